@@ -20,8 +20,14 @@ protected:
     void spawn(void);
     const actor_address& get_sender(void) const;
     const actor_address& get_self(void) const;
+    // 创建这个actor的actor_system，还没有被spawn时是默认的实例
+    class actor_system& get_system(void) const;
     const void enroll_creator(void) const;
     void quit(void);
+    virtual void on_hibernate(void);
+    virtual void on_wakeup(void);
+    // 长时间运行的处理函数定期调用，返回true时应该保存进度(比如给自己发一条继续的消息)后返回
+    bool yield_point(void);
 
     template<typename... Types>
     void handle(void(*func)(Types...));
@@ -51,6 +57,8 @@ private:
 private:
     actor_address m_sender;
     actor_address m_self;
+    class actor_system* m_system;
+    bool m_blocking;
     std::map<size_t, class caller> m_handlers;
 
     template<typename Actor>
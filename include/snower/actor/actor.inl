@@ -31,39 +31,43 @@ void actor::unhandle(void)
 template<typename... Types>
 void actor::reply(Types... args)
 {
-    singleton<actor_system>::get_instance().send_as(get_self(), get_sender(), std::forward<Types>(args)...);
+    get_system().send_as(get_self(), get_sender(), std::forward<Types>(args)...);
 }
 
 template<typename... Types>
 void actor::send(const actor_address& receiver, Types... args)
 {
-    singleton<actor_system>::get_instance().send_as(get_self(), receiver, std::forward<Types>(args)...);
+    get_system().send_as(get_self(), receiver, std::forward<Types>(args)...);
 }
 
 template<typename... Types>
 void actor::forward(const actor_address& next, Types... args)
 {
-    singleton<actor_system>::get_instance().send_as(get_sender(), next, std::forward<Types>(args)...);
+    get_system().send_as(get_sender(), next, std::forward<Types>(args)...);
 }
 
 template<typename... Types>
 bool actor::call(Types&&... args)
 {
-    logger& l = singletons<logger>::get_instance("actor");
+    logger& l = SNOWER_LOGGER("actor");
     l.INFO("正在准备调用");
     auto iter = m_handlers.find(caller::caller_hash<Types...>());
     if(iter == m_handlers.end())
     {
-        l.INFO("类型的hash值是：", caller::caller_hash<Types...>());
-        l.INFO("m_handlers中有 ", m_handlers.size(), " 个handle");
+        // 发错消息的一方可能一直在发，这一段每个调用点按SNOWER_LOG_LIMIT_PER_SECOND限流
+        l.INFO_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "类型的hash值是：", caller::caller_hash<Types...>());
+        l.INFO_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "m_handlers中有 ", m_handlers.size(), " 个handle");
+        if(l.enabled(logger::LEVEL_INFO))
         {
-            l.INFO("他们的Hash分别是");
+            // 拼成一行，限流时不会只留下半截列表
+            std::ostringstream hashes;
             for(auto& i : m_handlers)
             {
-                l.INFO(i.first);
+                hashes << " " << i.first;
             }
+            l.INFO_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "他们的Hash分别是", hashes.str());
         }
-        l.WARN("没有找到对应的handle");
+        l.WARN_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "没有找到对应的handle");
         return false;
     }
     else
@@ -9,6 +9,8 @@ namespace snower
 namespace actor
 {
 
+class actor_system;
+
 class actor_local_id final
 {
 public:
@@ -39,6 +41,8 @@ public:
 private:
     uint64_t m_id;
     std::string m_name;
+    // 创建这个actor的actor_system，由actor_system登记时设置
+    actor_system* m_system;
 };
 
 class actor_remote_id final
@@ -85,6 +89,8 @@ public:
     bool is_local(void) const;
     operator actor_local_id(void) const;
     operator actor_remote_id(void) const;
+    // 地址所属的actor_system，actor已经停止或者不是本地地址时返回nullptr
+    actor_system* get_system(void) const;
 
 private:
     actor_address(const std::shared_ptr<actor_local_id>& lid);
@@ -1,6 +1,9 @@
 #ifndef __SNOWER_ACTOR_ACTOR_SYSTEM_H__
 #define __SNOWER_ACTOR_ACTOR_SYSTEM_H__
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <unordered_map>
 #include <memory>
 #include <mutex>
@@ -17,6 +20,22 @@ namespace actor
 
 class actor_system
 {
+public:
+    enum { REDUCTION_BUDGET = 2000 };
+    // 休眠检查每次从actor表里复制出的actor数
+    enum { HIBERNATE_CHUNK = 1024 };
+
+private:
+    // 当前线程上正在执行的一次邮箱激活，处理一条消息、发送一条消息、调用一次yield_point各消耗一个reduction
+    struct activation
+    {
+        bool m_active;
+        bool m_blocking;
+        class actor_system* m_system;
+        uint32_t m_reductions;
+        uint32_t m_budget;
+    };
+
 private:
     using addr_ref = std::shared_ptr<class actor_local_id>;
     using mailbox_item = std::function<void()>;
@@ -26,17 +45,64 @@ private:
     using id_actor_map_type = std::unordered_map<uint64_t, actor_map_item>;
     using actor_bundle = std::tuple<bool, addr_ref, mailbox_ref, actor_ref>;
 
-private:
-    actor_system(void) {}
-    ~actor_system(void) {}
-
 public:
+    // 每个实例有自己的线程池、actor表和配置，默认实例由singleton<actor_system>提供给spawn/send等自由函数使用；
+    // 地址记得自己所属的实例，发给其他实例的actor的消息直接进对方的邮箱
+    actor_system(void)
+    : m_hibernate_sec(0)
+    , m_last_hibernate(0)
+    , m_budget(REDUCTION_BUDGET)
+    , m_accepting(true)
+    , m_expired(false)
+    , m_inflight(0)
+    , m_scheduled(0)
+    , m_thread_pool(0)
+    , m_blocking_pool(0)
+    {
+        m_thread_pool.set_tick_hook([this](){ check_hibernate(); });
+    }
+    // 不等待剩下的消息，正在处理的消息处理完后回收工作线程
+    ~actor_system(void)
+    {
+        shutdown(std::chrono::steady_clock::now());
+    }
+    actor_system(const actor_system&) = delete;
+    actor_system& operator = (const actor_system&) = delete;
+
     actor_ref get_actor(const actor_local_id& addr);
     void stop(const class actor_address& addr);
     bool valid_name(const std::string& name) const;
+    // 空闲超过seconds秒的actor被休眠，由线程池的控制线程定期检查，0表示不自动休眠
+    void set_hibernate_seconds(uint32_t seconds);
+    void hibernate_idle_actors(void);
+    // 所有已发送的消息都处理完、没有邮箱在线程池中排队时返回，超过deadline返回false
+    bool wait_for_all_actor_done(const std::chrono::steady_clock::time_point& deadline);
+    void wait_for_all_actor_done(void);
+    // 不再接受新消息，在deadline之前尽量处理完已有的消息，然后停止并回收工作线程；
+    // 返回false表示到deadline时还有消息没有处理完(这些消息不会再被处理)
+    bool shutdown(const std::chrono::steady_clock::time_point& deadline);
+    // shutdown之后重新开始接受消息
+    void start(void);
+    // 一次激活最多消耗的reduction数，用完后邮箱被重新排到线程池队尾，0表示不限制
+    void set_reduction_budget(uint32_t reductions);
+    // 消耗一个reduction，返回true表示本次激活的预算已经用完，处理函数应该保存进度后返回
+    static bool consume_reduction(void);
+    template<typename Strategy>
+    void set_idle_strategy(uint32_t spins = 1000, uint32_t yields = 100)
+    {
+        m_thread_pool.set_idle_strategy<Strategy>(spins, yields);
+    }
+    // 普通actor的工作线程绑定到拓扑分给它们的CPU上
+    void set_cpu_affinity(bool on = true)
+    {
+        m_thread_pool.set_cpu_affinity(on);
+    }
 
     template<typename Actor, typename... Types>
     actor_address spawn(Types&&... args);
+    // 处理函数里会调用阻塞接口(文件IO、同步的数据库客户端等)的actor，消息在单独的弹性线程池中处理，不占用普通actor的工作线程
+    template<typename Actor, typename... Types>
+    actor_address spawn_blocking(Types&&... args);
     template<typename Actor, typename... Types>
     actor_address spawned_by(const class actor_address& parent, Types&&... args);
     template<typename Actor, typename... Types>
@@ -49,7 +115,14 @@ public:
     void send_as(const actor_address& sender, const actor_address& receiver, Types&&... args);
 
 private:
-    void pool_mailbox(mailbox_ref mb);
+    void pool_mailbox(mailbox_ref mb, actor_ref act);
+    void check_hibernate(void);
+    static activation& current_activation(void);
+    bool enter_blocking(void);
+    void leave_blocking(void);
+    bool quiescent(void) const;
+    void message_done(size_t count = 1);
+    void schedule_done(void);
     uint64_t gen_id(void);
     std::string rand_name(void);
     std::string rand_name(uint64_t id);
@@ -67,10 +140,35 @@ private:
     id_actor_map_type m_actors;
     std::unordered_map<std::string, uint64_t> m_name_id_map;
     std::mutex m_lock_maps;
+    std::atomic<uint32_t> m_hibernate_sec;
+    std::atomic<std::chrono::steady_clock::rep> m_last_hibernate;
+    std::atomic<uint32_t> m_budget;
+    std::atomic<bool> m_accepting;
+    std::atomic<bool> m_expired;
+    // 已经进了邮箱还没处理完的消息数，已经提交给线程池还没结束的邮箱任务数
+    std::atomic<int64_t> m_inflight;
+    std::atomic<int64_t> m_scheduled;
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle_signal;
     thread_pool<Sequence> m_thread_pool;
+    thread_pool<Sequence, Elastic> m_blocking_pool;
     template<typename Actor>
     friend actor_address spawn(void);
-    friend class singleton<actor_system>;
+    friend class blocking_section;
+};
+
+// 普通actor的处理函数里偶尔要做一次阻塞调用时，在调用期间保持这个对象，
+// 线程池会临时多开一个线程顶替当前线程，其他actor不会因此饿死
+class blocking_section
+{
+public:
+    blocking_section(void);
+    ~blocking_section(void);
+    blocking_section(const blocking_section&) = delete;
+    blocking_section& operator = (const blocking_section&) = delete;
+
+private:
+    class actor_system* m_system;
 };
 
 template<typename Actor, typename... Types>
@@ -80,6 +178,13 @@ inline actor_address spawn(Types&&... args)
     return as.spawn<Actor, Types...>(std::forward<Types>(args)...);
 }
 
+template<typename Actor, typename... Types>
+inline actor_address spawn_blocking(Types&&... args)
+{
+    actor_system& as = singleton<actor_system>::get_instance();
+    return as.spawn_blocking<Actor, Types...>(std::forward<Types>(args)...);
+}
+
 template<typename Actor, typename... Types>
 inline actor_address spawned_by(const actor_address& addr, Types&&... args)
 {
@@ -101,27 +206,33 @@ inline actor_address spawn_and_named_by(const actor_address& addr, const std::st
     return as.spawn_and_named<Actor, Types...>(name, std::forward<Types>(args)...);
 }
 
+// 找不到地址所属的实例时交给默认实例，由它记录没有找到actor
+inline actor_system& system_of(const actor_address& addr)
+{
+    actor_system* as = addr.get_system();
+    return (as != nullptr) ? *as : singleton<actor_system>::get_instance();
+}
+
 inline void stop(const actor_address& addr)
 {
-    actor_system& as = singleton<actor_system>::get_instance();
-    as.stop(addr);
+    system_of(addr).stop(addr);
 }
 
 template<typename... Types>
 void send(const actor_address& receiver, Types... args)
 {
-    actor_system& as = singleton<actor_system>::get_instance();
-    as.send(receiver, std::forward<Types>(args)...);
+    system_of(receiver).send(receiver, std::forward<Types>(args)...);
 }
 template<typename... Types>
 void send_as(const actor_address& sender, const actor_address& receiver, Types... args)
 {
-    actor_system& as = singleton<actor_system>::get_instance();
-    as.send_as(sender, receiver, std::forward<Types>(args)...);
+    system_of(receiver).send_as(sender, receiver, std::forward<Types>(args)...);
 }
 
 void shutdown(void);
+bool shutdown(const std::chrono::steady_clock::time_point& deadline);
 void wait_for_all_actor_done(void);
+bool wait_for_all_actor_done(const std::chrono::steady_clock::time_point& deadline);
 
 } // namespace actor
 } // namespace snower 
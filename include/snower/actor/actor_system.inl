@@ -18,6 +18,18 @@ actor_address actor_system::spawn(Types&&... args)
     return add_actor(addr, a);
 }
 
+template<typename Actor, typename... Types>
+actor_address actor_system::spawn_blocking(Types&&... args)
+{
+    Actor* use = new Actor(std::forward<Types>(args)...);
+    class actor* a = static_cast<class actor*>(use);
+    a->m_blocking = true;
+    uint64_t id = gen_id();
+    std::string name = rand_name(id);
+    actor_local_id* addr = new actor_local_id(id, name);
+    return add_actor(addr, a);
+}
+
 template<typename Actor, typename... Types>
 actor_address actor_system::spawned_by(const actor_address& parent, Types&&... args)
 {
@@ -59,6 +71,23 @@ template<typename... Types>
 void actor_system::send_as(const actor_address& sender, const actor_address& addr, Types&&... args)
 {
     using namespace std;
+    // 接收者属于别的实例时直接交给它，不经过这个实例的actor表
+    actor_system* owner = addr.get_system();
+    if(owner != nullptr && owner != this)
+    {
+        owner->send_as(sender, addr, forward<Types>(args)...);
+        return;
+    }
+    // 先计数再检查m_accepting，和shutdown里先清标志再等计数归零相对：
+    // 要么shutdown等到这条消息处理完，要么这里看到已经关闭并撤回计数
+    m_inflight++;
+    if(!m_accepting)
+    {
+        message_done();
+        SNOWER_LOGGER("actor_system").WARN_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "actor system已经关闭，丢弃消息");
+        return;
+    }
+    consume_reduction();
     bool exist;
     addr_ref lid;
     mailbox_ref mb;
@@ -66,11 +95,11 @@ void actor_system::send_as(const actor_address& sender, const actor_address& add
     tie(exist, lid, mb, act) = get_actor_bundle(addr);
     if(exist && lid && mb && act)
     {
-        logger& l = singletons<logger>::get_instance("actor_system");
+        logger& l = SNOWER_LOGGER("actor_system");
         l.INFO("actor找到了");
         l.INFO("lambda之前 : " , sender);
         function<void(Types...)> f1([&, act, this, sender](Types&&... args){
-                logger& l = singletons<logger>::get_instance("actor_system");
+                logger& l = SNOWER_LOGGER("actor_system");
                 l.INFO("正在调用lambda...");
                 l.INFO("lambda中 : " , sender);
                 act->m_sender = sender;
@@ -80,16 +109,21 @@ void actor_system::send_as(const actor_address& sender, const actor_address& add
             });
         auto f2(bind(f1, forward<Types>(args)...));
         bool result = mb->push(f2);
+        if(!result)
+        {
+            message_done();
+        }
         l.INFO("加入函数，结果为", result);
         if(mb->add_to_pool())
         {
-            pool_mailbox(mb);
+            pool_mailbox(mb, act);
         }
     }
     else
     {
-        logger& l = singletons<logger>::get_instance("actor_system");
-        l.WARN("没有找到actor");
+        message_done();
+        logger& l = SNOWER_LOGGER("actor_system");
+        l.WARN_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "没有找到actor");
     }
 }
 
@@ -2,6 +2,7 @@
 #define __SNOWER_ACTOR_MAILBOX_H__
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -20,8 +21,13 @@ template<typename Item>
 class mailbox : public std::enable_shared_from_this<mailbox<Item>>
 {
 private:
+    using channel_type = channel<Item, 0>;
+
     mailbox(void)
-    : m_in_pool(false)
+    : m_mailbox(new channel_type())
+    , m_in_pool(false)
+    , m_hibernated(false)
+    , m_last_active(std::chrono::steady_clock::now())
     {
     }
     ~mailbox(void) { }
@@ -39,29 +45,40 @@ public:
     }
     bool push(const Item& func)
     {
-        singletons<logger>::get_instance("mailbox").INFO("邮箱中加入一个函数", " - const&");
-        return m_mailbox.try_push(func);
+        SNOWER_LOGGER("mailbox").INFO("邮箱中加入一个函数", " - const&");
+        std::lock_guard<std::mutex> locker(m_check_mutex);
+        return restore()->try_push(func);
     }
     bool push(Item&& func)
     {
-        singletons<logger>::get_instance("mailbox").INFO("邮箱中加入一个函数", " - &&");
-        return m_mailbox.try_push(std::move(func));
+        SNOWER_LOGGER("mailbox").INFO("邮箱中加入一个函数", " - &&");
+        std::lock_guard<std::mutex> locker(m_check_mutex);
+        return restore()->try_push(std::move(func));
     }
-    void clear(void)
+    // 返回丢弃的消息数
+    size_t clear(void)
     {
-        m_mailbox.clear();
+        std::lock_guard<std::mutex> locker(m_check_mutex);
+        size_t ret = 0;
+        if(m_mailbox)
+        {
+            ret = m_mailbox->size();
+            m_mailbox->clear();
+        }
+        return ret;
     }
     Item pop(void)
     {
         using namespace std;
         function<void()> ret;
-        tie(ignore, ret) = m_mailbox.try_pop();
+        // 只有占住邮箱的线程会调用pop，此时m_mailbox不会被释放
+        tie(ignore, ret) = m_mailbox->try_pop();
         return move(ret);
     }
     bool add_to_pool (void)
     {
         std::lock_guard<std::mutex> locker(m_check_mutex);
-        if(!m_in_pool.load() && m_mailbox.size() > 0)
+        if(!m_in_pool.load() && m_mailbox && m_mailbox->size() > 0)
         {
             m_in_pool.store(true);
             return true;
@@ -82,11 +99,55 @@ private:
     {
         std::lock_guard<std::mutex> locker(m_check_mutex);
         m_in_pool.store(false);
+        m_last_active = std::chrono::steady_clock::now();
+    }
+    // 空闲超过idle的邮箱会被占住，调用者执行完actor的休眠hook后必须调用hibernate_done
+    bool hibernate(const std::chrono::steady_clock::duration& idle)
+    {
+        using namespace std::chrono;
+        std::lock_guard<std::mutex> locker(m_check_mutex);
+        if(m_in_pool.load() || m_hibernated || (steady_clock::now() - m_last_active) < idle)
+        {
+            return false;
+        }
+        if(m_mailbox && !m_mailbox->empty())
+        {
+            return false;
+        }
+        m_in_pool.store(true);
+        return true;
+    }
+    void hibernate_done(void)
+    {
+        std::lock_guard<std::mutex> locker(m_check_mutex);
+        if(m_mailbox && m_mailbox->empty())
+        {
+            m_mailbox.reset();
+        }
+        m_hibernated = true;
+        m_in_pool.store(false);
+    }
+    bool wakeup(void)
+    {
+        std::lock_guard<std::mutex> locker(m_check_mutex);
+        bool ret = m_hibernated;
+        m_hibernated = false;
+        return ret;
+    }
+    channel_type* restore(void)
+    {
+        if(!m_mailbox)
+        {
+            m_mailbox.reset(new channel_type());
+        }
+        return m_mailbox.get();
     }
 
 private:
-    channel<Item, 0> m_mailbox;
+    std::unique_ptr<channel_type> m_mailbox;
     std::atomic<bool> m_in_pool;
+    bool m_hibernated;
+    std::chrono::steady_clock::time_point m_last_active;
     std::mutex m_check_mutex;
     friend class actor_system;
 };
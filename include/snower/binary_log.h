@@ -0,0 +1,510 @@
+#ifndef __SNOWER_BINARY_LOG_H__
+#define __SNOWER_BINARY_LOG_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <snower/log_format.h>
+
+namespace snower
+{
+
+// 二进制日志：每个调用点只在第一次写日志时登记一次文件、函数、行号和参数类型，
+// 之后每条日志只保存调用点编号、级别、时间、线程号和参数的原始字节，格式化留给log_decode离线去做。
+// 文件内容全部按本机字节序：
+//   文件头   "SNWBLOG1" u32进程号 u32格式长度 格式
+//   logger   u8(ENTRY_LOGGER) u16编号 u16名字长度 名字
+//   调用点   u8(ENTRY_SITE) u32编号 i32行号 u16长度 文件 u16长度 函数 u8参数个数 每个参数一个u8类型
+//   日志     u8(ENTRY_RECORD) u32调用点 u16 logger u8级别 u64微秒时间 u64线程号 参数
+//   文本     u8(ENTRY_TEXT) u32长度 已经格式化好的一行
+// 参数：BOOL/CHAR 1字节，INT/UINT/DOUBLE/POINTER 8字节，STRING/TEXT u32长度加内容
+class binary_log_file
+{
+public:
+    enum entry_kind
+    {
+        ENTRY_LOGGER = 1,
+        ENTRY_SITE,
+        ENTRY_RECORD,
+        ENTRY_TEXT,
+    };
+    enum arg_type
+    {
+        ARG_BOOL = 1,
+        ARG_CHAR,
+        ARG_INT,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_POINTER,
+        ARG_STRING,
+        ARG_TEXT,       // 其他类型在调用者线程上用operator<<转成文本保存
+    };
+    enum { MAGIC_SIZE = 8, CHUNK_SIZE = 64 * 1024, MAX_SITES = 65536, RECORD_HEADER = 24 };
+    // 排队的缓冲超过MAX_PENDING个时写日志的线程自己去写；攒着的日志最多过FLUSH_INTERVAL_MS毫秒写到文件
+    enum { MAX_PENDING = 64, MAX_FREE = 16, FLUSH_INTERVAL_MS = 1000 };
+    static const char MAGIC[MAGIC_SIZE + 1];
+
+private:
+    struct buffer
+    {
+        // 从m_start开始的内容还没有写到文件，前面的已经被collect复制走了
+        size_t m_start;
+        size_t m_size;
+        char m_data[CHUNK_SIZE];
+    };
+    using buffer_ref = std::unique_ptr<buffer>;
+    // 每个线程先把日志攒在自己的块里，只有这个线程往缓冲里写，每写完一条只是发布一次新的长度，不加锁；
+    // 收集攒着的日志时拿着m_mutex复制已经发布的部分，写的线程只在缓冲满了换缓冲时才拿m_mutex
+    struct chunk
+    {
+        chunk(void)
+        : m_committed(0)
+        , m_taken(0)
+        {
+        }
+        std::atomic<size_t> m_committed;
+        // 已经被复制走的长度，拿着m_mutex读写
+        size_t m_taken;
+        buffer_ref m_buffer;
+        std::mutex m_mutex;
+    };
+
+public:
+    // format是解码时使用的格式，与log_appender的格式相同；文件打不开时之后的日志都被丢弃
+    binary_log_file(const std::string& name, const std::string& format);
+    ~binary_log_file(void);
+    binary_log_file(const binary_log_file&) = delete;
+    binary_log_file& operator = (const binary_log_file&) = delete;
+
+    const log_format& format(void) const
+    {
+        return *m_format;
+    }
+    bool is_open(void) const
+    {
+        return m_fd >= 0;
+    }
+    // 同名的logger得到同一个编号
+    uint16_t define_logger(const std::string& name);
+    // slot是调用点自己的静态变量，第一次调用时分配编号
+    template<typename... Types>
+    void write(uint16_t logger_id, std::atomic<uint32_t>& slot, const log_record& r, const Types&... args);
+    // 没有调用点编号的日志(直接调用logger::log/logf)在调用者线程上格式化，按文本保存
+    template<typename... Types>
+    void write_line(const log_format& format, const log_record& r, const Types&... args);
+    // 把各个线程攒着的日志写到文件
+    void flush(void);
+
+private:
+    static uint32_t site_id(std::atomic<uint32_t>& slot)
+    {
+        uint32_t ret = slot.load(std::memory_order_acquire);
+        return (ret != 0) ? ret : assign_site_id(slot);
+    }
+    static uint32_t assign_site_id(std::atomic<uint32_t>& slot);
+    void define_site(uint32_t site, const log_record& r, const uint8_t* types, size_t count);
+    template<typename Output>
+    static void put_header(Output& out, uint32_t site, uint16_t logger_id, const log_record& r);
+    template<typename... Types>
+    void write_record(uint32_t site, uint16_t logger_id, const log_record& r, std::false_type, const Types&... args);
+    template<typename... Types>
+    void write_record(uint32_t site, uint16_t logger_id, const log_record& r, std::true_type, const Types&... args);
+    void append(const std::string& data);
+    chunk& local_chunk(void)
+    {
+        // 按文件的序号缓存，文件销毁后新建的文件即使地址相同也不会用到旧的块
+        static thread_local uint64_t cached_serial = 0;
+        static thread_local chunk* cached_chunk = nullptr;
+        if(cached_serial != m_serial)
+        {
+            cached_chunk = &register_chunk();
+            cached_serial = m_serial;
+        }
+        return *cached_chunk;
+    }
+    chunk& register_chunk(void);
+    buffer_ref new_buffer(void);
+    // 写的线程把写满的缓冲换下来排队
+    void rotate(chunk& c);
+    // 把各个块里已经发布的日志复制出来排队，wait为false时跳过正在换缓冲的块
+    void collect(bool wait);
+    void write_queued(void);
+    void write_all(const char* data, size_t size);
+    void writer_thread(void);
+
+private:
+    int m_fd;
+    uint64_t m_serial;
+    log_format_ref m_format;
+    std::unique_ptr<std::atomic<bool>[]> m_defined;
+    std::map<std::string, uint16_t> m_loggers;
+    std::unordered_map<std::thread::id, std::unique_ptr<chunk>> m_chunks;
+    std::mutex m_chunks_mutex;
+    // 同一个块换下来的缓冲按顺序排队，一个线程的日志在文件里也是按顺序的
+    std::deque<buffer_ref> m_queue;
+    std::vector<buffer_ref> m_free;
+    std::mutex m_queue_mutex;
+    std::condition_variable m_queue_signal;
+    std::mutex m_write_mutex;
+    // 调用点/logger的登记直接写文件，总是在用到它们的日志之前
+    std::mutex m_file_mutex;
+    bool m_running;
+    std::thread m_thread;
+};
+
+using binary_log_ref = std::shared_ptr<binary_log_file>;
+
+// 把binary_log_file写的文件还原成log_appender会输出的文本
+class binary_log_reader
+{
+private:
+    struct site_info
+    {
+        std::string m_file;
+        std::string m_func;
+        int m_line;
+        std::vector<uint8_t> m_types;
+    };
+
+public:
+    // format为空时使用文件头里记录的格式
+    binary_log_reader(std::istream& is, const std::string& format = std::string());
+
+    // 文件头是否正确
+    bool good(void) const
+    {
+        return m_format != nullptr;
+    }
+    // 把下一条日志输出到os，文件结束或者内容不完整时返回false
+    bool next(std::ostream& os);
+
+private:
+    template<typename T>
+    bool get(T& value)
+    {
+        return m_is.read(reinterpret_cast<char*>(&value), sizeof(value)).gcount() == sizeof(value);
+    }
+    template<typename Length>
+    bool get_string(std::string& value)
+    {
+        Length len;
+        if(!get(len))
+        {
+            return false;
+        }
+        value.resize(len);
+        return len == 0 || m_is.read(&value[0], len).gcount() == (std::streamsize)len;
+    }
+    bool read_site(void);
+    bool read_record(std::ostream& os);
+    bool read_arg(uint8_t type, std::string& text);
+
+private:
+    std::istream& m_is;
+    pid_t m_pid;
+    log_format_ref m_format;
+    std::map<uint16_t, std::string> m_loggers;
+    std::unordered_map<uint32_t, site_info> m_sites;
+    std::vector<std::string> m_args;
+    native::log_buffer m_text;
+};
+
+namespace native
+{
+
+template<typename T>
+struct is_char_type : std::integral_constant<bool,
+    std::is_same<T, char>::value || std::is_same<T, signed char>::value || std::is_same<T, unsigned char>::value>
+{
+};
+
+// 参数按decay之后的类型保存，输出结果要和ostream直接输出原来的值一样：
+// char*按字符串，signed/unsigned char*也被ostream当作字符串，只好转成文本；函数指针ostream输出的是bool，同样转成文本
+template<typename T>
+struct binary_arg_type : std::integral_constant<uint8_t,
+    std::is_same<T, bool>::value ? binary_log_file::ARG_BOOL
+    : is_char_type<T>::value ? binary_log_file::ARG_CHAR
+    : std::is_integral<T>::value ? (std::is_signed<T>::value ? binary_log_file::ARG_INT : binary_log_file::ARG_UINT)
+    : (std::is_same<T, float>::value || std::is_same<T, double>::value) ? binary_log_file::ARG_DOUBLE
+    : (std::is_same<T, char*>::value || std::is_same<T, const char*>::value || std::is_same<T, std::string>::value) ? binary_log_file::ARG_STRING
+    : (std::is_pointer<T>::value && std::is_object<typename std::remove_pointer<T>::type>::value
+        && !is_char_type<typename std::remove_cv<typename std::remove_pointer<T>::type>::type>::value) ? binary_log_file::ARG_POINTER
+    : binary_log_file::ARG_TEXT>
+{
+};
+
+template<typename... Types>
+struct has_text_arg : std::false_type
+{
+};
+
+template<typename T, typename... Types>
+struct has_text_arg<T, Types...> : std::integral_constant<bool,
+    binary_arg_type<T>::value == binary_log_file::ARG_TEXT || has_text_arg<Types...>::value>
+{
+};
+
+template<typename... Types>
+struct string_arg_count : std::integral_constant<size_t, 0>
+{
+};
+
+template<typename T, typename... Types>
+struct string_arg_count<T, Types...> : std::integral_constant<size_t,
+    (binary_arg_type<T>::value == binary_log_file::ARG_STRING ? 1 : 0) + string_arg_count<Types...>::value>
+{
+};
+
+// 直接写到事先算好大小的内存里，字符串参数的长度用算大小时记下的，不再strlen一次
+struct raw_output
+{
+    void append(const void* data, size_t size)
+    {
+        memcpy(m_pos, data, size);
+        m_pos += size;
+    }
+    char* m_pos;
+    const size_t* m_lens;
+};
+
+template<typename Output, typename T>
+inline void put_value(Output& out, T value)
+{
+    out.append(&value, sizeof(value));
+}
+
+template<typename Output>
+inline void put_string(Output& out, const char* data, size_t size)
+{
+    put_value(out, (uint32_t)size);
+    out.append(data, size);
+}
+
+// 固定长度参数的字节数，要和put_arg写的一致
+template<uint8_t Type>
+struct fixed_arg_size : std::integral_constant<size_t, 8>
+{
+};
+
+template<>
+struct fixed_arg_size<binary_log_file::ARG_BOOL> : std::integral_constant<size_t, 1>
+{
+};
+
+template<>
+struct fixed_arg_size<binary_log_file::ARG_CHAR> : std::integral_constant<size_t, 1>
+{
+};
+
+inline size_t string_size(const char* value)
+{
+    return (value != nullptr) ? strlen(value) : 0;
+}
+
+inline size_t string_size(const std::string& value)
+{
+    return value.size();
+}
+
+template<typename T, uint8_t Type>
+inline size_t arg_size(size_t*, const T&, std::integral_constant<uint8_t, Type>)
+{
+    return fixed_arg_size<Type>::value;
+}
+
+template<typename T>
+inline size_t arg_size(size_t* lens, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_STRING>)
+{
+    *lens = string_size(value);
+    return 4 + *lens;
+}
+
+inline size_t args_size(size_t*)
+{
+    return 0;
+}
+
+// 字符串参数的长度按顺序记在lens里
+template<typename T, typename... Types>
+inline size_t args_size(size_t* lens, const T& value, const Types&... args)
+{
+    using type = typename std::decay<T>::type;
+    return arg_size(lens, value, binary_arg_type<type>())
+        + args_size(lens + string_arg_count<type>::value, args...);
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer*, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_BOOL>)
+{
+    put_value(out, (uint8_t)(value ? 1 : 0));
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer*, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_CHAR>)
+{
+    put_value(out, (char)value);
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer*, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_INT>)
+{
+    put_value(out, (int64_t)value);
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer*, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_UINT>)
+{
+    put_value(out, (uint64_t)value);
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer*, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_DOUBLE>)
+{
+    put_value(out, (double)value);
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer*, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_POINTER>)
+{
+    put_value(out, (uint64_t)(uintptr_t)value);
+}
+
+template<typename Output>
+inline void put_arg(Output& out, log_buffer*, const char* value, std::integral_constant<uint8_t, binary_log_file::ARG_STRING>)
+{
+    // 空指针按空字符串保存
+    put_string(out, value, string_size(value));
+}
+
+template<typename Output>
+inline void put_arg(Output& out, log_buffer*, const std::string& value, std::integral_constant<uint8_t, binary_log_file::ARG_STRING>)
+{
+    put_string(out, value.data(), value.size());
+}
+
+inline void put_arg(raw_output& out, log_buffer*, const char* value, std::integral_constant<uint8_t, binary_log_file::ARG_STRING>)
+{
+    put_string(out, value, *out.m_lens++);
+}
+
+inline void put_arg(raw_output& out, log_buffer*, const std::string& value, std::integral_constant<uint8_t, binary_log_file::ARG_STRING>)
+{
+    put_string(out, value.data(), *out.m_lens++);
+}
+
+template<typename Output, typename T>
+inline void put_arg(Output& out, log_buffer* scratch, const T& value, std::integral_constant<uint8_t, binary_log_file::ARG_TEXT>)
+{
+    scratch->reset();
+    *scratch << value;
+    put_string(out, scratch->text().data(), scratch->text().size());
+}
+
+template<typename Output>
+inline void put_args(Output&, log_buffer*)
+{
+}
+
+template<typename Output, typename T, typename... Types>
+inline void put_args(Output& out, log_buffer* scratch, const T& value, const Types&... args)
+{
+    using type = typename std::decay<T>::type;
+    put_arg(out, scratch, value, binary_arg_type<type>());
+    put_args(out, scratch, args...);
+}
+
+} // namespace native
+
+template<typename... Types>
+void binary_log_file::write(uint16_t logger_id, std::atomic<uint32_t>& slot, const log_record& r, const Types&... args)
+{
+    uint32_t site = site_id(slot);
+    if(site >= MAX_SITES)
+    {
+        write_line(*m_format, r, args...);
+        return;
+    }
+    if(!m_defined[site].load(std::memory_order_acquire))
+    {
+        // 末尾多放一个0，没有参数时数组也不为空
+        static const uint8_t types[] = { native::binary_arg_type<typename std::decay<Types>::type>::value..., 0 };
+        define_site(site, r, types, sizeof...(Types));
+    }
+    write_record(site, logger_id, r, native::has_text_arg<typename std::decay<Types>::type...>(), args...);
+}
+
+template<typename Output>
+void binary_log_file::put_header(Output& out, uint32_t site, uint16_t logger_id, const log_record& r)
+{
+    native::put_value(out, (uint8_t)ENTRY_RECORD);
+    native::put_value(out, site);
+    native::put_value(out, logger_id);
+    native::put_value(out, (uint8_t)r.m_level);
+    native::put_value(out, (uint64_t)r.m_time.tv_sec * 1000000 + r.m_time.tv_usec);
+    native::put_value(out, r.m_tid);
+}
+
+// 参数都能直接保存时，先算出大小，再在本线程的块里就地编码
+template<typename... Types>
+void binary_log_file::write_record(uint32_t site, uint16_t logger_id, const log_record& r, std::false_type, const Types&... args)
+{
+    size_t lens[native::string_arg_count<typename std::decay<Types>::type...>::value + 1];
+    size_t size = RECORD_HEADER + native::args_size(lens, args...);
+    if(size > CHUNK_SIZE)
+    {
+        write_record(site, logger_id, r, std::true_type(), args...);
+        return;
+    }
+    chunk& c = local_chunk();
+    if(c.m_buffer->m_size + size > CHUNK_SIZE)
+    {
+        rotate(c);
+    }
+    buffer& b = *c.m_buffer;
+    native::raw_output out = { b.m_data + b.m_size, lens };
+    put_header(out, site, logger_id, r);
+    native::put_args(out, (native::log_buffer*)nullptr, args...);
+    b.m_size += size;
+    c.m_committed.store(b.m_size, std::memory_order_release);
+}
+
+// 有参数要先转成文本时先编码到缓冲里：operator<<里又写日志的话不会占着块
+template<typename... Types>
+void binary_log_file::write_record(uint32_t site, uint16_t logger_id, const log_record& r, std::true_type, const Types&... args)
+{
+    native::log_buffer_scope buffers;
+    native::log_buffer& out = buffers.get(0);
+    out.reset();
+    put_header(out, site, logger_id, r);
+    native::put_args(out, &buffers.get(1), args...);
+    append(out.text());
+}
+
+template<typename... Types>
+void binary_log_file::write_line(const log_format& format, const log_record& r, const Types&... args)
+{
+    native::log_buffer_scope buffers;
+    native::log_buffer& line = buffers.get(1);
+    line.reset();
+    format.render(line, r, args...);
+    native::log_buffer& out = buffers.get(0);
+    out.reset();
+    native::put_value(out, (uint8_t)ENTRY_TEXT);
+    native::put_string(out, line.text().data(), line.text().size());
+    append(out.text());
+}
+
+} // namespace snower
+
+#endif // __SNOWER_BINARY_LOG_H__
@@ -0,0 +1,147 @@
+#ifndef __SNOWER_EVENT_COUNT_H__
+#define __SNOWER_EVENT_COUNT_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif // __linux__
+
+namespace snower
+{
+
+// 等待者先prepare_wait取得当前纪元，再检查一次条件，条件仍不满足才wait
+// 通知方只有在确实有等待者时才会进入内核
+class event_count
+{
+public:
+    using key_type = uint32_t;
+
+public:
+    event_count(void)
+    : m_epoch(0)
+    , m_waiters(0)
+    {
+    }
+    event_count(const event_count&) = delete;
+    event_count& operator = (const event_count&) = delete;
+
+    key_type prepare_wait(void)
+    {
+        key_type key = m_epoch.load(std::memory_order_acquire);
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return key;
+    }
+    void cancel_wait(void)
+    {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    template<typename Rep, typename Period>
+    bool wait_for(key_type key, const std::chrono::duration<Rep, Period>& rel_time)
+    {
+        using namespace std::chrono;
+        bool ret = do_wait(key, duration_cast<nanoseconds>(rel_time));
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return ret;
+    }
+    void notify_one(void)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_waiters.load(std::memory_order_seq_cst) > 0)
+        {
+            m_epoch.fetch_add(1, std::memory_order_release);
+            do_wake(1);
+        }
+    }
+    // 最多唤醒count个等待者，批量提交任务时用
+    void notify_many(uint32_t count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t waiters = m_waiters.load(std::memory_order_seq_cst);
+        if(waiters > 0 && count > 0)
+        {
+            m_epoch.fetch_add(1, std::memory_order_release);
+            do_wake((int)std::min(count, waiters));
+        }
+    }
+    void notify_all(void)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_epoch.fetch_add(1, std::memory_order_release);
+        if(m_waiters.load(std::memory_order_seq_cst) > 0)
+        {
+            do_wake(INT32_MAX);
+        }
+    }
+    uint32_t waiters(void) const
+    {
+        return m_waiters.load(std::memory_order_relaxed);
+    }
+
+private:
+#ifdef __linux__
+    bool do_wait(key_type key, const std::chrono::nanoseconds& rel_time)
+    {
+        using namespace std::chrono;
+        steady_clock::time_point deadline = steady_clock::now() + rel_time;
+        while(m_epoch.load(std::memory_order_acquire) == key)
+        {
+            nanoseconds left = duration_cast<nanoseconds>(deadline - steady_clock::now());
+            if(left.count() <= 0)
+            {
+                return false;
+            }
+            struct timespec ts;
+            ts.tv_sec = left.count() / 1000000000;
+            ts.tv_nsec = left.count() % 1000000000;
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, key, &ts, nullptr, 0);
+        }
+        return true;
+    }
+    void do_wake(int count)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+#else
+    bool do_wait(key_type key, const std::chrono::nanoseconds& rel_time)
+    {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        return m_signal.wait_for(locker, rel_time, [&](){ return m_epoch.load(std::memory_order_acquire) != key; });
+    }
+    void do_wake(int count)
+    {
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+        }
+        if(count == 1)
+        {
+            m_signal.notify_one();
+        }
+        else
+        {
+            m_signal.notify_all();
+        }
+    }
+#endif // __linux__
+
+private:
+    std::atomic<uint32_t> m_epoch;
+    std::atomic<uint32_t> m_waiters;
+#ifndef __linux__
+    std::mutex m_mutex;
+    std::condition_variable m_signal;
+#endif // __linux__
+};
+
+} // namespace snower
+
+#endif // __SNOWER_EVENT_COUNT_H__
@@ -0,0 +1,55 @@
+#ifndef __SNOWER_LOG_CLOCK_H__
+#define __SNOWER_LOG_CLOCK_H__
+
+#include <sys/time.h>
+#include <time.h>
+#include <stddef.h>
+
+namespace snower
+{
+
+// 日志的时间戳：取时间的方式可选，格式化时每个线程缓存当前这一秒的日期时间部分，只格式化微秒
+class log_clock
+{
+public:
+    enum source
+    {
+        CLOCK_SOURCE_REALTIME,      // clock_gettime(CLOCK_REALTIME)，和gettimeofday一样精确
+        CLOCK_SOURCE_COARSE,        // CLOCK_REALTIME_COARSE，最便宜，精度只有一个时钟节拍(通常1~4毫秒)
+        CLOCK_SOURCE_TSC,           // 由TSC推算，每个线程每隔RESYNC_MS毫秒用CLOCK_REALTIME校准一次；不是x86时用CLOCK_MONOTONIC推算
+    };
+    enum { RESYNC_MS = 100, CALIBRATE_MS = 5 };
+    // format()需要的缓冲大小，"2007-12-25 01:45:32:123456"是26个字符，年份超过4位时会更长
+    enum { TIME_BUFFER_SIZE = 40 };
+
+public:
+    static void now(source src, struct timeval& tv)
+    {
+        struct timespec ts;
+        switch(src)
+        {
+        case CLOCK_SOURCE_COARSE:
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            break;
+
+        case CLOCK_SOURCE_TSC:
+            now_tsc(tv);
+            return;
+
+        default:
+            clock_gettime(CLOCK_REALTIME, &ts);
+        }
+        tv.tv_sec = ts.tv_sec;
+        tv.tv_usec = ts.tv_nsec / 1000;
+    }
+    // 按"2007-12-25 01:45:32:123456"格式化到buf，buf至少TIME_BUFFER_SIZE字节，返回长度；
+    // 同一秒之内只有第一次调用localtime_r/gmtime_r和snprintf
+    static size_t format(char* buf, const struct timeval& tv, bool utc);
+
+private:
+    static void now_tsc(struct timeval& tv);
+};
+
+} // namespace snower
+
+#endif // __SNOWER_LOG_CLOCK_H__
@@ -0,0 +1,206 @@
+#ifndef __SNOWER_LOG_FORMAT_H__
+#define __SNOWER_LOG_FORMAT_H__
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace snower
+{
+
+// 一条日志除参数以外的全部信息，调用时填好，格式化时才转成文本；只含指针和数值，复制没有开销
+struct log_record
+{
+    const char* m_file;
+    const char* m_func;
+    const char* m_name;
+    int m_line;
+    int m_level;
+    // pthread_self()，输出和std::thread::id一样
+    uint64_t m_tid;
+    // 0表示当前进程，解码二进制日志时填文件里记录的进程号
+    pid_t m_pid;
+    struct timeval m_time;
+};
+
+// 预先解析好的日志格式：
+//   %F 文件  %f 函数  %l 行号  %N logger名  %L 级别  %p 进程号  %t 线程号  %T 本地时间  %U UTC时间
+//   %m 输出下一个参数  %M 输出剩下的全部参数  %% 输出%
+class log_format
+{
+public:
+    enum token_kind
+    {
+        TOKEN_TEXT,
+        TOKEN_FILE,
+        TOKEN_FUNC,
+        TOKEN_LINE,
+        TOKEN_NAME,
+        TOKEN_LEVEL,
+        TOKEN_PID,
+        TOKEN_TID,
+        TOKEN_TIME,
+        TOKEN_UTC_TIME,
+        TOKEN_NEXT_ARG,
+        TOKEN_ALL_ARGS,
+        TOKEN_UNKNOWN,
+    };
+
+private:
+    struct token
+    {
+        token_kind m_kind;
+        std::string m_text;
+    };
+
+public:
+    explicit log_format(const std::string& format);
+    // 相同的格式串返回同一个对象，使用同一格式的appender因此可以共享格式化结果
+    static std::shared_ptr<const log_format> compile(const std::string& format);
+    // 日志宏把编译好的格式缓存在调用点，之后只比较一次格式串，格式串变了(传的是变量)才重新编译；
+    // compile()的结果一直留在缓存里，所以可以只记指针
+    static const log_format& compile(std::atomic<const log_format*>& cache, const char* format, size_t len)
+    {
+        const log_format* ret = cache.load(std::memory_order_acquire);
+        if(ret == nullptr || ret->m_source.compare(0, std::string::npos, format, len) != 0)
+        {
+            ret = compile(std::string(format, len)).get();
+            cache.store(ret, std::memory_order_release);
+        }
+        return *ret;
+    }
+
+    const std::string& source(void) const
+    {
+        return m_source;
+    }
+    // 标准级别返回名字，介于两个标准级别之间的返回靠近的那个加上+/-
+    static const char* level_name(int level);
+    template<typename... Types>
+    void render(std::ostream& os, const log_record& r, const Types&... args) const
+    {
+        render_from(os, r, 0, args...);
+        os << '\n';
+    }
+    // 参数已经是输出好的文本，结果与render()相同，解码二进制日志时用
+    void render_texts(std::ostream& os, const log_record& r, const std::vector<std::string>& args) const;
+
+private:
+    template<typename T, typename... Types>
+    void render_from(std::ostream& os, const log_record& r, size_t index, const T& value, const Types&... args) const
+    {
+        for(size_t i = index; i < m_tokens.size(); i++)
+        {
+            const token& t = m_tokens[i];
+            switch(t.m_kind)
+            {
+            case TOKEN_NEXT_ARG:
+                os << value;
+                render_from(os, r, i + 1, args...);
+                return;
+
+            case TOKEN_ALL_ARGS:
+                render_args(os, value, args...);
+                break;
+
+            case TOKEN_UNKNOWN:
+                // 还有参数时未知的格式什么也不输出，留给以后扩展
+                break;
+
+            default:
+                render_token(os, r, t);
+            }
+        }
+    }
+    // 参数已经用完，%m/%M原样输出
+    void render_from(std::ostream& os, const log_record& r, size_t index) const;
+    void render_token(std::ostream& os, const log_record& r, const token& t) const;
+    static void render_args(std::ostream&)
+    {
+    }
+    template<typename T, typename... Types>
+    static void render_args(std::ostream& os, const T& value, const Types&... args)
+    {
+        os << value;
+        render_args(os, args...);
+    }
+
+private:
+    std::string m_source;
+    std::vector<token> m_tokens;
+};
+
+using log_format_ref = std::shared_ptr<const log_format>;
+
+namespace native
+{
+
+// 追加到std::string的输出流，清空时保留容量，反复使用时格式化常见的日志不用再分配内存
+class log_buffer : private std::streambuf, public std::ostream
+{
+public:
+    log_buffer(void)
+    : std::ostream(static_cast<std::streambuf*>(this))
+    {
+        m_text.reserve(256);
+    }
+    void reset(void)
+    {
+        m_text.clear();
+        clear();
+    }
+    // 直接追加原始字节，不经过ostream
+    void append(const void* data, size_t size)
+    {
+        m_text.append(static_cast<const char*>(data), size);
+    }
+    const std::string& text(void) const
+    {
+        return m_text;
+    }
+
+private:
+    virtual std::streambuf::int_type overflow(std::streambuf::int_type c)
+    {
+        if(c != std::streambuf::traits_type::eof())
+        {
+            m_text.push_back((char)c);
+        }
+        return c;
+    }
+    virtual std::streamsize xsputn(const char* s, std::streamsize n)
+    {
+        m_text.append(s, (size_t)n);
+        return n;
+    }
+
+private:
+    std::string m_text;
+};
+
+// 本线程上一次格式化用的一组缓冲；格式化参数时又写了日志(比如operator<<里)的话，内层用另一组，不会覆盖外层
+class log_buffer_scope
+{
+public:
+    log_buffer_scope(void);
+    ~log_buffer_scope(void);
+    log_buffer_scope(const log_buffer_scope&) = delete;
+    log_buffer_scope& operator = (const log_buffer_scope&) = delete;
+
+    log_buffer& get(size_t index);
+
+private:
+    std::vector<std::unique_ptr<log_buffer>>& m_buffers;
+};
+
+} // namespace native
+
+} // namespace snower
+
+#endif // __SNOWER_LOG_FORMAT_H__
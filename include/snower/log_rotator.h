@@ -0,0 +1,69 @@
+#ifndef __SNOWER_LOG_ROTATOR_H__
+#define __SNOWER_LOG_ROTATOR_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <snower/task.h>
+
+namespace snower
+{
+
+// 日志文件切换的后台线程：关闭旧文件、改名、清理和压缩旧文件、预先打开下一个文件都在这里按提交顺序执行，
+// 写日志的线程切换文件时只需要换一个文件描述符
+class log_rotator
+{
+public:
+    enum { TICK_MS = 100 };
+
+private:
+    log_rotator(void);
+
+public:
+    // 和async_log_writer一样故意不析构，进程退出时由stop()执行完剩下的任务；fork出的子进程里会换成新实例
+    static log_rotator& get_instance(void);
+    // 停止以后提交的任务直接在调用者线程上执行
+    void post(task&& job);
+    // 返回时，调用之前提交的任务都已经执行完
+    void wait(void);
+    void stop(void);
+    // 有tick时后台线程每TICK_MS调用一次，文件对象用它把超过刷新间隔的缓冲写出去；tick里不能做耗时的事
+    void add_tick(const void* owner, std::function<void ()>&& tick);
+    // 返回后owner的tick不会再被调用
+    void remove_tick(const void* owner);
+    // 用系统的gzip压缩name，成功时name被替换成name.gz
+    static bool gzip(const std::string& name);
+
+private:
+    void worker_thread(void);
+    void run_ticks(void);
+    static void on_exit(void);
+    static void prepare_fork(void);
+    static void after_fork_parent(void);
+    static void after_fork_child(void);
+
+private:
+    std::deque<task> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_signal;
+    std::condition_variable m_done_signal;
+    uint64_t m_posted;
+    uint64_t m_done;
+    bool m_running;
+    // m_ticks_mutex在调用tick期间一直拿着，remove_tick因此会等正在执行的tick结束
+    std::map<const void*, std::function<void ()>> m_ticks;
+    std::mutex m_ticks_mutex;
+    std::atomic<bool> m_has_ticks;
+    std::thread m_thread;
+    std::mutex m_thread_mutex;
+};
+
+} // namespace snower
+
+#endif // __SNOWER_LOG_ROTATOR_H__
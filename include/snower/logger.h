@@ -2,90 +2,32 @@
 #define __SNOWER_LOGGER_H__
 
 #include <sys/time.h>
+#include <pthread.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <thread>
 #include <vector>
+#include <snower/binary_log.h>
+#include <snower/event_count.h>
+#include <snower/log_clock.h>
+#include <snower/log_format.h>
+#include <snower/log_rotator.h>
+#include <snower/mmap_log.h>
+#include <snower/singleton.h>
+#include <snower/spsc_ring.h>
+#include <snower/task.h>
 
 namespace snower
 {
 
-using tag_func = std::function<void (std::ostream&)>;
-using log_datas = std::vector<tag_func>;
-
-inline void log_to_stream(std::ostream& os) {}
-
-template<typename T, typename... Types>
-void log_to_stream(std::ostream& os, T value, Types... args)
-{
-    os << value;
-    log_to_stream(os, args...);
-}
-
-void log_to_stream(std::ostream& os, const log_datas& ld, const char* format);
-
-template<typename T, typename... Types>
-void log_to_stream(std::ostream& os, const log_datas& ld, const char* format, T value, Types... args)
-{
-    for(; *format != '\0'; format++)
-    {
-        if(*format == '%')
-        {
-            format++;
-            if(*format != '\0')
-            {
-                switch(*format)
-                {
-                case 'F':
-                    ld[0](os); break;
-
-                case 'f':
-                    ld[1](os); break;
-
-                case 'l':
-                    ld[2](os); break;
-
-                case 'N':
-                    ld[3](os); break;
-
-                case 'L':
-                    ld[4](os); break;
-
-                case 'p':
-                    ld[5](os); break;
-
-                case 't':
-                    ld[6](os); break;
-
-                case 'T':
-                    ld[7](os); break;
-
-                case '%':
-                    os << '%'; break;
-
-                case 'm':
-                    os << value;
-                    log_to_stream(os, ld, format + 1, args...);
-                    return;
-
-                case 'M':
-                    log_to_stream(os, value, args...); break;
-
-                default:;
-                    // 允许用户扩展
-                }
-            }
-        }
-        else
-        {
-            os << *format;
-        }
-    }
-}
-
 class log_appender
 {
 public:
@@ -93,30 +35,33 @@ public:
     log_appender(const std::string& format);
     log_appender(std::string&& format);
     virtual ~log_appender(void) {}
-    template<typename... Types>
-    void write(const log_datas& ld, Types... args)
+    const log_format& format(void) const
     {
-        using namespace std;
-        stringstream ss;
-        log_to_stream(ss, ld, m_format.c_str(), forward<Types>(args)...);
-        ss << endl;
-        do_write(ss.str());
+        return *m_format;
     }
-    template<typename... Types>
-    void writef(const std::string& format, const log_datas& ld, Types... args)
+    // log_msg是已经按format()格式化好的一整行
+    void write(const std::string& log_msg)
     {
-        using namespace std;
-        stringstream ss;
-        log_to_stream(ss, ld, format.c_str(), forward<Types>(args)...);
-        ss << endl;
-        do_write(ss.str());
+        do_write(log_msg);
+    }
+    // level是这一行日志的级别，logger写日志时走这里
+    void write(const std::string& log_msg, int level)
+    {
+        do_write_level(log_msg, level);
     }
+    // 把已经写出的内容刷到终端/文件
+    virtual void flush(void) {}
 
 protected:
     virtual void do_write(const std::string& log_msg) = 0;
+    // 需要按级别处理的appender(比如遇到WARN立即刷新的文件)覆盖这个
+    virtual void do_write_level(const std::string& log_msg, int)
+    {
+        do_write(log_msg);
+    }
 
 private:
-    std::string m_format;
+    log_format_ref m_format;
 };
 
 using log_appender_ref = std::shared_ptr<log_appender>;
@@ -125,6 +70,7 @@ class console_appender : public log_appender
 {
 public:
     using log_appender::log_appender;
+    virtual void flush(void);
 
 protected:
     virtual void do_write(const std::string& log_msg);
@@ -134,6 +80,7 @@ class stderr_appender : public log_appender
 {
 public:
     using log_appender::log_appender;
+    virtual void flush(void);
 
 protected:
     virtual void do_write(const std::string& log_msg);
@@ -193,28 +140,50 @@ public:
     , m_file_obj(std::move(file_obj))
     {
     }
+    virtual void flush(void)
+    {
+        m_file_obj->flush();
+    }
 
 protected:
     virtual void do_write(const std::string& log_msg)
     {
         m_file_obj->write(log_msg);
     }
+    virtual void do_write_level(const std::string& log_msg, int level)
+    {
+        m_file_obj->write(log_msg, level);
+    }
 
 private:
     file_ref m_file_obj;
 };
 
+// 日志文件：内容先攒在用户态的缓冲里，缓冲满了、距上次写盘超过flush_interval、或者遇到flush_level及以上的日志时，
+// 用一次write/writev写到O_APPEND打开的文件描述符，每一批日志只有一次系统调用；没有新日志时由log_rotator的后台线程
+// 每TICK_MS检查一次，缓冲里的内容最多在flush_interval之后再晚一个TICK_MS写出去；
+// 需要切换文件时换上log_rotator预先打开的临时文件，关闭、改名和清理都在后台做
 class file_object_base
 {
+public:
+    enum
+    {
+        DEFAULT_BUFFER_SIZE = 64 * 1024,
+        DEFAULT_FLUSH_INTERVAL_MS = 1000,
+        DEFAULT_FLUSH_LEVEL = 50,           // logger::LEVEL_WARN
+    };
+
 public:
     template<typename Duration = int>
     file_object_base(const std::string& name, size_t size, Duration&& rel_time = Duration(0))
     : m_file_name(get_abs_path_name(name))
     , m_truncate_size(size)
+    , m_fd(-1)
     , m_file_size(0)
     {
         using namespace std;
         using namespace std::chrono;
+        init_file();
         get_postfix_from_time = [](const system_clock::time_point& t) -> string {
             char name[64] = {0};
             time_t tm_t = system_clock::to_time_t(t);
@@ -225,24 +194,73 @@ public:
     }
     virtual ~file_object_base(void);
 
-    void write(const std::string& msg);
+    // 没有级别的按0处理，只受缓冲大小和时间间隔控制
+    void write(const std::string& msg, int level = 0);
+    void flush(void);
+    // 缓冲攒够size字节才写文件，0表示每一行都直接写
+    void set_buffer_size(size_t size);
+    void set_flush_interval(const std::chrono::milliseconds& interval);
+    void set_flush_level(int level);
 
 protected:
     virtual void check_file(size_t add_len, bool time_out, const std::chrono::system_clock::time_point& now) = 0;
+    bool is_open(void) const
+    {
+        return m_fd >= 0;
+    }
+    // 先把缓冲写进当前文件再打开新文件，切换文件时不会把旧内容写到新文件里
+    void open_file(const std::string& name, bool truncate);
+    void close_file(void);
+    // 换到下一个文件：name和closed都在log_rotator的后台线程里调用，name给出新文件的名字，临时文件改成这个名字，
+    // closed拿到刚关闭的旧文件的名字；第一次打开时直接在调用者线程上按name()打开
+    void rotate_file(const std::function<std::string ()>& name, const std::function<void (const std::string&)>& closed = nullptr);
 
 private:
+    // 写日志的线程和后台任务共用，文件对象析构以后后台任务还可能拿着它
+    struct rotation_state
+    {
+        std::mutex m_mutex;
+        int m_next_fd;
+        std::string m_next_name;
+        // 正在写的文件改名以后的名字
+        std::string m_current;
+        uint64_t m_serial;
+        bool m_closed;
+    };
+    using rotation_ref = std::shared_ptr<rotation_state>;
+
     static std::string get_abs_path_name(const std::string& name);
+    static std::string temp_name(rotation_state& state, const std::string& base);
+    static void prepare_next(const rotation_ref& state, const std::string& base);
+    void init_file(void);
+    // log_rotator的tick调用，距上次写盘超过flush_interval时写出缓冲
+    void flush_due(void);
+    void flush_buffer(void);
+    void write_through(const std::string& msg);
+    void write_all(const char* data, size_t size);
 
 protected:
     std::string m_file_name;
     size_t m_truncate_size;
-    std::ofstream m_file;
+    int m_fd;
     size_t m_file_size;
     std::chrono::system_clock::time_point m_file_open_time;
     std::mutex m_file_mutex;
 
     std::function<std::chrono::system_clock::time_point(const std::chrono::system_clock::time_point&)> get_next_open_time;
     std::function<std::string(const std::chrono::system_clock::time_point&)> get_postfix_from_time;
+    // file_splitted用：保留的文件个数和旧文件的压缩方式
+    size_t m_keep_files;
+    std::function<void (const std::string&)> m_compress;
+
+private:
+    rotation_ref m_rotation;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_buffer_size;
+    size_t m_buffered;
+    std::chrono::milliseconds m_flush_interval;
+    int m_flush_level;
+    std::chrono::system_clock::time_point m_last_flush;
 };
 
 class file_infinite : public file_object_base
@@ -273,26 +291,164 @@ class file_splitted : public file_object_base
 public:
     using file_object_base::file_object_base;
     ~file_splitted(void);
+    // 连同正在写的文件一共保留count个，更早的在后台删掉，0表示不删
+    void set_max_files(size_t count);
+    // 旧文件关闭后在后台调用，比如log_rotator::gzip
+    void set_compressor(const std::function<void (const std::string&)>& compress);
 
 private:
     virtual void check_file(size_t add_len, bool time_out, const std::chrono::system_clock::time_point& now);
 };
 
-#define TRACE(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_TRACE, ##__VA_ARGS__)
-#define DEBUG(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_DEBUG, ##__VA_ARGS__)
-#define INFO(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_INFO, ##__VA_ARGS__)
-#define LOG(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_LOG, ##__VA_ARGS__)
-#define WARN(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_WARN, ##__VA_ARGS__)
-#define ERROR(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_ERROR, ##__VA_ARGS__)
-#define FATAL(...) log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_FATAL, ##__VA_ARGS__)
-
-#define TRACEF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_TRACE, ##__VA_ARGS__)
-#define DEBUGF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_DEBUG, ##__VA_ARGS__)
-#define INFOF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_INFO, ##__VA_ARGS__)
-#define LOGF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_LOG, ##__VA_ARGS__)
-#define WARNF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_WARN, ##__VA_ARGS__)
-#define ERRORF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_ERROR, ##__VA_ARGS__)
-#define FATALF(...) logf(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_FATAL, ##__VA_ARGS__)
+// 异步日志的后台写线程：每个写日志的线程有自己的无锁环形缓冲，缓冲里放的是“格式化并写入”的闭包，
+// 后台线程轮流从各个缓冲中批量取出执行，格式化和IO都不在调用者线程上
+class async_log_writer
+{
+public:
+    enum overflow_policy
+    {
+        OVERFLOW_BLOCK,     // 缓冲满时调用者等待后台线程腾出空间
+        OVERFLOW_DROP,      // 缓冲满时丢弃这条日志，计入dropped()
+    };
+    enum { DEFAULT_CAPACITY = 4096, BATCH = 256 };
+    // 一条记录连同logger指针占64字节，剩下的放参数，常见的几个参数不需要在堆上分配
+    using record_task = basic_task<128>;
+
+private:
+    using ring_type = spsc_ring<record_task>;
+    using ring_ref = std::shared_ptr<ring_type>;
+
+    async_log_writer(void);
+
+public:
+    // 故意不析构：进程退出时有的logger和线程还可能在写日志，退出时只由stop()停掉后台线程；
+    // fork出的子进程里没有父进程的后台线程，会换成一个新的实例
+    static async_log_writer& get_instance(void);
+    // 写完缓冲中的日志后停止后台线程，之后的日志在调用者线程上同步写；进程退出时会自动调用
+    void stop(void);
+    // 返回false表示按OVERFLOW_DROP丢弃了
+    bool post(record_task&& record);
+    // 返回时，调用之前提交的日志都已经写完并刷到了各个appender
+    void flush(void);
+    void set_overflow_policy(overflow_policy policy);
+    // 只影响之后才开始写日志的线程
+    void set_ring_capacity(size_t capacity);
+    uint64_t dropped(void) const;
+    // 后台线程空闲、flush以及进程崩溃时调用，用来刷新各个logger的appender
+    void add_flush_hook(const void* owner, std::function<void ()>&& hook);
+    void remove_flush_hook(const void* owner);
+    // 收到SIGSEGV/SIGBUS/SIGFPE/SIGILL/SIGABRT时先把缓冲中的日志写出去，再按默认方式处理信号
+    void install_crash_handler(void);
+
+private:
+    ring_type& local_ring(void);
+    void writer_thread(void);
+    size_t drain(size_t max, bool force = false);
+    void run_flush_hooks(void);
+    static bool& in_writer(void);
+    static void on_exit(void);
+    static void prepare_fork(void);
+    static void after_fork_parent(void);
+    static void after_fork_child(void);
+    static void on_fatal_signal(int sig);
+
+private:
+    std::vector<ring_ref> m_rings;
+    std::mutex m_rings_mutex;
+    std::map<const void*, std::function<void ()>> m_hooks;
+    std::mutex m_hooks_mutex;
+    std::atomic<size_t> m_capacity;
+    std::atomic<int> m_overflow;
+    std::atomic<uint64_t> m_dropped;
+    // 后台线程和崩溃处理函数都可能消费缓冲，同一时刻只能有一个
+    std::atomic<bool> m_consuming;
+    std::atomic<bool> m_running;
+    std::atomic<uint64_t> m_flush_requests;
+    std::atomic<uint64_t> m_flush_done;
+    event_count m_wakeup;
+    std::mutex m_flush_mutex;
+    std::condition_variable m_flush_signal;
+    std::thread m_thread;
+    std::mutex m_thread_mutex;
+};
+
+// 编译期的日志级别下限，低于它的日志宏在编译时就被去掉，比如-DSNOWER_LOG_MIN_LEVEL=50只保留WARN及以上；
+// 在宏展开处判断，所以各个编译单元可以用不同的下限
+#ifndef SNOWER_LOG_MIN_LEVEL
+#define SNOWER_LOG_MIN_LEVEL 0
+#endif // SNOWER_LOG_MIN_LEVEL
+
+// l.INFO(...)展开成l.gate(...)->*[&](...){ ... }，先判断级别，满足时才对参数求值；
+// lambda里的静态变量是这个调用点的编号，二进制模式下用它代替文件、函数、行号和参数类型
+#define SNOWER_LOG_AT(level, ...) gate((level) >= SNOWER_LOG_MIN_LEVEL, level, __FILE__, __FUNCTION__, __LINE__)->*[&](const snower::log_site& snower_log_site_){ static std::atomic<uint32_t> snower_log_slot_(0); snower_log_site_.at(snower_log_slot_)(__VA_ARGS__); }
+#define SNOWER_LOGF_AT(level, ...) gate((level) >= SNOWER_LOG_MIN_LEVEL, level, __FILE__, __FUNCTION__, __LINE__)->*[&](const snower::log_site& snower_log_site_){ static std::atomic<const snower::log_format*> snower_log_format_(nullptr); snower_log_site_.format(snower_log_format_, __VA_ARGS__); }
+// 取名字对应的logger并缓存在调用点的静态变量里，之后每次只是读一个引用：logger& l = SNOWER_LOGGER("actor");
+#define SNOWER_LOGGER(name) ([]() -> snower::logger& { static snower::logger& snower_logger_ = snower::log_registry::get_instance().get(name); return snower_logger_; }())
+// 限流的调用点：每秒最多per_second行(0表示不限)，每one_in条只写一条(小于2表示不抽样)，限流器也是lambda里的静态变量；
+// 被丢掉的条数攒起来，放行时距上次汇总超过一秒就先写一行汇总
+#define SNOWER_LOG_LIMIT_AT(level, per_second, one_in, ...) gate((level) >= SNOWER_LOG_MIN_LEVEL, level, __FILE__, __FUNCTION__, __LINE__)->*[&](const snower::log_site& snower_log_site_){ static std::atomic<uint32_t> snower_log_slot_(0); static snower::log_limiter snower_log_limiter_(per_second, one_in); if(snower_log_limiter_.pass(snower_log_site_)) snower_log_site_.at(snower_log_slot_)(__VA_ARGS__); }
+
+// 库里出错时可能每条消息都会走到的警告(比如发给已经停止的actor)用的限速，每个调用点每秒的行数
+#ifndef SNOWER_LOG_LIMIT_PER_SECOND
+#define SNOWER_LOG_LIMIT_PER_SECOND 10
+#endif // SNOWER_LOG_LIMIT_PER_SECOND
+
+#define TRACE(...) SNOWER_LOG_AT(logger::LEVEL_TRACE, __VA_ARGS__)
+#define DEBUG(...) SNOWER_LOG_AT(logger::LEVEL_DEBUG, __VA_ARGS__)
+#define INFO(...) SNOWER_LOG_AT(logger::LEVEL_INFO, __VA_ARGS__)
+#define LOG(...) SNOWER_LOG_AT(logger::LEVEL_LOG, __VA_ARGS__)
+#define WARN(...) SNOWER_LOG_AT(logger::LEVEL_WARN, __VA_ARGS__)
+#define ERROR(...) SNOWER_LOG_AT(logger::LEVEL_ERROR, __VA_ARGS__)
+#define FATAL(...) SNOWER_LOG_AT(logger::LEVEL_FATAL, __VA_ARGS__)
+
+#define TRACEF(...) SNOWER_LOGF_AT(logger::LEVEL_TRACE, __VA_ARGS__)
+#define DEBUGF(...) SNOWER_LOGF_AT(logger::LEVEL_DEBUG, __VA_ARGS__)
+#define INFOF(...) SNOWER_LOGF_AT(logger::LEVEL_INFO, __VA_ARGS__)
+#define LOGF(...) SNOWER_LOGF_AT(logger::LEVEL_LOG, __VA_ARGS__)
+#define WARNF(...) SNOWER_LOGF_AT(logger::LEVEL_WARN, __VA_ARGS__)
+#define ERRORF(...) SNOWER_LOGF_AT(logger::LEVEL_ERROR, __VA_ARGS__)
+#define FATALF(...) SNOWER_LOGF_AT(logger::LEVEL_FATAL, __VA_ARGS__)
+
+#define TRACE_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_TRACE, per_second, 0, __VA_ARGS__)
+#define DEBUG_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_DEBUG, per_second, 0, __VA_ARGS__)
+#define INFO_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_INFO, per_second, 0, __VA_ARGS__)
+#define LOG_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_LOG, per_second, 0, __VA_ARGS__)
+#define WARN_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_WARN, per_second, 0, __VA_ARGS__)
+#define ERROR_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_ERROR, per_second, 0, __VA_ARGS__)
+#define FATAL_LIMIT(per_second, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_FATAL, per_second, 0, __VA_ARGS__)
+
+#define TRACE_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_TRACE, 0, one_in, __VA_ARGS__)
+#define DEBUG_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_DEBUG, 0, one_in, __VA_ARGS__)
+#define INFO_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_INFO, 0, one_in, __VA_ARGS__)
+#define LOG_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_LOG, 0, one_in, __VA_ARGS__)
+#define WARN_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_WARN, 0, one_in, __VA_ARGS__)
+#define ERROR_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_ERROR, 0, one_in, __VA_ARGS__)
+#define FATAL_SAMPLE(one_in, ...) SNOWER_LOG_LIMIT_AT(logger::LEVEL_FATAL, 0, one_in, __VA_ARGS__)
+
+class log_gate;
+
+namespace native
+{
+
+// 异步写日志时参数要复制到后台线程：C字符串可能指向调用者的栈或者马上释放的std::string，复制成std::string；
+// 其它参数按值复制
+template<typename T>
+inline const T& async_arg(const T& value)
+{
+    return value;
+}
+
+inline std::string async_arg(const char* value)
+{
+    return (value != nullptr) ? std::string(value) : std::string();
+}
+
+inline std::string async_arg(char* value)
+{
+    return async_arg((const char*)value);
+}
+
+} // namespace native
 
 class logger final
 {
@@ -321,6 +477,22 @@ public:
     void enable(bool on = true);
     void set_top_level(int level);
     void set_level(int level);
+    // 开启后日志在async_log_writer的后台线程里格式化和写入；参数按值保存，指针参数指向的内容要活到写完为止
+    void set_async(bool on = true);
+    // 选择取日志时间的方式，默认CLOCK_SOURCE_REALTIME
+    void set_clock(log_clock::source src);
+    // 开启后带调用点编号的日志(日志宏)只把参数的原始字节写到file里，用log_decode还原成文本，不再经过appender；
+    // 传空指针关闭
+    void set_binary(const binary_log_ref& file);
+    // 同步模式下刷新各个appender，异步模式下还会等已经提交的日志都写完
+    void flush(void);
+    // 没有appender的logger也算关闭
+    bool enabled(int level) const
+    {
+        return level >= m_floor.load(std::memory_order_relaxed) && level <= m_top_level.load(std::memory_order_relaxed);
+    }
+    // 日志宏用的入口，compiled是编译期下限的判断结果，级别不满足时返回的对象不会执行日志语句
+    log_gate gate(bool compiled, int level, const char* file, const char* func, int line);
 
     template<typename... Types>
     void log(const char* file, const char* func, int line, int level, Types... args)
@@ -334,32 +506,31 @@ public:
         {
             level = LEVEL_ALL;
         }
-        if(m_enable && level >= m_level && level <= m_top_level)
+        if(enabled(level))
         {
-            log_datas ld;
-            ld.emplace_back([file](ostream& os) { os << file; });
-            ld.emplace_back([func](ostream& os) { os << func; });
-            ld.emplace_back([line](ostream& os) { os << line; });
-            ld.emplace_back([this](ostream& os) { os << this->m_logger_name; });
-            string level_name = level_to_name(level);
-            ld.emplace_back([level_name](ostream& os) { os << level_name; });
-            auto pid = getpid();
-            ld.emplace_back([pid](ostream& os) { os << pid; });
-            auto tid = this_thread::get_id();
-            ld.emplace_back([tid](ostream& os) { os << tid; });
-            auto now = m_get_time_func();
-            ld.emplace_back([now](ostream& os) { os << now; });
+            log_record r = make_record(file, func, line, level);
+            if(m_binary)
             {
-                lock_guard<mutex> locker(m_appenders_mutex);
-                for(log_appender_ref& a : m_appenders)
-                {
-                    a->write(ld, forward<Types>(args)...);
-                }
+                m_binary->write_line(m_binary->format(), r, args...);
+            }
+            else if(m_async)
+            {
+                post_appenders(r, native::async_arg(args)...);
+            }
+            else
+            {
+                write_appenders(r, args...);
             }
         }
     }
     template<typename... Types>
     void logf(const char* file, const char* func, int line, int level, const std::string& format, Types... args)
+    {
+        logf(file, func, line, level, *log_format::compile(format), args...);
+    }
+    // f必须一直有效，log_format::compile()返回的格式都满足
+    template<typename... Types>
+    void logf(const char* file, const char* func, int line, int level, const log_format& f, Types... args)
     {
         using namespace std;
         if(level > LEVEL_NONE)
@@ -370,45 +541,344 @@ public:
         {
             level = LEVEL_ALL;
         }
-        if(m_enable && level >= m_level && level <= m_top_level)
+        if(enabled(level))
         {
-            log_datas ld;
-            ld.emplace_back([file](ostream& os) { os << file; });
-            ld.emplace_back([func](ostream& os) { os << func; });
-            ld.emplace_back([line](ostream& os) { os << line; });
-            ld.emplace_back([this](ostream& os) { os << this->m_logger_name; });
-            string level_name = level_to_name(level);
-            ld.emplace_back([level_name](ostream& os) { os << level_name; });
-            auto pid = getpid();
-            ld.emplace_back([pid](ostream& os) { os << pid; });
-            auto tid = this_thread::get_id();
-            ld.emplace_back([tid](ostream& os) { os << tid; });
-            auto now = m_get_time_func();
-            ld.emplace_back([now](ostream& os) { os << now; });
+            log_record r = make_record(file, func, line, level);
+            if(m_binary)
             {
-                lock_guard<mutex> locker(m_appenders_mutex);
-                for(log_appender_ref& a : m_appenders)
-                {
-                    a->writef(format, ld, forward<Types>(args)...);
-                }
+                m_binary->write_line(f, r, args...);
             }
+            else if(m_async)
+            {
+                // 编译好的格式一直留在缓存里，异步时只需要带上指针
+                postf_appenders(f, r, native::async_arg(args)...);
+            }
+            else
+            {
+                writef_appenders(f, r, args...);
+            }
+        }
+    }
+
+    // slot是调用点的编号，只在二进制模式下使用
+    template<typename... Types>
+    void log_at(std::atomic<uint32_t>& slot, const char* file, const char* func, int line, int level, const Types&... args)
+    {
+        if(!m_binary)
+        {
+            log(file, func, line, level, args...);
+            return;
+        }
+        if(level > LEVEL_NONE)
+        {
+            level = LEVEL_NONE;
+        }
+        if(level < LEVEL_ALL)
+        {
+            level = LEVEL_ALL;
+        }
+        if(enabled(level))
+        {
+            m_binary->write(m_binary_logger, slot, make_record(file, func, line, level), args...);
         }
     }
 
 private:
-    std::string get_time_string(void);
-    std::string level_to_name(int level);
+    enum { SHARED_FORMATS = 4 };
+
+    log_record make_record(const char* file, const char* func, int line, int level) const
+    {
+        log_record r;
+        r.m_file = file;
+        r.m_func = func;
+        r.m_name = m_logger_name.c_str();
+        r.m_line = line;
+        r.m_level = level;
+        r.m_tid = (uint64_t)pthread_self();
+        r.m_pid = 0;
+        log_clock::now(m_clock, r.m_time);
+        return r;
+    }
+    // args已经经过native::async_arg，可以放心地按值带到后台线程
+    template<typename... Types>
+    void post_appenders(const log_record& r, const Types&... args)
+    {
+        async_log_writer::get_instance().post([this, r, args...](){ write_appenders(r, args...); });
+    }
+    // 编译好的格式一直留在缓存里，异步时只需要带上指针
+    template<typename... Types>
+    void postf_appenders(const log_format& format, const log_record& r, const Types&... args)
+    {
+        const log_format* f = &format;
+        async_log_writer::get_instance().post([this, f, r, args...](){ writef_appenders(*f, r, args...); });
+    }
+    // 每种格式只格式化一次，格式相同的appender共用结果
+    template<typename... Types>
+    void write_appenders(const log_record& r, const Types&... args)
+    {
+        std::lock_guard<std::mutex> locker(m_appenders_mutex);
+        native::log_buffer_scope buffers;
+        const log_format* rendered[SHARED_FORMATS];
+        size_t count = 0;
+        for(log_appender_ref& a : m_appenders)
+        {
+            const log_format* f = &a->format();
+            size_t i = 0;
+            while(i < count && rendered[i] != f)
+            {
+                i++;
+            }
+            native::log_buffer& buf = buffers.get(i);
+            if(i == count)
+            {
+                buf.reset();
+                f->render(buf, r, args...);
+                if(count < SHARED_FORMATS)
+                {
+                    rendered[count++] = f;
+                }
+            }
+            a->write(buf.text(), r.m_level);
+        }
+    }
+    template<typename... Types>
+    void writef_appenders(const log_format& format, const log_record& r, const Types&... args)
+    {
+        std::lock_guard<std::mutex> locker(m_appenders_mutex);
+        native::log_buffer_scope buffers;
+        native::log_buffer& buf = buffers.get(0);
+        buf.reset();
+        format.render(buf, r, args...);
+        for(log_appender_ref& a : m_appenders)
+        {
+            a->write(buf.text(), r.m_level);
+        }
+    }
+    void flush_appenders(void);
+    void update_floor(void);
 
 private:
     std::string m_logger_name;
     bool m_enable;
-    int m_top_level;
+    bool m_async;
+    // enabled()读的两个值是原子的，运行时改级别不用和写日志的线程同步；改的一方拿着m_appenders_mutex
+    std::atomic<int> m_top_level;
     int m_level;
+    // 实际生效的下限：关闭或者既没有appender也没有二进制文件时是LEVEL_NONE + 1，否则是m_level
+    std::atomic<int> m_floor;
+    log_clock::source m_clock;
+    binary_log_ref m_binary;
+    uint16_t m_binary_logger;
     std::vector<log_appender_ref> m_appenders;
     std::mutex m_appenders_mutex;
-    std::function<std::string()> m_get_time_func;
 };
 
+class log_call;
+
+class log_site
+{
+public:
+    log_site(logger& l, int level, const char* file, const char* func, int line)
+    : m_logger(l)
+    , m_level(level)
+    , m_file(file)
+    , m_func(func)
+    , m_line(line)
+    {
+    }
+    template<typename... Types>
+    void operator () (Types&&... args) const
+    {
+        m_logger.log(m_file, m_func, m_line, m_level, std::forward<Types>(args)...);
+    }
+    // cache是调用点缓存的编译好的格式
+    template<typename... Types>
+    void format(std::atomic<const log_format*>& cache, const char* format, Types&&... args) const
+    {
+        m_logger.logf(m_file, m_func, m_line, m_level, log_format::compile(cache, format, strlen(format)), std::forward<Types>(args)...);
+    }
+    template<typename... Types>
+    void format(std::atomic<const log_format*>& cache, const std::string& format, Types&&... args) const
+    {
+        m_logger.logf(m_file, m_func, m_line, m_level, log_format::compile(cache, format.data(), format.size()), std::forward<Types>(args)...);
+    }
+    log_call at(std::atomic<uint32_t>& slot) const;
+
+private:
+    friend class log_limiter;
+    logger& m_logger;
+    int m_level;
+    const char* m_file;
+    const char* m_func;
+    int m_line;
+};
+
+// 带上了调用点编号的log_site
+class log_call
+{
+public:
+    log_call(logger& l, std::atomic<uint32_t>& slot, int level, const char* file, const char* func, int line)
+    : m_logger(l)
+    , m_slot(slot)
+    , m_level(level)
+    , m_file(file)
+    , m_func(func)
+    , m_line(line)
+    {
+    }
+    template<typename... Types>
+    void operator () (const Types&... args) const
+    {
+        m_logger.log_at(m_slot, m_file, m_func, m_line, m_level, args...);
+    }
+
+private:
+    logger& m_logger;
+    std::atomic<uint32_t>& m_slot;
+    int m_level;
+    const char* m_file;
+    const char* m_func;
+    int m_line;
+};
+
+inline log_call log_site::at(std::atomic<uint32_t>& slot) const
+{
+    return log_call(m_logger, slot, m_level, m_file, m_func, m_line);
+}
+
+class log_gate
+{
+public:
+    log_gate(logger& l, bool pass, int level, const char* file, const char* func, int line)
+    : m_pass(pass)
+    , m_site(l, level, file, func, line)
+    {
+    }
+    template<typename Body>
+    void operator ->* (Body&& body) const
+    {
+        if(m_pass)
+        {
+            body(m_site);
+        }
+    }
+
+private:
+    bool m_pass;
+    log_site m_site;
+};
+
+// 一个日志调用点的限流：令牌桶(按GCRA只保存一个理论到达时间，一次CAS)限制每秒的行数，计数器做1/N抽样
+class log_limiter
+{
+public:
+    enum { REPORT_INTERVAL_MS = 1000 };
+
+public:
+    // burst是空闲一段时间后可以连着写的行数，0表示和per_second一样
+    log_limiter(uint32_t per_second, uint32_t one_in, uint32_t burst = 0);
+    ~log_limiter(void);
+    log_limiter(const log_limiter&) = delete;
+    log_limiter& operator = (const log_limiter&) = delete;
+    // 这一条是否放行；放行时如果有没汇总的丢弃，先在site上写一行汇总
+    bool pass(const log_site& site);
+    // 一共丢掉的条数
+    uint64_t suppressed(void) const
+    {
+        return m_total.load(std::memory_order_relaxed);
+    }
+    // 调用点安静下来以后也要报告丢弃的条数：log_rotator的后台线程定期调用(only为空)，距上次汇总超过间隔的才写；
+    // logger::flush时只处理写到这个logger的，不等间隔
+    static void report_pending(const logger* only = nullptr);
+    // logger析构时调用，之后不再往它上面写汇总，没汇总的条数留到调用点下一次放行时报告
+    static void forget(const logger* l);
+
+private:
+    bool take(int64_t now);
+    // 汇总行也占限速的额度，没有额度时留到下一次
+    void report(const log_site& site, int64_t now, bool force = false);
+
+private:
+    int64_t m_interval;
+    int64_t m_tolerance;
+    uint32_t m_one_in;
+    std::atomic<int64_t> m_tat;
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_pending;
+    std::atomic<uint64_t> m_total;
+    std::atomic<int64_t> m_last_report;
+    // 汇总行的参数和被限流的日志不一样，二进制模式下要用自己的调用点
+    std::atomic<uint32_t> m_slot;
+    // 最近一次丢弃的调用点，report_pending用它写汇总；只在攒下第一条丢弃时更新
+    std::mutex m_site_mutex;
+    logger* m_site_logger;
+    int m_site_level;
+    const char* m_site_file;
+    const char* m_site_func;
+    int m_site_line;
+};
+
+// 按名字找logger的全局表：logger建好以后地址不变，直到进程退出时才析构；
+// 每个桶是只在头上添加的链表，查找只读原子指针，不加锁，只有新建logger时拿锁
+class log_registry
+{
+private:
+    log_registry(void);
+
+public:
+    ~log_registry(void);
+    static log_registry& get_instance(void);
+    // 没有时新建一个
+    logger& get(const std::string& name);
+    logger* find(const std::string& name) const;
+    // 运行时改级别，写日志的线程不加锁就能看到；name对应的logger还没有时先建出来，以后取到的就是这个级别
+    void set_level(const std::string& name, int level);
+    // 所有已经建出来的logger
+    void set_level(int level);
+    void flush(void);
+
+private:
+    struct entry
+    {
+        entry(const std::string& name)
+        : m_name(name)
+        , m_logger(name)
+        , m_next(nullptr)
+        {
+        }
+        std::string m_name;
+        logger m_logger;
+        entry* m_next;
+    };
+    enum { BUCKETS = 64 };
+
+    entry* lookup(const std::string& name, size_t bucket) const;
+
+private:
+    std::atomic<entry*> m_buckets[BUCKETS];
+    std::mutex m_mutex;
+};
+
+// 以前按名字取logger的写法仍然可用，查的是同一张表
+template<>
+class singletons<logger, PassName> final
+{
+private:
+    singletons(void) {}
+    ~singletons(void) {}
+
+public:
+    static logger& get_instance(const std::string& name = "")
+    {
+        return log_registry::get_instance().get(name);
+    }
+};
+
+inline log_gate logger::gate(bool compiled, int level, const char* file, const char* func, int line)
+{
+    return log_gate(*this, compiled && enabled(level), level, file, func, line);
+}
+
 }
 
 #endif // __SNOWER_LOGGER_H__
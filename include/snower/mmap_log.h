@@ -0,0 +1,137 @@
+#ifndef __SNOWER_MMAP_LOG_H__
+#define __SNOWER_MMAP_LOG_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace snower
+{
+
+// 内存映射的日志文件，可以直接给file_appender用：日志写在预先分配好大小的段文件里，段文件名是 名字.000001、名字.000002 ……
+// 写日志的线程用一次fetch_add在当前段里占一块地方，把整行复制进去再标记成已写完，不加锁也没有系统调用；
+// 页面由内核写回磁盘，进程崩溃时已经写完的日志都留在文件里。
+// 段写满时换到log_rotator预先建好的下一个段，旧段等占了地方的线程都写完以后在后台解除映射。
+// 段的内容全部按本机字节序：
+//   段头   "SNWMLOG1" u64序号 u64段大小 u32进程号 u32保留
+//   日志   u32长度(最高位表示已经写完) 内容 补齐到8字节
+//   u32 RECORD_NEXT表示后面的日志在下一个段里，RECORD_END表示文件已经关闭；还是0的地方还没有写到
+class mmap_log_file
+{
+public:
+    enum { MAGIC_SIZE = 8, HEADER_SIZE = 32, RECORD_HEADER = 4, RECORD_ALIGN = 8 };
+    enum { DEFAULT_SEGMENT_SIZE = 16 * 1024 * 1024, MIN_SEGMENT_SIZE = 64 * 1024, MAX_SEGMENT_SIZE = 1024 * 1024 * 1024 };
+    enum : uint32_t
+    {
+        RECORD_COMMITTED = 0x80000000u,
+        RECORD_NEXT = 0xFFFFFFFEu,
+        RECORD_END = 0xFFFFFFFFu,
+    };
+    static const char MAGIC[MAGIC_SIZE + 1];
+
+public:
+    // 从已有的段之后的序号开始，不覆盖上次运行(包括崩溃)留下的段
+    mmap_log_file(const std::string& name, size_t segment_size = DEFAULT_SEGMENT_SIZE);
+    ~mmap_log_file(void);
+    mmap_log_file(const mmap_log_file&) = delete;
+    mmap_log_file& operator = (const mmap_log_file&) = delete;
+
+    // 超过一个段能放下的部分会被截掉；级别不影响写法，和file_object_base保持一样的接口
+    void write(const std::string& msg, int level = 0);
+    // 内容已经在页缓存里，读的一方马上能看到，这里只是让内核开始写回磁盘
+    void flush(void);
+    uint64_t current_segment(void) const
+    {
+        return m_current.load(std::memory_order_acquire);
+    }
+
+    static std::string segment_name(const std::string& name, uint64_t seq);
+    // 已经存在的段的序号，从小到大
+    static std::vector<uint64_t> list_segments(const std::string& name);
+
+private:
+    struct alignas(64) segment
+    {
+        // 0表示没有映射文件
+        std::atomic<uint64_t> m_seq;
+        std::atomic<size_t> m_tail;
+        std::atomic<char*> m_base;
+        int m_fd;
+    };
+    // 正在写的段、预先建好的下一个段、等着解除映射的上一个段
+    enum { SEGMENTS = 3 };
+
+    segment& slot(uint64_t seq)
+    {
+        return m_segments[seq % SEGMENTS];
+    }
+    void rollover(uint64_t seq);
+    // prepare和retire都要拿着m_segments_mutex调用
+    void prepare(uint64_t seq);
+    void retire(segment& s);
+    void wait_committed(const char* base, size_t end);
+
+private:
+    std::string m_name;
+    size_t m_segment_size;
+    // 每条日志之后总要留下写RECORD_NEXT/RECORD_END的地方
+    size_t m_limit;
+    size_t m_max_record;
+    std::atomic<uint64_t> m_current;
+    segment m_segments[SEGMENTS];
+    std::mutex m_segments_mutex;
+};
+
+// 读mmap_log_file的一个段，写的一方还在写的时候也可以读，next()读不到时看state()决定等待还是换段
+class mmap_log_reader
+{
+public:
+    enum read_state
+    {
+        READ_EMPTY,         // 暂时没有新的日志
+        READ_PENDING,       // 下一条已经占了地方，还没写完
+        READ_NEXT,          // 这个段读完了，接着读下一个段
+        READ_END,           // 文件已经关闭，或者后面的内容不完整
+    };
+
+public:
+    mmap_log_reader(const std::string& segment_file);
+    ~mmap_log_reader(void);
+    mmap_log_reader(const mmap_log_reader&) = delete;
+    mmap_log_reader& operator = (const mmap_log_reader&) = delete;
+
+    bool good(void) const
+    {
+        return m_base != nullptr;
+    }
+    uint64_t sequence(void) const
+    {
+        return m_seq;
+    }
+    read_state state(void) const
+    {
+        return m_state;
+    }
+    bool next(std::string& msg);
+    // 跳过一条READ_PENDING的日志，用在写它的进程已经不在的时候
+    void skip(void);
+
+    // 正在写的段：有日志的段里序号最大的，都没有日志时是序号最小的；一个段也没有时返回0
+    static uint64_t active_segment(const std::string& name);
+
+private:
+    uint32_t current_word(void) const;
+
+private:
+    const char* m_base;
+    size_t m_size;
+    size_t m_pos;
+    uint64_t m_seq;
+    read_state m_state;
+};
+
+} // namespace snower
+
+#endif // __SNOWER_MMAP_LOG_H__
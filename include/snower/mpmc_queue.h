@@ -0,0 +1,154 @@
+#ifndef __SNOWER_MPMC_QUEUE_H__
+#define __SNOWER_MPMC_QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace snower
+{
+
+// 有界无锁多生产者多消费者队列，每个槽位带一个序号(Dmitry Vyukov的算法)
+template<typename Item>
+class mpmc_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<size_t> m_seq;
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type m_data;
+    };
+
+public:
+    explicit mpmc_queue(size_t capacity = 0)
+    : m_cells(nullptr)
+    , m_mask(0)
+    , m_tail(0)
+    , m_head(0)
+    {
+        reserve(capacity);
+    }
+    ~mpmc_queue(void)
+    {
+        clear();
+        delete[] m_cells;
+    }
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator = (const mpmc_queue&) = delete;
+
+    // 容量会向上取整为2的幂，只能在队列还没有被共享时调用
+    void reserve(size_t capacity)
+    {
+        size_t size = 2;
+        while(size < capacity)
+        {
+            size <<= 1;
+        }
+        clear();
+        delete[] m_cells;
+        m_cells = new cell[size];
+        for(size_t i = 0; i < size; i++)
+        {
+            m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+        }
+        m_mask = size - 1;
+        m_tail.store(0, std::memory_order_relaxed);
+        m_head.store(0, std::memory_order_relaxed);
+    }
+    size_t capacity(void) const
+    {
+        return m_mask + 1;
+    }
+    size_t size(void) const
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        return (tail > head) ? (tail - head) : 0;
+    }
+    bool empty(void) const
+    {
+        return size() == 0;
+    }
+    void clear(void)
+    {
+        Item item;
+        while(m_cells != nullptr && try_pop(item))
+        {
+        }
+    }
+
+    bool try_push(const Item& item)
+    {
+        Item use(item);
+        return try_push(std::move(use));
+    }
+    bool try_push(Item&& item)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        while(true)
+        {
+            cell* c = &m_cells[pos & m_mask];
+            size_t seq = c->m_seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0)
+            {
+                if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    new(&c->m_data) Item(std::move(item));
+                    c->m_seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool try_pop(Item& item)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        while(true)
+        {
+            cell* c = &m_cells[pos & m_mask];
+            size_t seq = c->m_seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0)
+            {
+                if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    Item* ptr = reinterpret_cast<Item*>(&c->m_data);
+                    item = std::move(*ptr);
+                    ptr->~Item();
+                    c->m_seq.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    cell* m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) std::atomic<size_t> m_head;
+};
+
+} // namespace snower
+
+#endif // __SNOWER_MPMC_QUEUE_H__
@@ -0,0 +1,185 @@
+#ifndef __SNOWER_PARALLEL_H__
+#define __SNOWER_PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <snower/task.h>
+
+namespace snower
+{
+
+namespace native
+{
+
+// 一次fork-join的共享状态：区间按grain切成块，谁抢到块谁执行，调用者自己也参与；
+// 线程池里的帮手任务持有shared_ptr，晚到的帮手发现块已经分完就直接返回
+class parallel_state
+{
+public:
+    parallel_state(size_t first, size_t last, size_t grain, std::function<void (size_t, size_t, size_t)>&& body)
+    : m_first(first)
+    , m_last(last)
+    , m_grain(grain)
+    , m_chunks((last - first + grain - 1) / grain)
+    , m_next(0)
+    , m_done(0)
+    , m_body(std::move(body))
+    {
+    }
+    size_t chunks(void) const
+    {
+        return m_chunks;
+    }
+    void run(void)
+    {
+        size_t finished = 0;
+        for(size_t chunk = m_next++; chunk < m_chunks; chunk = m_next++)
+        {
+            size_t begin = m_first + chunk * m_grain;
+            size_t end = std::min(begin + m_grain, m_last);
+            try
+            {
+                m_body(chunk, begin, end);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                if(!m_error)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+            finished++;
+        }
+        if(finished > 0 && (m_done += finished) == m_chunks)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_signal.notify_all();
+        }
+    }
+    // 等别的线程手里的块做完，有块抛了异常时在调用者线程里重新抛出
+    void wait(void)
+    {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_signal.wait(locker, [this](){ return m_done == m_chunks; });
+        if(m_error)
+        {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+private:
+    size_t m_first;
+    size_t m_last;
+    size_t m_grain;
+    size_t m_chunks;
+    std::atomic<size_t> m_next;
+    std::atomic<size_t> m_done;
+    std::function<void (size_t, size_t, size_t)> m_body;
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+    std::condition_variable m_signal;
+};
+
+// grain为0时每个线程大约分到4块，兼顾负载均衡和调度开销
+inline size_t parallel_grain(size_t count, size_t threads, size_t grain)
+{
+    if(grain > 0)
+    {
+        return grain;
+    }
+    return std::max(count / (std::max(threads, (size_t)1) * 4), (size_t)1);
+}
+
+// body(chunk, begin, end)，返回时所有块都已执行完
+template<typename Pool>
+void parallel_chunks(Pool& pool, size_t first, size_t last, size_t grain, std::function<void (size_t, size_t, size_t)>&& body)
+{
+    std::shared_ptr<parallel_state> state = std::make_shared<parallel_state>(first, last, grain, std::move(body));
+    size_t helpers = std::min(state->chunks() - 1, (size_t)pool.thread_count());
+    if(helpers > 0)
+    {
+        std::vector<task> jobs;
+        jobs.reserve(helpers);
+        for(size_t i = 0; i < helpers; i++)
+        {
+            jobs.emplace_back([state](){ state->run(); });
+        }
+        pool.add_jobs(std::make_move_iterator(jobs.begin()), std::make_move_iterator(jobs.end()));
+    }
+    state->run();
+    state->wait();
+}
+
+} // namespace native
+
+// 对[first, last)中的每个i执行body(i)，调用者线程也参与执行，在线程池的工作线程里调用也不会死锁
+template<typename Pool, typename Body>
+void parallel_for(Pool& pool, size_t first, size_t last, const Body& body, size_t grain = 0)
+{
+    if(first >= last)
+    {
+        return;
+    }
+    grain = native::parallel_grain(last - first, pool.thread_count() + 1, grain);
+    native::parallel_chunks(pool, first, last, grain, [&body](size_t, size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++)
+            {
+                body(i);
+            }
+        });
+}
+
+// 每块先在本地用reduce折叠map(i)的结果，最后按块的顺序合并，所以结果与执行顺序无关
+template<typename Pool, typename T, typename Map, typename Reduce>
+T parallel_reduce(Pool& pool, size_t first, size_t last, T identity, const Map& map, const Reduce& reduce, size_t grain = 0)
+{
+    if(first >= last)
+    {
+        return identity;
+    }
+    grain = native::parallel_grain(last - first, pool.thread_count() + 1, grain);
+    std::vector<T> partials((last - first + grain - 1) / grain, identity);
+    native::parallel_chunks(pool, first, last, grain, [&](size_t chunk, size_t begin, size_t end){
+            T local = identity;
+            for(size_t i = begin; i < end; i++)
+            {
+                local = reduce(local, map(i));
+            }
+            partials[chunk] = local;
+        });
+    T ret = identity;
+    for(T& partial : partials)
+    {
+        ret = reduce(ret, partial);
+    }
+    return ret;
+}
+
+// out[i] = func(in[i])，要求随机访问迭代器
+template<typename Pool, typename InputIterator, typename OutputIterator, typename Func>
+OutputIterator parallel_transform(Pool& pool, InputIterator first, InputIterator last, OutputIterator out, const Func& func, size_t grain = 0)
+{
+    size_t count = std::distance(first, last);
+    parallel_for(pool, 0, count, [&](size_t i){ out[i] = func(first[i]); }, grain);
+    return out + count;
+}
+
+// 并行执行所有的可调用对象，全部完成后返回
+template<typename Pool, typename... Funcs>
+void parallel_invoke(Pool& pool, Funcs&&... funcs)
+{
+    std::vector<std::function<void ()>> list = { std::function<void ()>(std::forward<Funcs>(funcs))... };
+    parallel_for(pool, 0, list.size(), [&](size_t i){ list[i](); }, 1);
+}
+
+} // namespace snower
+
+#endif // __SNOWER_PARALLEL_H__
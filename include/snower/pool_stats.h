@@ -0,0 +1,265 @@
+#ifndef __SNOWER_POOL_STATS_H__
+#define __SNOWER_POOL_STATS_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace snower
+{
+
+// 按2的幂分桶的纳秒延迟直方图，第i个桶统计[2^i, 2^(i+1))纳秒的样本
+struct latency_histogram
+{
+    enum { BUCKETS = 48 };
+
+    latency_histogram(void)
+    : m_count(0)
+    , m_sum_ns(0)
+    {
+        for(uint64_t& c : m_buckets)
+        {
+            c = 0;
+        }
+    }
+    static size_t bucket_of(uint64_t ns)
+    {
+        size_t ret = 63 - __builtin_clzll(ns | 1);
+        return (ret < BUCKETS) ? ret : (BUCKETS - 1);
+    }
+    uint64_t mean_ns(void) const
+    {
+        return (m_count > 0) ? m_sum_ns / m_count : 0;
+    }
+    // 返回p分位(0~1)所在桶的上界，精度是2倍
+    uint64_t percentile_ns(double p) const
+    {
+        uint64_t rank = (uint64_t)(p * m_count);
+        uint64_t seen = 0;
+        for(size_t i = 0; i < BUCKETS; i++)
+        {
+            seen += m_buckets[i];
+            if(seen > rank)
+            {
+                return ((uint64_t)2 << i) - 1;
+            }
+        }
+        return 0;
+    }
+
+    uint64_t m_count;
+    uint64_t m_sum_ns;
+    uint64_t m_buckets[BUCKETS];
+};
+
+// thread_pool::stats()返回的快照，各项计数从线程池创建开始累计；
+// queued在提交成功时计数，started在工作线程取走任务时计数(一次取一批时按取走的个数)，
+// 各项来自不同的分片，任务在途时彼此会有少许偏差
+struct thread_pool_stats
+{
+    uint64_t m_queued;
+    uint64_t m_started;
+    uint64_t m_completed;
+    uint64_t m_rejected;
+    size_t m_pending;
+    uint32_t m_threads;
+    uint32_t m_busy;
+    uint32_t m_idle;
+    latency_histogram m_wait;
+    latency_histogram m_run;
+};
+
+namespace native
+{
+
+// 每个线程固定写一个分片，分片按缓存行对齐，避免多个线程争同一个缓存行；
+// 提交、取走、完成各计一次数，等待/执行时间按采样记录。
+// 前SHARDS - 1个分片各自只分给一个活着的线程，它只管读了再写，不用带lock前缀的原子加；
+// 分片分完以后的线程共用最后一个分片，才用fetch_add
+class pool_counters
+{
+public:
+    enum { SHARDS = 16 };
+
+private:
+    struct alignas(64) shard
+    {
+        std::atomic<uint64_t> m_queued;
+        std::atomic<uint64_t> m_started;
+        std::atomic<uint64_t> m_completed;
+        std::atomic<uint64_t> m_rejected;
+        std::atomic<uint64_t> m_wait_sum;
+        std::atomic<uint64_t> m_run_sum;
+        std::atomic<uint64_t> m_wait[latency_histogram::BUCKETS];
+        std::atomic<uint64_t> m_run[latency_histogram::BUCKETS];
+    };
+
+public:
+    pool_counters(void)
+    {
+        for(shard& s : m_shards)
+        {
+            s.m_queued = 0;
+            s.m_started = 0;
+            s.m_completed = 0;
+            s.m_rejected = 0;
+            s.m_wait_sum = 0;
+            s.m_run_sum = 0;
+            for(size_t i = 0; i < latency_histogram::BUCKETS; i++)
+            {
+                s.m_wait[i] = 0;
+                s.m_run[i] = 0;
+            }
+        }
+    }
+    void on_queued(uint64_t count = 1)
+    {
+        const slot& me = this_slot();
+        add(m_shards[me.m_index].m_queued, count, me.m_owned);
+    }
+    void on_started(uint64_t count = 1)
+    {
+        const slot& me = this_slot();
+        add(m_shards[me.m_index].m_started, count, me.m_owned);
+    }
+    void on_rejected(uint64_t count = 1)
+    {
+        const slot& me = this_slot();
+        add(m_shards[me.m_index].m_rejected, count, me.m_owned);
+    }
+    // wait_ns/run_ns为0表示这个任务没有被采样
+    void on_completed(uint64_t wait_ns, uint64_t run_ns)
+    {
+        const slot& me = this_slot();
+        shard& s = m_shards[me.m_index];
+        add(s.m_completed, 1, me.m_owned);
+        if(wait_ns > 0)
+        {
+            add(s.m_wait_sum, wait_ns, me.m_owned);
+            add(s.m_wait[latency_histogram::bucket_of(wait_ns)], 1, me.m_owned);
+            add(s.m_run_sum, run_ns, me.m_owned);
+            add(s.m_run[latency_histogram::bucket_of(run_ns)], 1, me.m_owned);
+        }
+    }
+    uint64_t completed(void) const
+    {
+        uint64_t ret = 0;
+        for(const shard& s : m_shards)
+        {
+            ret += s.m_completed.load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+    void collect(thread_pool_stats& out) const
+    {
+        out.m_queued = out.m_started = out.m_completed = out.m_rejected = 0;
+        out.m_wait = latency_histogram();
+        out.m_run = latency_histogram();
+        for(const shard& s : m_shards)
+        {
+            out.m_queued += s.m_queued.load(std::memory_order_relaxed);
+            out.m_started += s.m_started.load(std::memory_order_relaxed);
+            out.m_completed += s.m_completed.load(std::memory_order_relaxed);
+            out.m_rejected += s.m_rejected.load(std::memory_order_relaxed);
+            out.m_wait.m_sum_ns += s.m_wait_sum.load(std::memory_order_relaxed);
+            out.m_run.m_sum_ns += s.m_run_sum.load(std::memory_order_relaxed);
+            for(size_t i = 0; i < latency_histogram::BUCKETS; i++)
+            {
+                uint64_t wait = s.m_wait[i].load(std::memory_order_relaxed);
+                uint64_t run = s.m_run[i].load(std::memory_order_relaxed);
+                out.m_wait.m_buckets[i] += wait;
+                out.m_wait.m_count += wait;
+                out.m_run.m_buckets[i] += run;
+                out.m_run.m_count += run;
+            }
+        }
+    }
+    // 需要计时时返回当前的纳秒数，否则返回0；每个线程每sample个任务计时一次
+    static uint64_t sample_clock(uint32_t sample)
+    {
+        // 倒数而不是取模，省掉每个任务一次除法；sample改小以后剩下的数不超过新的sample
+        static thread_local uint32_t left = 1;
+        if(sample == 0 || (--left > 0 && left < sample))
+        {
+            return 0;
+        }
+        left = sample;
+        return now_ns();
+    }
+    static uint64_t now_ns(void)
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    // 线程在进程里占的分片编号，所有pool_counters共用同一套编号，线程退出时还回去
+    struct slot
+    {
+        slot(void)
+        : m_index(SHARDS - 1)
+        , m_owned(false)
+        {
+            std::lock_guard<std::mutex> locker(slot_mutex());
+            uint32_t& used = slot_bits();
+            for(size_t i = 0; i < SHARDS - 1; i++)
+            {
+                if((used & (1u << i)) == 0)
+                {
+                    used |= (1u << i);
+                    m_index = i;
+                    m_owned = true;
+                    break;
+                }
+            }
+        }
+        ~slot(void)
+        {
+            if(m_owned)
+            {
+                std::lock_guard<std::mutex> locker(slot_mutex());
+                slot_bits() &= ~(1u << m_index);
+            }
+        }
+        size_t m_index;
+        bool m_owned;
+    };
+
+    static std::mutex& slot_mutex(void)
+    {
+        static std::mutex ret;
+        return ret;
+    }
+    static uint32_t& slot_bits(void)
+    {
+        static uint32_t ret = 0;
+        return ret;
+    }
+    static const slot& this_slot(void)
+    {
+        static thread_local slot ret;
+        return ret;
+    }
+    static void add(std::atomic<uint64_t>& counter, uint64_t count, bool owned)
+    {
+        // 独占的分片只有读取快照的线程会同时读，relaxed的读写就够了
+        if(owned)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+        else
+        {
+            counter.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    shard m_shards[SHARDS];
+};
+
+} // namespace native
+
+} // namespace snower
+
+#endif // __SNOWER_POOL_STATS_H__
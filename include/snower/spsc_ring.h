@@ -0,0 +1,124 @@
+#ifndef __SNOWER_SPSC_RING_H__
+#define __SNOWER_SPSC_RING_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace snower
+{
+
+// 有界无锁单生产者单消费者环形缓冲，生产者和消费者各自缓存对方的下标，
+// 只有缓存的下标显示满/空时才去读对方的缓存行
+template<typename Item>
+class spsc_ring
+{
+private:
+    using storage_type = typename std::aligned_storage<sizeof(Item), alignof(Item)>::type;
+
+public:
+    // 容量向上取整为2的幂
+    explicit spsc_ring(size_t capacity)
+    : m_items(nullptr)
+    , m_mask(0)
+    , m_head(0)
+    , m_tail_cache(0)
+    , m_tail(0)
+    , m_head_cache(0)
+    {
+        size_t size = 2;
+        while(size < capacity)
+        {
+            size <<= 1;
+        }
+        m_items = new storage_type[size];
+        m_mask = size - 1;
+    }
+    ~spsc_ring(void)
+    {
+        consume([](Item&){}, SIZE_MAX);
+        delete[] m_items;
+    }
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator = (const spsc_ring&) = delete;
+
+    size_t capacity(void) const
+    {
+        return m_mask + 1;
+    }
+    size_t size(void) const
+    {
+        return pushed() - popped();
+    }
+    bool empty(void) const
+    {
+        return size() == 0;
+    }
+    // 累计放入/取走的个数，取走的计数在消费者处理完一项之后才增加
+    uint64_t pushed(void) const
+    {
+        return m_tail.load(std::memory_order_acquire);
+    }
+    uint64_t popped(void) const
+    {
+        return m_head.load(std::memory_order_acquire);
+    }
+
+    // 只能由生产者线程调用
+    template<typename... Types>
+    bool try_push(Types&&... args)
+    {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_head_cache > m_mask)
+        {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if(tail - m_head_cache > m_mask)
+            {
+                return false;
+            }
+        }
+        new(&m_items[tail & m_mask]) Item(std::forward<Types>(args)...);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    // 只能由消费者线程调用：对最多max项依次调用func，每处理完一项才让出它的槽位，返回处理的个数
+    template<typename Func>
+    size_t consume(Func&& func, size_t max)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        size_t ret = 0;
+        while(ret < max)
+        {
+            if(head == m_tail_cache)
+            {
+                m_tail_cache = m_tail.load(std::memory_order_acquire);
+                if(head == m_tail_cache)
+                {
+                    break;
+                }
+            }
+            Item* item = reinterpret_cast<Item*>(&m_items[head & m_mask]);
+            func(*item);
+            item->~Item();
+            m_head.store(++head, std::memory_order_release);
+            ret++;
+        }
+        return ret;
+    }
+
+private:
+    storage_type* m_items;
+    size_t m_mask;
+    // 消费者写m_head，生产者写m_tail，分别放在不同的缓存行
+    alignas(64) std::atomic<uint64_t> m_head;
+    uint64_t m_tail_cache;
+    alignas(64) std::atomic<uint64_t> m_tail;
+    uint64_t m_head_cache;
+};
+
+} // namespace snower
+
+#endif // __SNOWER_SPSC_RING_H__
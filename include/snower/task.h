@@ -0,0 +1,197 @@
+#ifndef __SNOWER_TASK_H__
+#define __SNOWER_TASK_H__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace snower
+{
+
+// 只能移动的void()可调用对象，INLINE_SIZE以内且移动不抛异常的对象直接放在内部缓冲区，
+// 不用像std::function那样在堆上分配，也不要求可调用对象可以复制
+template<size_t Size>
+class basic_task
+{
+public:
+    enum { INLINE_SIZE = Size };
+
+private:
+    using storage_type = typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type;
+
+    struct ops
+    {
+        void (*m_invoke)(storage_type&);
+        void (*m_move)(storage_type& from, storage_type& to);
+        void (*m_destroy)(storage_type&);
+    };
+
+    template<typename F>
+    struct inline_ops
+    {
+        static F& get(storage_type& s)
+        {
+            return *reinterpret_cast<F*>(&s);
+        }
+        static void invoke(storage_type& s)
+        {
+            get(s)();
+        }
+        static void move(storage_type& from, storage_type& to)
+        {
+            new(&to) F(std::move(get(from)));
+            get(from).~F();
+        }
+        static void destroy(storage_type& s)
+        {
+            get(s).~F();
+        }
+        static const ops* table(void)
+        {
+            static const ops t = { &invoke, &move, &destroy };
+            return &t;
+        }
+    };
+
+    template<typename F>
+    struct heap_ops
+    {
+        static F*& get(storage_type& s)
+        {
+            return *reinterpret_cast<F**>(&s);
+        }
+        static void invoke(storage_type& s)
+        {
+            (*get(s))();
+        }
+        static void move(storage_type& from, storage_type& to)
+        {
+            new(&to) F*(get(from));
+        }
+        static void destroy(storage_type& s)
+        {
+            delete get(s);
+        }
+        static const ops* table(void)
+        {
+            static const ops t = { &invoke, &move, &destroy };
+            return &t;
+        }
+    };
+
+    template<typename F>
+    struct fits_inline : std::integral_constant<bool,
+        sizeof(F) <= INLINE_SIZE
+        && alignof(std::max_align_t) % alignof(F) == 0
+        && std::is_nothrow_move_constructible<F>::value>
+    {
+    };
+
+public:
+    basic_task(void)
+    : m_ops(nullptr)
+    {
+    }
+    basic_task(std::nullptr_t)
+    : m_ops(nullptr)
+    {
+    }
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, basic_task>::value>::type>
+    basic_task(F&& func)
+    : m_ops(nullptr)
+    {
+        using type = typename std::decay<F>::type;
+        if(is_empty(func))
+        {
+            return;
+        }
+        construct<type>(std::forward<F>(func), fits_inline<type>());
+    }
+    basic_task(basic_task&& other) noexcept
+    : m_ops(other.m_ops)
+    {
+        if(m_ops != nullptr)
+        {
+            m_ops->m_move(other.m_storage, m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+    basic_task& operator = (basic_task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            if(other.m_ops != nullptr)
+            {
+                other.m_ops->m_move(other.m_storage, m_storage);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+    basic_task& operator = (std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+    basic_task(const basic_task&) = delete;
+    basic_task& operator = (const basic_task&) = delete;
+    ~basic_task(void)
+    {
+        reset();
+    }
+
+    explicit operator bool (void) const
+    {
+        return m_ops != nullptr;
+    }
+    void operator () (void)
+    {
+        m_ops->m_invoke(m_storage);
+    }
+    void reset(void)
+    {
+        if(m_ops != nullptr)
+        {
+            m_ops->m_destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    template<typename T, typename F>
+    void construct(F&& func, std::true_type)
+    {
+        new(&m_storage) T(std::forward<F>(func));
+        m_ops = inline_ops<T>::table();
+    }
+    template<typename T, typename F>
+    void construct(F&& func, std::false_type)
+    {
+        new(&m_storage) T*(new T(std::forward<F>(func)));
+        m_ops = heap_ops<T>::table();
+    }
+    // 空的std::function或空函数指针构造出空的task
+    template<typename F>
+    static auto is_empty(const F& func) -> decltype(!func)
+    {
+        return !func;
+    }
+    template<typename... Types>
+    static bool is_empty(const Types&...)
+    {
+        return false;
+    }
+
+private:
+    storage_type m_storage;
+    const ops* m_ops;
+};
+
+using task = basic_task<64>;
+
+} // namespace snower
+
+#endif // __SNOWER_TASK_H__
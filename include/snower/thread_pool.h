@@ -1,15 +1,33 @@
 #ifndef __SNOWER_THREAD_POOL_H__
 #define __SNOWER_THREAD_POOL_H__
 
+#include <sched.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
 #include <deque>
+#include <fstream>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include <snower/event_count.h>
+#include <snower/mpmc_queue.h>
+#include <snower/pool_stats.h>
+#include <snower/singleton.h>
+#include <snower/task.h>
+#include <snower/timer_queue.h>
+#include <snower/topology.h>
 
 namespace snower
 {
@@ -17,14 +35,41 @@ namespace snower
 class Priority {};
 class Schedule {};
 class Sequence {};
+class LockFree {};
+template<typename QueueType>
+class PerNode {};
 
 class AutoManage {};
 class Fixed {};
 class Infinity {};
+// 有任务提交而没有空闲线程时就新建线程，空闲超时后退出，适合执行阻塞调用的任务
+class Elastic {};
+
+class Park {};
+class BusySpin {};
+class SpinYield {};
+class SpinPark {};
 
 namespace native
 {
 
+// 当前工作线程所属的NUMA节点，不是PerNode线程池的工作线程时为-1
+inline int& this_worker_node(void)
+{
+    static thread_local int node = -1;
+    return node;
+}
+
+template<typename QueueType>
+struct is_per_node : std::false_type
+{
+};
+
+template<typename QueueType>
+struct is_per_node<PerNode<QueueType>> : std::true_type
+{
+};
+
 template<typename Func, typename Queue = std::vector<Func>>
 class queue_wrapper_base
 {
@@ -33,6 +78,7 @@ public:
     : m_threshold(threshold)
     , m_queue_limit(queue_limit)
     , m_idle_sec(30)
+    , m_waiting(0)
     {
     }
     void set_thread_idle_seconds(uint32_t seconds)
@@ -57,21 +103,81 @@ public:
     }
     virtual void add(size_t key, Func&& func) = 0;
     virtual Func get(void) = 0;
+    virtual Func try_get(void) = 0;
+    // 默认逐个提交/逐个取，能在一次加锁里完成的队列自己覆盖
+    virtual void add_batch(size_t key, std::vector<Func>& funcs)
+    {
+        for(Func& func : funcs)
+        {
+            add(key, std::move(func));
+        }
+    }
+    virtual size_t try_get_batch(std::vector<Func>& out, size_t max)
+    {
+        size_t ret = 0;
+        while(ret < max)
+        {
+            Func func = try_get();
+            if(!func)
+            {
+                break;
+            }
+            out.push_back(std::move(func));
+            ret++;
+        }
+        return ret;
+    }
 
     bool out_of_threshold(void) const
     {
         return (m_threshold > 0) ? size() >= m_threshold : false;
     }
+    uint32_t limit(void) const
+    {
+        return m_queue_limit;
+    }
     bool out_of_limit(void) const
     {
         return (m_queue_limit > 0) ? size() >= m_queue_limit : false;
     }
+    // 在queue_limit之内还能放下多少个任务
+    size_t room(void) const
+    {
+        if(m_queue_limit == 0)
+        {
+            return SIZE_MAX;
+        }
+        size_t used = size();
+        return (used < m_queue_limit) ? (m_queue_limit - used) : 0;
+    }
 
 protected:
     void on_add_func(void)
     {
         m_signal.notify_one();
     }
+    // 只唤醒min(count, 正在等待的线程数)个线程
+    void on_add_funcs(size_t count)
+    {
+        size_t waiting = m_waiting;
+        if(count >= waiting)
+        {
+            m_signal.notify_all();
+            return;
+        }
+        for(size_t i = 0; i < count; i++)
+        {
+            m_signal.notify_one();
+        }
+    }
+    // 调用时必须持有锁，lock可以是m_mutex本身或者锁住它的unique_lock
+    template<typename Lock, typename Duration>
+    void wait_signal(Lock& lock, const Duration& timeout)
+    {
+        m_waiting++;
+        m_signal.wait_for(lock, timeout);
+        m_waiting--;
+    }
 
 protected:
     uint32_t m_threshold;
@@ -81,192 +187,967 @@ protected:
     Queue m_queue;
     std::mutex m_mutex;
     std::condition_variable_any m_signal;
+    std::atomic<size_t> m_waiting;
 };
 
-template<typename Trait, typename Func = std::function<void ()>>
+template<typename Trait, typename Func = task>
 class queue_wrapper : public queue_wrapper_base<Func>
 {
 };
 
+// 还没到期的任务在堆里，已经到期但还没被取走的在ready里
 template<typename Func>
-class queue_wrapper<Schedule, Func> : public queue_wrapper_base<Func, std::multimap<std::chrono::steady_clock::time_point, Func>>
+struct schedule_queue
+{
+    schedule_queue(void)
+    : m_size(0)
+    {
+    }
+    size_t size(void) const
+    {
+        return m_size;
+    }
+    bool empty(void) const
+    {
+        return m_size == 0;
+    }
+    void clear(void)
+    {
+        m_timers.clear();
+        m_ready.clear();
+        m_size = 0;
+    }
+    void update_size(void)
+    {
+        m_size = m_timers.size() + m_ready.size();
+    }
+
+    timer_heap<Func> m_timers;
+    std::deque<Func> m_ready;
+    std::atomic<size_t> m_size;
+};
+
+// 同一时刻只有一个工作线程负责等最早的到期时间，其余空闲线程等在m_signal上；
+// 它在m_timer_signal上等到最早的到期时间，醒来后一次取出所有到期任务
+template<typename Func>
+class queue_wrapper<Schedule, Func> : public queue_wrapper_base<Func, schedule_queue<Func>>
 {
 private:
-    using queue_type = std::multimap<std::chrono::steady_clock::time_point, Func>;
+    using queue_type = schedule_queue<Func>;
     using parent_type = queue_wrapper_base<Func, queue_type>;
 
 public:
     enum { DEFAULT = 0 };
 
-    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
-    : parent_type(0, 0)
+    // 未到期的定时任务不该触发新线程，所以不用threshold；queue_limit限制的是还没执行的定时任务总数
+    queue_wrapper(uint32_t, uint32_t queue_limit)
+    : parent_type(0, queue_limit)
+    , m_timer_waiter(false)
     {
     }
+    virtual void clear(void)
+    {
+        parent_type::clear();
+        m_timer_signal.notify_all();
+    }
     virtual void add(size_t key, Func&& func)
     {
-        using namespace std;
+        add_timer(key, std::move(func));
+    }
+    // key是延迟的微秒数
+    timer_handle add_timer(size_t key, Func&& func)
+    {
         using namespace std::chrono;
 
         steady_clock::time_point tp = steady_clock::now() + microseconds(key);
+        timer_handle ret;
+        bool earliest = false;
+        bool waiter = false;
         {
             std::lock_guard<std::mutex> locker(parent_type::m_mutex);
-            parent_type::m_queue.emplace(tp, std::move(func));
+            earliest = parent_type::m_queue.m_timers.empty() || tp < parent_type::m_queue.m_timers.top_deadline();
+            ret = parent_type::m_queue.m_timers.push(tp, std::move(func));
+            parent_type::m_queue.update_size();
+            waiter = m_timer_waiter;
         }
-        parent_type::on_add_func();
+        if(!waiter)
+        {
+            parent_type::on_add_func();
+        }
+        else if(earliest)
+        {
+            m_timer_signal.notify_one();
+        }
+        return ret;
+    }
+    virtual void add_batch(size_t key, std::vector<Func>& funcs)
+    {
+        using namespace std::chrono;
+
+        if(funcs.empty())
+        {
+            return;
+        }
+        steady_clock::time_point tp = steady_clock::now() + microseconds(key);
+        bool earliest = false;
+        bool waiter = false;
+        {
+            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+            earliest = parent_type::m_queue.m_timers.empty() || tp < parent_type::m_queue.m_timers.top_deadline();
+            for(Func& func : funcs)
+            {
+                parent_type::m_queue.m_timers.push(tp, std::move(func));
+            }
+            parent_type::m_queue.update_size();
+            waiter = m_timer_waiter;
+        }
+        // 这一批的到期时间相同，只需要一个线程计时，到期后take_ready会再唤醒其它线程
+        if(!waiter)
+        {
+            parent_type::on_add_func();
+        }
+        else if(earliest)
+        {
+            m_timer_signal.notify_one();
+        }
+    }
+    bool cancel(const timer_handle& handle)
+    {
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        bool ret = parent_type::m_queue.m_timers.cancel(handle);
+        parent_type::m_queue.update_size();
+        return ret;
     }
     virtual Func get(void)
     {
         using namespace std;
         using namespace std::chrono;
 
-        steady_clock::time_point now = steady_clock::now();
-        auto get_first = [&]() -> Func {
-            auto iter = parent_type::m_queue.begin();
-            if((iter != parent_type::m_queue.end()) && (iter->first < steady_clock::now()))
+        unique_lock<mutex> locker(parent_type::m_mutex);
+        Func ret = take_ready();
+        if(ret)
+        {
+            return ret;
+        }
+        if(parent_type::m_queue.m_timers.empty() || m_timer_waiter)
+        {
+            parent_type::wait_signal(locker, seconds(parent_type::m_idle_sec));
+            return take_ready();
+        }
+        // 整个等待都在m_timer_signal上，加入更早的定时任务时随时可以叫醒计时的线程；
+        // 调小了timer slack，条件变量的超时也足够准，不需要单独的精确睡眠
+        use_precise_timer_slack();
+        m_timer_waiter = true;
+        while(!ret && !parent_type::m_queue.m_timers.empty())
+        {
+            steady_clock::time_point deadline = parent_type::m_queue.m_timers.top_deadline();
+            if(deadline > steady_clock::now())
             {
-                Func ret = iter->second;
-                parent_type::m_queue.erase(iter);
-                return move(ret);
+                m_timer_signal.wait_until(locker, deadline);
             }
-            else
+            ret = take_ready();
+        }
+        m_timer_waiter = false;
+        if(!parent_type::m_queue.m_timers.empty())
+        {
+            // 交给另一个空闲线程继续计时
+            parent_type::m_signal.notify_one();
+        }
+        return ret;
+    }
+    virtual Func try_get(void)
+    {
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        return take_ready();
+    }
+
+private:
+    // 调用时必须持有锁
+    Func take_ready(void)
+    {
+        using namespace std::chrono;
+
+        queue_type& q = parent_type::m_queue;
+        if(!q.m_timers.empty() && q.m_timers.top_deadline() <= steady_clock::now())
+        {
+            q.m_timers.pop_expired(steady_clock::now(), q.m_ready);
+        }
+        if(q.m_ready.empty())
+        {
+            return Func();
+        }
+        Func ret(std::move(q.m_ready.front()));
+        q.m_ready.pop_front();
+        q.update_size();
+        if(q.m_ready.size() > 1)
+        {
+            parent_type::m_signal.notify_all();
+        }
+        else if(!q.m_ready.empty())
+        {
+            parent_type::m_signal.notify_one();
+        }
+        return ret;
+    }
+
+private:
+    bool m_timer_waiter;
+    std::condition_variable_any m_timer_signal;
+};
+
+// 线程池队列里实际存放的任务：用户的task加上入队时刻，没有采样等待时间时为0
+struct pool_job
+{
+    pool_job(void)
+    : m_enqueued(0)
+    {
+    }
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, pool_job>::value>::type>
+    pool_job(F&& func)
+    : m_func(std::forward<F>(func))
+    , m_enqueued(0)
+    {
+    }
+    explicit operator bool (void) const
+    {
+        return (bool)m_func;
+    }
+    void operator () (void)
+    {
+        m_func();
+    }
+
+    task m_func;
+    uint64_t m_enqueued;
+};
+
+template<typename Queue, typename Func>
+timer_handle add_to_queue(Queue& queue, size_t key, Func&& func)
+{
+    queue.add(key, std::move(func));
+    return timer_handle::accepted();
+}
+
+template<typename Func>
+timer_handle add_to_queue(queue_wrapper<Schedule, Func>& queue, size_t key, Func&& func)
+{
+    return queue.add_timer(key, std::move(func));
+}
+
+// 每个优先级一个FIFO桶，用位图记录非空的桶，第0位对应最高优先级
+template<typename Func, size_t Levels>
+struct priority_buckets
+{
+    using entry_type = std::pair<std::chrono::steady_clock::time_point, Func>;
+
+    priority_buckets(void)
+    : m_bitmap(0)
+    , m_size(0)
+    {
+    }
+    size_t size(void) const
+    {
+        return m_size;
+    }
+    bool empty(void) const
+    {
+        return m_size == 0;
+    }
+    void clear(void)
+    {
+        for(std::deque<entry_type>& b : m_buckets)
+        {
+            b.clear();
+        }
+        m_bitmap = 0;
+        m_size = 0;
+    }
+    void push(size_t index, entry_type&& e)
+    {
+        m_buckets[index].emplace_back(std::move(e));
+        m_bitmap |= (1u << index);
+        m_size++;
+    }
+    Func pop(size_t index)
+    {
+        std::deque<entry_type>& b = m_buckets[index];
+        Func ret(std::move(b.front().second));
+        b.pop_front();
+        if(b.empty())
+        {
+            m_bitmap &= ~(1u << index);
+        }
+        m_size--;
+        return ret;
+    }
+
+    std::deque<entry_type> m_buckets[Levels];
+    uint32_t m_bitmap;
+    std::atomic<size_t> m_size;
+};
+
+template<typename Func>
+class queue_wrapper<Priority, Func> : public queue_wrapper_base<Func, priority_buckets<Func, 10>>
+{
+private:
+    using queue_type = priority_buckets<Func, 10>;
+    using parent_type = queue_wrapper_base<Func, queue_type>;
+
+public:
+    enum { DEFAULT = 5 };
+    enum {
+        PRIORITY_LOWEST = 1
+        , PRIORITY_HIGHEST = 10
+    };
+
+    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
+    : parent_type(threshold, queue_limit)
+    , m_aging_ms(0)
+    , m_aging_since(0)
+    {
+    }
+    // 开启后任务每等待ms毫秒，有效优先级提高一级，避免低优先级任务一直饿死
+    void set_aging_milliseconds(uint32_t ms)
+    {
+        using namespace std::chrono;
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        if(ms > 0 && m_aging_ms == 0)
+        {
+            m_aging_since = steady_clock::now().time_since_epoch().count();
+        }
+        m_aging_ms = ms;
+    }
+    virtual void add(size_t key, Func&& func)
+    {
+        using namespace std::chrono;
+
+        if(key > PRIORITY_HIGHEST)
+        {
+            key = PRIORITY_HIGHEST;
+        }
+        else if(key < PRIORITY_LOWEST)
+        {
+            key = PRIORITY_LOWEST;
+        }
+        steady_clock::time_point now = (m_aging_ms > 0) ? steady_clock::now() : steady_clock::time_point();
+        {
+            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+            parent_type::m_queue.push(PRIORITY_HIGHEST - key, typename queue_type::entry_type(now, std::move(func)));
+        }
+        parent_type::on_add_func();
+    }
+    virtual void add_batch(size_t key, std::vector<Func>& funcs)
+    {
+        using namespace std::chrono;
+
+        key = std::min(std::max(key, (size_t)PRIORITY_LOWEST), (size_t)PRIORITY_HIGHEST);
+        steady_clock::time_point now = (m_aging_ms > 0) ? steady_clock::now() : steady_clock::time_point();
+        {
+            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+            for(Func& func : funcs)
             {
-                return move(Func());
+                parent_type::m_queue.push(PRIORITY_HIGHEST - key, typename queue_type::entry_type(now, std::move(func)));
             }
-        };
+        }
+        parent_type::on_add_funcs(funcs.size());
+    }
+    virtual Func get(void)
+    {
+        using namespace std;
+        using namespace std::chrono;
 
         lock_guard<mutex> locker(parent_type::m_mutex);
-        if(!parent_type::m_queue.empty())
+        if(parent_type::m_queue.empty())
+        {
+            parent_type::wait_signal(parent_type::m_mutex, seconds(parent_type::m_idle_sec));
+        }
+        return get_first();
+    }
+    virtual Func try_get(void)
+    {
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        return get_first();
+    }
+    virtual size_t try_get_batch(std::vector<Func>& out, size_t max)
+    {
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        size_t ret = 0;
+        while(ret < max && !parent_type::m_queue.empty())
+        {
+            out.push_back(get_first());
+            ret++;
+        }
+        return ret;
+    }
+
+private:
+    Func get_first(void)
+    {
+        using namespace std::chrono;
+
+        uint32_t bitmap = parent_type::m_queue.m_bitmap;
+        if(bitmap == 0)
+        {
+            return Func();
+        }
+        size_t index = __builtin_ctz(bitmap);
+        uint32_t aging = m_aging_ms;
+        if(aging > 0)
         {
-            auto iter = parent_type::m_queue.begin();
-            if(iter->first > now)
+            // 有效优先级 = 桶的优先级 + 队首任务等待时间 / aging，最多只看10个桶
+            // 关闭aging时加入的任务没有记录时间，按开启aging的时刻算，不能当成等了无限久
+            steady_clock::time_point now = steady_clock::now();
+            steady_clock::time_point since = steady_clock::time_point(steady_clock::duration(m_aging_since));
+            int64_t best = -1;
+            for(uint32_t rest = bitmap; rest != 0; rest &= rest - 1)
+            {
+                size_t i = __builtin_ctz(rest);
+                steady_clock::time_point enqueued = parent_type::m_queue.m_buckets[i].front().first;
+                if(enqueued == steady_clock::time_point())
+                {
+                    enqueued = since;
+                }
+                int64_t waited = duration_cast<milliseconds>(now - enqueued).count();
+                int64_t effective = (int64_t)(PRIORITY_HIGHEST - i) + waited / aging;
+                if(effective > best)
+                {
+                    best = effective;
+                    index = i;
+                }
+            }
+        }
+        return parent_type::m_queue.pop(index);
+    }
+
+private:
+    std::atomic<uint32_t> m_aging_ms;
+    // 开启aging的时刻，修改时拿着m_mutex
+    std::chrono::steady_clock::rep m_aging_since;
+};
+
+template<typename Func>
+class queue_wrapper<Sequence, Func> : public queue_wrapper_base<Func, std::deque<Func>>
+{
+private:
+    using queue_type = std::deque<Func>;
+    using parent_type = queue_wrapper_base<Func, queue_type>;
+
+public:
+    enum { DEFAULT = 0 };
+
+    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
+    : parent_type(threshold, queue_limit)
+    {
+    }
+    virtual void add(size_t key, Func&& func)
+    {
+        {
+            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+            parent_type::m_queue.emplace_back(std::move(func));
+        }
+        parent_type::on_add_func();
+    }
+    virtual void add_batch(size_t key, std::vector<Func>& funcs)
+    {
+        {
+            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+            for(Func& func : funcs)
             {
-                parent_type::m_signal.wait_for(parent_type::m_mutex, (iter->first - now));
+                parent_type::m_queue.emplace_back(std::move(func));
             }
+        }
+        parent_type::on_add_funcs(funcs.size());
+    }
+    virtual Func get(void)
+    {
+        using namespace std;
+        using namespace std::chrono;
+
+        lock_guard<mutex> locker(parent_type::m_mutex);
+        if(!parent_type::m_queue.empty())
+        {
             return get_first();
         }
         else
         {
-            parent_type::m_signal.wait_for(parent_type::m_mutex, seconds(parent_type::m_idle_sec));
+            parent_type::wait_signal(parent_type::m_mutex, seconds(parent_type::m_idle_sec));
             return get_first();
         }
     }
+    virtual Func try_get(void)
+    {
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        return get_first();
+    }
+    virtual size_t try_get_batch(std::vector<Func>& out, size_t max)
+    {
+        std::lock_guard<std::mutex> locker(parent_type::m_mutex);
+        size_t ret = 0;
+        while(ret < max && !parent_type::m_queue.empty())
+        {
+            out.push_back(get_first());
+            ret++;
+        }
+        return ret;
+    }
+
+private:
+    Func get_first(void)
+    {
+        using namespace std;
+
+        if(parent_type::m_queue.size() > 0)
+        {
+            Func ret(move(parent_type::m_queue.front()));
+            parent_type::m_queue.pop_front();
+            return ret;
+        }
+        else
+        {
+            return Func();
+        }
+    }
 };
 
 template<typename Func>
-class queue_wrapper<Priority, Func> : public queue_wrapper_base<Func, std::multimap<size_t, Func>>
+class queue_wrapper<LockFree, Func> : public queue_wrapper_base<Func, mpmc_queue<Func>>
 {
 private:
-    using queue_type = std::multimap<size_t, Func>;
+    using queue_type = mpmc_queue<Func>;
     using parent_type = queue_wrapper_base<Func, queue_type>;
 
 public:
-    enum { DEFAULT = 5 };
-    enum {
-        PRIORITY_LOWEST = 1
-        , PRIORITY_HIGHEST = 10
-    };
+    enum { DEFAULT = 0 };
+    // 环形队列容量固定，queue_limit为0时也要有上限，否则队列满了生产者只能一直等
+    enum { DEFAULT_LIMIT = 65536 - 256 };
+    // 多个生产者可能同时越过out_of_limit的检查，环里多留出这些位置
+    enum { RACE_SLACK = 256 };
+
+    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
+    : parent_type(threshold, (queue_limit > 0) ? queue_limit : (uint32_t)DEFAULT_LIMIT)
+    {
+        parent_type::m_queue.reserve((size_t)parent_type::m_queue_limit + RACE_SLACK);
+    }
+    virtual void clear(void)
+    {
+        parent_type::m_queue.clear();
+        m_event.notify_all();
+    }
+    virtual void add(size_t key, Func&& func)
+    {
+        // add_job已经用queue_limit挡住了大部分提交，只有超过RACE_SLACK个生产者同时越过检查时环才会满，这时让出CPU等消费者腾出位置
+        while(!parent_type::m_queue.try_push(std::move(func)))
+        {
+            std::this_thread::yield();
+        }
+        m_event.notify_one();
+    }
+    virtual void add_batch(size_t key, std::vector<Func>& funcs)
+    {
+        for(Func& func : funcs)
+        {
+            while(!parent_type::m_queue.try_push(std::move(func)))
+            {
+                std::this_thread::yield();
+            }
+        }
+        m_event.notify_many((uint32_t)std::min(funcs.size(), (size_t)UINT32_MAX));
+    }
+    virtual Func get(void)
+    {
+        using namespace std::chrono;
+
+        Func ret;
+        if(parent_type::m_queue.try_pop(ret))
+        {
+            return ret;
+        }
+        event_count::key_type key = m_event.prepare_wait();
+        if(parent_type::m_queue.try_pop(ret))
+        {
+            m_event.cancel_wait();
+            return ret;
+        }
+        m_event.wait_for(key, seconds(parent_type::m_idle_sec));
+        parent_type::m_queue.try_pop(ret);
+        return ret;
+    }
+    virtual Func try_get(void)
+    {
+        Func ret;
+        parent_type::m_queue.try_pop(ret);
+        return ret;
+    }
+
+private:
+    event_count m_event;
+};
+
+template<typename Sub>
+struct node_queues
+{
+    size_t size(void) const
+    {
+        size_t ret = 0;
+        for(const std::unique_ptr<Sub>& q : m_queues)
+        {
+            ret += q->size();
+        }
+        return ret;
+    }
+    bool empty(void) const
+    {
+        return size() == 0;
+    }
+    void clear(void)
+    {
+        for(std::unique_ptr<Sub>& q : m_queues)
+        {
+            q->clear();
+        }
+    }
+
+    std::vector<std::unique_ptr<Sub>> m_queues;
+};
+
+// 每个NUMA节点一个子队列：工作线程提交的任务进本节点队列，外部线程轮流分配；
+// 取任务时先取本节点，再从其它节点偷，都没有时在共同的event_count上等待
+template<typename QueueType, typename Func>
+class queue_wrapper<PerNode<QueueType>, Func> : public queue_wrapper_base<Func, node_queues<queue_wrapper<QueueType, Func>>>
+{
+private:
+    using sub_type = queue_wrapper<QueueType, Func>;
+    using queue_type = node_queues<sub_type>;
+    using parent_type = queue_wrapper_base<Func, queue_type>;
+
+    static_assert(!std::is_same<QueueType, Schedule>::value, "PerNode does not support Schedule");
+
+public:
+    enum { DEFAULT = sub_type::DEFAULT };
+
+    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
+    : parent_type(threshold, queue_limit)
+    , m_next(0)
+    {
+        const cpu_topology& topo = singleton<cpu_topology, instantiate_policy::Lazy>::get_instance();
+        std::vector<std::unique_ptr<sub_type>>& queues = parent_type::m_queue.m_queues;
+        queues.resize(topo.node_count());
+        for(size_t i = 0; i < queues.size(); i++)
+        {
+            topo.run_on_node(i, [&](){ queues[i].reset(new sub_type(0, queue_limit)); });
+        }
+        // 子队列自己有上限时（LockFree的环），总的上限不能超过它们的和
+        if(queue_limit == 0 && queues[0]->limit() > 0)
+        {
+            uint64_t total = 0;
+            for(const std::unique_ptr<sub_type>& q : queues)
+            {
+                total += q->limit();
+            }
+            parent_type::m_queue_limit = (uint32_t)std::min(total, (uint64_t)UINT32_MAX);
+        }
+    }
+    virtual void clear(void)
+    {
+        parent_type::m_queue.clear();
+        m_event.notify_all();
+    }
+    virtual void add(size_t key, Func&& func)
+    {
+        std::vector<std::unique_ptr<sub_type>>& queues = parent_type::m_queue.m_queues;
+        int node = this_worker_node();
+        size_t index = (node >= 0) ? (size_t)node : m_next++;
+        // 选中的节点队列满了就换下一个，总数已经由add_job按上限挡住
+        for(size_t i = 0; i + 1 < queues.size() && queues[index % queues.size()]->out_of_limit(); i++)
+        {
+            index++;
+        }
+        queues[index % queues.size()]->add(key, std::move(func));
+        m_event.notify_one();
+    }
+    virtual void add_batch(size_t key, std::vector<Func>& funcs)
+    {
+        std::vector<std::unique_ptr<sub_type>>& queues = parent_type::m_queue.m_queues;
+        int node = this_worker_node();
+        size_t index = (node >= 0) ? (size_t)node : m_next++;
+        // 一个节点队列放不下时按各自的余量分到后面的节点
+        size_t pos = 0;
+        for(size_t i = 0; i < queues.size() && pos < funcs.size(); i++)
+        {
+            sub_type& queue = *queues[(index + i) % queues.size()];
+            size_t rest = funcs.size() - pos;
+            size_t take = (i + 1 == queues.size()) ? rest : std::min(queue.room(), rest);
+            if(take == funcs.size())
+            {
+                queue.add_batch(key, funcs);
+            }
+            else if(take > 0)
+            {
+                std::vector<Func> part(std::make_move_iterator(funcs.begin() + pos), std::make_move_iterator(funcs.begin() + pos + take));
+                queue.add_batch(key, part);
+            }
+            pos += take;
+        }
+        m_event.notify_many((uint32_t)std::min(funcs.size(), (size_t)UINT32_MAX));
+    }
+    virtual Func get(void)
+    {
+        using namespace std::chrono;
+
+        Func ret = try_get();
+        if(ret)
+        {
+            return ret;
+        }
+        event_count::key_type key = m_event.prepare_wait();
+        ret = try_get();
+        if(ret)
+        {
+            m_event.cancel_wait();
+            return ret;
+        }
+        m_event.wait_for(key, seconds(parent_type::m_idle_sec));
+        return try_get();
+    }
+    virtual Func try_get(void)
+    {
+        std::vector<std::unique_ptr<sub_type>>& queues = parent_type::m_queue.m_queues;
+        int node = this_worker_node();
+        size_t local = (node >= 0) ? (size_t)node : 0;
+        for(size_t i = 0; i < queues.size(); i++)
+        {
+            Func ret = queues[(local + i) % queues.size()]->try_get();
+            if(ret)
+            {
+                return ret;
+            }
+        }
+        return Func();
+    }
+
+private:
+    std::atomic<size_t> m_next;
+    event_count m_event;
+};
+
+inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+template<typename Strategy>
+struct idle_mode
+{
+};
+
+template<>
+struct idle_mode<Park>
+{
+    enum { value = 0 };
+};
+
+template<>
+struct idle_mode<BusySpin>
+{
+    enum { value = 1 };
+};
+
+template<>
+struct idle_mode<SpinYield>
+{
+    enum { value = 2 };
+};
+
+template<>
+struct idle_mode<SpinPark>
+{
+    enum { value = 3 };
+};
 
-    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
-    : parent_type(threshold, queue_limit)
+// 队列为空时工作线程的等待方式，用CPU换唤醒延迟：
+// Park直接阻塞在队列上；BusySpin一直自旋；SpinYield自旋spins次后不断yield；
+// SpinPark自旋spins次、yield yields次之后再阻塞
+class idle_strategy
+{
+public:
+    idle_strategy(void)
+    : m_mode(idle_mode<Park>::value)
+    , m_spins(1000)
+    , m_yields(100)
     {
     }
-    virtual void add(size_t key, Func&& func)
+    template<typename Strategy>
+    void set(uint32_t spins, uint32_t yields)
     {
-        if(key > PRIORITY_HIGHEST)
-        {
-            key = PRIORITY_HIGHEST;
-        }
-        else if(key < PRIORITY_LOWEST)
-        {
-            key = PRIORITY_LOWEST;
-        }
-        {
-            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
-            parent_type::m_queue.emplace(key, std::move(func));
-        }
-        parent_type::on_add_func();
+        m_spins = spins;
+        m_yields = yields;
+        m_mode = idle_mode<Strategy>::value;
     }
-    virtual Func get(void)
+    template<typename Queue>
+    auto wait(Queue& queue, const std::atomic<bool>& running, uint32_t idle_sec) -> decltype(queue.get())
     {
-        using namespace std;
         using namespace std::chrono;
 
-        auto get_first = [&]() -> Func {
-            auto iter = parent_type::m_queue.begin();
-            if(iter != parent_type::m_queue.end())
+        int mode = m_mode;
+        if(mode == idle_mode<Park>::value)
+        {
+            return queue.get();
+        }
+        uint32_t spins = m_spins;
+        uint32_t yields = m_yields;
+        steady_clock::time_point deadline = steady_clock::now() + seconds(idle_sec);
+        for(uint32_t i = 1; running; i++)
+        {
+            auto ret = queue.try_get();
+            if(ret)
+            {
+                return ret;
+            }
+            if(mode == idle_mode<SpinPark>::value && i > spins + yields)
+            {
+                return queue.get();
+            }
+            if((i & 0x3ff) == 0 && steady_clock::now() >= deadline)
+            {
+                return ret;
+            }
+            if(mode == idle_mode<BusySpin>::value || i <= spins)
             {
-                Func ret = iter->second;
-                parent_type::m_queue.erase(iter);
-                return move(ret);
+                cpu_relax();
             }
             else
             {
-                return move(Func());
+                std::this_thread::yield();
             }
-        };
-        lock_guard<mutex> locker(parent_type::m_mutex);
-        if(!parent_type::m_queue.empty())
+        }
+        return queue.try_get();
+    }
+
+private:
+    std::atomic<int> m_mode;
+    std::atomic<uint32_t> m_spins;
+    std::atomic<uint32_t> m_yields;
+};
+
+// cgroup v2的cpu.max或v1的cfs配额换算成的CPU数，没有限制时返回0
+inline double cgroup_cpu_quota(void)
+{
+    using namespace std;
+    ifstream v2("/sys/fs/cgroup/cpu.max");
+    if(v2)
+    {
+        string quota;
+        double period = 0;
+        v2 >> quota >> period;
+        if(quota.compare("max") != 0 && period > 0)
         {
-            return get_first();
+            return atof(quota.c_str()) / period;
         }
-        else
+        return 0;
+    }
+    static const char* v1_dirs[] = { "/sys/fs/cgroup/cpu/", "/sys/fs/cgroup/cpu,cpuacct/" };
+    for(const char* dir : v1_dirs)
+    {
+        ifstream quota_file(string(dir) + "cpu.cfs_quota_us");
+        ifstream period_file(string(dir) + "cpu.cfs_period_us");
+        double quota = 0;
+        double period = 0;
+        if(quota_file >> quota && period_file >> period)
         {
-            parent_type::m_signal.wait_for(parent_type::m_mutex, seconds(parent_type::m_idle_sec));
-            return get_first();
+            return (quota > 0 && period > 0) ? quota / period : 0;
         }
     }
-};
+    return 0;
+}
 
-template<typename Func>
-class queue_wrapper<Sequence, Func> : public queue_wrapper_base<Func, std::deque<Func>>
+// 取hardware_concurrency、CPU亲和性与cgroup CPU配额三者中最小的那个
+inline uint32_t available_cpus(void)
 {
-private:
-    using queue_type = std::deque<Func>;
-    using parent_type = queue_wrapper_base<Func, queue_type>;
+    uint32_t cpus = std::thread::hardware_concurrency();
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        cpus = CPU_COUNT(&set);
+    }
+#endif // __linux__
+    double quota = cgroup_cpu_quota();
+    if(quota > 0)
+    {
+        cpus = std::min(cpus, (uint32_t)std::ceil(quota));
+    }
+    return std::max(cpus, (uint32_t)1);
+}
 
+// 爬山法调整线程数：上一步让吞吐变好就沿原方向继续，变差就回头，
+// 吞吐持平但排队时间(积压/吞吐)在变长时再试探着加一个线程，没有积压时逐步收缩
+class hill_climbing
+{
 public:
-    enum { DEFAULT = 0 };
-
-    queue_wrapper(uint32_t threshold, uint32_t queue_limit)
-    : parent_type(threshold, queue_limit)
+    hill_climbing(uint32_t min, uint32_t max)
+    : m_min(min)
+    , m_max(std::max(min, max))
+    , m_target(min)
+    , m_direction(1)
+    , m_last_rate(0)
+    , m_last_latency(0)
+    , m_tolerance(0.05)
     {
     }
-    virtual void add(size_t key, Func&& func)
+    uint32_t target(void) const
     {
-        {
-            std::lock_guard<std::mutex> locker(parent_type::m_mutex);
-            parent_type::m_queue.emplace_back(std::move(func));
-        }
-        parent_type::on_add_func();
+        return m_target;
     }
-    virtual Func get(void)
+    uint32_t update(double rate, size_t backlog, uint32_t busy)
     {
-        using namespace std;
-        using namespace std::chrono;
-
-        auto get_first = [&]() -> Func {
-            if(parent_type::m_queue.size() > 0)
-            {
-                Func ret = parent_type::m_queue.front();
-                parent_type::m_queue.pop_front();
-                return move(ret);
-            }
-            else
-            {
-                return move(Func());
-            }
-        };
-        lock_guard<mutex> locker(parent_type::m_mutex);
-        if(!parent_type::m_queue.empty())
+        double latency = (rate > 0) ? (backlog / rate) : (backlog > 0 ? 1e9 : 0);
+        int move = 0;
+        if(backlog == 0)
         {
-            return get_first();
+            move = (busy < m_target) ? -1 : 0;
+            m_direction = 1;
         }
-        else
+        else if(rate > m_last_rate * (1 + m_tolerance))
         {
-            parent_type::m_signal.wait_for(parent_type::m_mutex, seconds(parent_type::m_idle_sec));
-            return get_first();
+            move = m_direction;
+        }
+        else if(rate < m_last_rate * (1 - m_tolerance))
+        {
+            move = -m_direction;
+        }
+        else if(latency > m_last_latency)
+        {
+            move = 1;
+        }
+        if(move != 0)
+        {
+            if(backlog > 0)
+            {
+                m_direction = move;
+            }
+            int target = (int)m_target + move;
+            m_target = (uint32_t)std::min(std::max(target, (int)m_min), (int)m_max);
         }
+        m_last_rate = rate;
+        m_last_latency = latency;
+        return m_target;
     }
+
+private:
+    uint32_t m_min;
+    uint32_t m_max;
+    uint32_t m_target;
+    int m_direction;
+    double m_last_rate;
+    double m_last_latency;
+    double m_tolerance;
 };
 
 class thread_manage_policy_base
@@ -275,27 +1156,69 @@ public:
     thread_manage_policy_base(uint32_t min, uint32_t max)
     : m_min(min)
     , m_max(max)
+    , m_target(max)
     , m_current(0)
+    , m_compensation(0)
     , m_idle_sec(30)
     {
     }
+    static uint32_t default_size(void)
+    {
+        return 4;
+    }
+    bool adaptive(void) const
+    {
+        return false;
+    }
+    bool elastic(void) const
+    {
+        return false;
+    }
     void set_thread_idle_seconds(uint32_t seconds)
     {
         m_idle_sec = seconds;
     }
+    uint32_t min_threads(void) const
+    {
+        return m_min;
+    }
+    uint32_t max_threads(void) const
+    {
+        return m_max;
+    }
+    uint32_t current_threads(void) const
+    {
+        return m_current;
+    }
+    void set_target(uint32_t target)
+    {
+        m_target = std::min(std::max(target, m_min), m_max);
+    }
+    // 每个正在阻塞调用里的工作线程额外占一个线程名额，不计入min/max/target
+    void compensate(bool enter)
+    {
+        if(enter)
+        {
+            m_compensation++;
+        }
+        else
+        {
+            m_compensation--;
+        }
+    }
     bool must_create_thread(void)
     {
         return m_current < m_min;
     }
     bool apply_for_create_thread(void)
     {
-        return m_current < m_max;
+        return m_current < m_target + m_compensation;
     }
     bool apply_for_destory_thread(const std::chrono::steady_clock::time_point& last_active)
     {
         using namespace std::chrono;
 
-        if(m_current > m_max)
+        if(m_current > m_max + m_compensation)
         {
             return true;
         }
@@ -309,6 +1232,19 @@ public:
             return (span >= m_idle_sec);
         }
     }
+    // 线程数超过目标时让一个线程退出，成功时已经替它减掉了计数
+    bool apply_for_retire_thread(void)
+    {
+        uint32_t current = m_current;
+        while(current > m_target + m_compensation)
+        {
+            if(m_current.compare_exchange_weak(current, current - 1))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
     void on_thread_start(void)
     {
         m_current++;
@@ -318,10 +1254,12 @@ public:
         m_current--;
     }
 
-private:
+protected:
     uint32_t m_min;
     uint32_t m_max;
+    std::atomic<uint32_t> m_target;
     std::atomic<uint32_t> m_current;
+    std::atomic<uint32_t> m_compensation;
     uint32_t m_idle_sec;
 };
 
@@ -335,8 +1273,17 @@ class thread_manage_policy<AutoManage> : public thread_manage_policy_base
 {
 public:
     thread_manage_policy(uint32_t cpus)
-    : thread_manage_policy_base(2, cpus + 1)
+    : thread_manage_policy_base(std::min((uint32_t)2, cpus), cpus + 1)
+    {
+        m_target = m_min;
+    }
+    static uint32_t default_size(void)
+    {
+        return available_cpus();
+    }
+    bool adaptive(void) const
     {
+        return true;
     }
 };
 
@@ -360,22 +1307,46 @@ public:
     }
 };
 
+template<>
+class thread_manage_policy<Elastic> : public thread_manage_policy_base
+{
+public:
+    thread_manage_policy(uint32_t)
+    : thread_manage_policy_base(1, 256)
+    {
+    }
+    bool elastic(void) const
+    {
+        return true;
+    }
+};
+
 } // namespace native
 
 template<typename QueueType = Schedule, typename Policy = AutoManage>
 class thread_pool
 {
 private:
-    using func_type = std::function<void ()>;
+    using func_type = native::pool_job;
     using queue_type = native::queue_wrapper<QueueType, func_type>;
     using policy_base_type = native::thread_manage_policy_base;
     using policy_type = native::thread_manage_policy<Policy>;
 
+public:
+    using job_handle = timer_handle;
+
 public:
     thread_pool(uint32_t queue_limit = 1000)
     : m_queue(std::min((uint32_t)50, queue_limit / 10), queue_limit)
-    , m_policy(4)
+    , m_policy(policy_type::default_size())
     , m_running(false)
+    , m_busy(0)
+    , m_stats_on(true)
+    , m_sample(64)
+    , m_worker_seq(0)
+    , m_affinity(false)
+    , m_adjust_ms(100)
+    , m_batch(1)
     , m_idle_sec(30)
     {
         m_policy.set_thread_idle_seconds(m_idle_sec);
@@ -397,19 +1368,30 @@ public:
             m_running = true;
             while(m_policy.must_create_thread())
             {
-                lock_guard<mutex> locker(m_threads_mutex);
-                m_threads.push_back(thread(&thread_pool::worker_thread, this));
+                create_thread();
             }
             m_last_check = steady_clock::now();
+            if(m_policy.adaptive())
+            {
+                m_controller = thread(&thread_pool::controller_thread, this);
+            }
         }
     }
     void stop(void)
     {
         m_running = false;
+        {
+            std::lock_guard<std::mutex> locker(m_controller_mutex);
+        }
+        m_controller_signal.notify_all();
         m_queue.clear();
     }
     void join(void)
     {
+        if(m_controller.joinable())
+        {
+            m_controller.join();
+        }
         std::lock_guard<std::mutex> locker(m_threads_mutex);
         for(std::thread& t : m_threads)
         {
@@ -430,26 +1412,126 @@ public:
             m_policy.set_thread_idle_seconds(m_idle_sec);
         }
     }
-    bool add_job(const func_type& func, int arg = queue_type::DEFAULT)
+    void set_adjust_interval(uint32_t milliseconds)
     {
-        using namespace std;
-        using namespace std::chrono;
-        if(!m_running || m_queue.out_of_limit())
+        m_adjust_ms = std::max(milliseconds, (uint32_t)1);
+    }
+    // 只对AutoManage有效：控制线程每次调整完线程数后调用一次，用来做不需要很准的定期检查；
+    // hook里不能阻塞，耗时的工作提交成任务
+    void set_tick_hook(std::function<void ()>&& hook)
+    {
+        std::lock_guard<std::mutex> locker(m_controller_mutex);
+        m_tick_hook = std::move(hook);
+    }
+    // 在BusySpin/SpinYield/SpinPark/Park中选择空闲线程的等待方式，运行中也可以切换
+    template<typename Strategy>
+    void set_idle_strategy(uint32_t spins = 1000, uint32_t yields = 100)
+    {
+        m_idle.template set<Strategy>(spins, yields);
+    }
+    // 工作线程每次最多连续取走jobs个任务，减少取任务时的加锁次数，默认1
+    void set_worker_batch(uint32_t jobs)
+    {
+        m_batch = std::max(jobs, (uint32_t)1);
+    }
+    // 开启后每个工作线程在下一次取任务前绑定到拓扑分给它的CPU上
+    void set_cpu_affinity(bool on = true)
+    {
+        m_affinity = on;
+    }
+    // 只对thread_pool<Schedule>有效，handle来自add_timer_job，任务已经开始执行或已被取消时返回false
+    bool cancel_job(const job_handle& handle)
+    {
+        return m_queue.cancel(handle);
+    }
+    // 当前工作线程要进入阻塞调用前调用，线程池临时多开一个线程顶替它；
+    // 与leave_blocking成对调用，之后多出来的线程在空闲时退出
+    void enter_blocking(void)
+    {
+        m_policy.compensate(true);
+        if(m_running && m_policy.apply_for_create_thread())
         {
-            return false;
+            create_thread();
+        }
+    }
+    void leave_blocking(void)
+    {
+        m_policy.compensate(false);
+    }
+    // 只对thread_pool<Priority>有效
+    void set_priority_aging(uint32_t milliseconds)
+    {
+        m_queue.set_aging_milliseconds(milliseconds);
+    }
+    uint32_t thread_count(void) const
+    {
+        return m_policy.current_threads();
+    }
+    // 计数与延迟直方图的快照，计数来自各线程的分片之和，不是严格同一时刻的值
+    thread_pool_stats stats(void) const
+    {
+        thread_pool_stats ret;
+        m_stats.collect(ret);
+        ret.m_pending = m_queue.size();
+        ret.m_threads = m_policy.current_threads();
+        ret.m_busy = m_busy;
+        ret.m_idle = (ret.m_threads > ret.m_busy) ? (ret.m_threads - ret.m_busy) : 0;
+        return ret;
+    }
+    // 每个提交线程每every个任务记录一次等待/执行时间，0表示只计数不计时，默认64；
+    // 每个任务都计时要多读三次时钟，提交密集时开销明显
+    void set_stats_sampling(uint32_t every)
+    {
+        m_sample = every;
+    }
+    // 关闭后不再计数也不计时，stats()里只有线程数和积压是准的；AutoManage的控制线程仍然要数完成的任务
+    void enable_stats(bool on = true)
+    {
+        m_stats_on = on;
+    }
+    // 任务被拒绝(线程池已停止或超过queue_limit)时返回false
+    bool add_job(func_type&& func, int arg = queue_type::DEFAULT)
+    {
+        return (bool)submit(std::move(func), arg);
+    }
+    // 只对thread_pool<Schedule>有效，delay是延迟的微秒数；返回的句柄可以用来cancel_job，任务被拒绝时为false
+    job_handle add_timer_job(func_type&& func, int delay = queue_type::DEFAULT)
+    {
+        static_assert(std::is_same<QueueType, Schedule>::value, "add_timer_job needs thread_pool<Schedule>");
+        return submit(std::move(func), delay);
+    }
+    // 一次提交[first, last)里的任务：只加一次锁，只唤醒需要的线程，只检查一次是否要建线程；
+    // 超过queue_limit的部分不提交，返回实际提交的个数。想移动任务时可以传move_iterator
+    template<typename Iterator>
+    size_t add_jobs(Iterator first, Iterator last, int arg = queue_type::DEFAULT)
+    {
+        bool counted = m_stats_on.load(std::memory_order_relaxed);
+        size_t room = m_running ? m_queue.room() : 0;
+        uint64_t stamp = counted ? native::pool_counters::sample_clock(m_sample) : 0;
+        std::vector<func_type> jobs;
+        for(; first != last && jobs.size() < room; ++first)
+        {
+            jobs.emplace_back(*first);
+            jobs.back().m_enqueued = stamp;
         }
-        m_queue.add(arg, func_type(func));
-        if(m_policy.must_create_thread() || (m_queue.out_of_threshold() && m_policy.apply_for_create_thread()))
+        if(counted && first != last)
         {
-            lock_guard<mutex> locker(m_threads_mutex);
-            m_threads.push_back(thread(&thread_pool::worker_thread, this));
+            m_stats.on_rejected(std::distance(first, last));
         }
-        uint32_t span = duration_cast<duration<uint32_t>>(steady_clock::now() - m_last_check).count();
-        if(span >= 10)
+        if(jobs.empty())
         {
-            thread(&thread_pool::check_exits, this).detach();
+            return 0;
         }
-        return true;
+        m_queue.add_batch(arg, jobs);
+        if(counted)
+        {
+            m_stats.on_queued(jobs.size());
+        }
+        if(need_thread())
+        {
+            create_thread();
+        }
+        return jobs.size();
     }
     template<typename... Types>
     bool add_job(const std::function<void (Types...)>& func, Types... args, int arg = queue_type::DEFAULT)
@@ -458,34 +1540,181 @@ public:
     }
 
 private:
-    void worker_thread(void)
+    job_handle submit(func_type&& func, int arg)
+    {
+        using namespace std;
+        using namespace std::chrono;
+        bool counted = m_stats_on.load(std::memory_order_relaxed);
+        if(!m_running || m_queue.out_of_limit())
+        {
+            if(counted)
+            {
+                m_stats.on_rejected();
+            }
+            return job_handle();
+        }
+        func.m_enqueued = counted ? native::pool_counters::sample_clock(m_sample) : 0;
+        job_handle ret = native::add_to_queue(m_queue, arg, std::move(func));
+        if(counted && ret)
+        {
+            m_stats.on_queued();
+        }
+        if(need_thread())
+        {
+            create_thread();
+        }
+        if(!m_policy.adaptive())
+        {
+            uint32_t span = duration_cast<duration<uint32_t>>(steady_clock::now() - m_last_check).count();
+            if(span >= 10)
+            {
+                thread(&thread_pool::check_exits, this).detach();
+            }
+        }
+        return ret;
+    }
+    // AutoManage的线程数由控制线程调整，其余策略在提交时按积压决定是否加线程
+    bool need_thread(void)
+    {
+        if(m_policy.must_create_thread())
+        {
+            return true;
+        }
+        if(m_policy.adaptive())
+        {
+            return false;
+        }
+        bool backlog = m_queue.out_of_threshold() || (m_policy.elastic() && m_busy + m_queue.size() > m_policy.current_threads());
+        return backlog && m_policy.apply_for_create_thread();
+    }
+    void create_thread(void)
+    {
+        m_policy.on_thread_start();
+        std::lock_guard<std::mutex> locker(m_threads_mutex);
+        m_threads.push_back(std::thread(&thread_pool::worker_thread, this, m_worker_seq++));
+    }
+    void worker_thread(size_t index)
     {
         using namespace std;
         using namespace std::chrono;
 
+        // 拓扑要读sysfs，只有PerNode和绑核时才用到，普通线程池不去加载；
+        // 用Lazy的单例，Normal的单例在程序启动时就会构造
+        if(native::is_per_node<QueueType>::value)
+        {
+            native::this_worker_node() = (int)singleton<cpu_topology, instantiate_policy::Lazy>::get_instance().node_of_worker(index);
+        }
+        vector<func_type> batch;
+        bool bound = false;
         bool work = true;
-        m_policy.on_thread_start();
+        bool retired = false;
         steady_clock::time_point last_active = steady_clock::now();
         while(work && m_running)
         {
-            func_type func = m_queue.get();
+            if(!bound && m_affinity)
+            {
+                cpu_topology::bind_this_thread(singleton<cpu_topology, instantiate_policy::Lazy>::get_instance().cpu_of_worker(index));
+                bound = true;
+            }
+            func_type func = m_idle.wait(m_queue, m_running, m_idle_sec);
             if(func)
             {
-                func();
+                m_busy++;
+                bool counted = m_stats_on.load(std::memory_order_relaxed);
+                if(counted)
+                {
+                    m_stats.on_started();
+                }
+                run_job(func, counted);
+                uint32_t limit = m_batch;
+                if(limit > 1 && m_queue.try_get_batch(batch, limit - 1) > 0)
+                {
+                    if(counted)
+                    {
+                        m_stats.on_started(batch.size());
+                    }
+                    for(func_type& f : batch)
+                    {
+                        run_job(f, counted);
+                    }
+                    batch.clear();
+                }
+                m_busy--;
                 last_active = steady_clock::now();
+                retired = m_policy.adaptive() && m_policy.apply_for_retire_thread();
+                work = !retired;
+            }
+            else if(m_policy.adaptive() && m_policy.apply_for_retire_thread())
+            {
+                retired = true;
+                work = false;
             }
-            else if(m_policy.apply_for_destory_thread(last_active))
+            else if(!m_policy.adaptive() && m_policy.apply_for_destory_thread(last_active))
             {
                 work = false;
             }
         }
-        m_policy.on_thread_exit();
+        if(!retired)
+        {
+            m_policy.on_thread_exit();
+        }
         {
             thread::id tid = this_thread::get_id();
             lock_guard<mutex> locker(m_exits_mutex);
             m_exits.push_back(tid);
         }
     }
+    void run_job(func_type& func, bool counted)
+    {
+        if(func.m_enqueued == 0)
+        {
+            func();
+            if(counted || m_policy.adaptive())
+            {
+                m_stats.on_completed(0, 0);
+            }
+            return;
+        }
+        uint64_t start = native::pool_counters::now_ns();
+        func();
+        uint64_t end = native::pool_counters::now_ns();
+        m_stats.on_completed(std::max(start - std::min(start, func.m_enqueued), (uint64_t)1), std::max(end - start, (uint64_t)1));
+    }
+    // 只有AutoManage会启动，按固定间隔采样完成的任务数与积压，爬山调整线程数，并回收退出的线程
+    void controller_thread(void)
+    {
+        using namespace std;
+        using namespace std::chrono;
+
+        native::hill_climbing climber(m_policy.min_threads(), m_policy.max_threads());
+        uint64_t last_completed = m_stats.completed();
+        steady_clock::time_point last = steady_clock::now();
+        unique_lock<mutex> locker(m_controller_mutex);
+        while(m_running)
+        {
+            m_controller_signal.wait_for(locker, milliseconds(m_adjust_ms));
+            if(!m_running)
+            {
+                break;
+            }
+            steady_clock::time_point now = steady_clock::now();
+            uint64_t completed = m_stats.completed();
+            double secs = duration_cast<duration<double>>(now - last).count();
+            double rate = (secs > 0) ? (completed - last_completed) / secs : 0;
+            m_policy.set_target(climber.update(rate, m_queue.size(), m_busy));
+            while(m_running && m_policy.apply_for_create_thread())
+            {
+                create_thread();
+            }
+            check_exits();
+            if(m_tick_hook)
+            {
+                m_tick_hook();
+            }
+            last_completed = completed;
+            last = now;
+        }
+    }
     void check_exits(void)
     {
         using namespace std;
@@ -524,6 +1753,13 @@ private:
     queue_type m_queue;
     policy_type m_policy;
     std::atomic<bool> m_running;
+    native::idle_strategy m_idle;
+    std::atomic<uint32_t> m_busy;
+    native::pool_counters m_stats;
+    std::atomic<bool> m_stats_on;
+    std::atomic<uint32_t> m_sample;
+    std::atomic<size_t> m_worker_seq;
+    std::atomic<bool> m_affinity;
 
     std::vector<std::thread> m_threads;
     std::mutex m_threads_mutex;
@@ -531,10 +1767,16 @@ private:
     std::mutex m_exits_mutex;
     std::chrono::steady_clock::time_point m_last_check;
 
+    std::thread m_controller;
+    std::mutex m_controller_mutex;
+    std::condition_variable m_controller_signal;
+    std::function<void ()> m_tick_hook;
+    uint32_t m_adjust_ms;
+
+    std::atomic<uint32_t> m_batch;
     uint32_t m_idle_sec;
 };
 
 } // namespace snower
 
 #endif // __SNOWER_THREAD_POOL_H__
-
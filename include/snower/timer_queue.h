@@ -0,0 +1,236 @@
+#ifndef __SNOWER_TIMER_QUEUE_H__
+#define __SNOWER_TIMER_QUEUE_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif // __linux__
+
+namespace snower
+{
+
+// 定时任务的取消句柄，槽位被复用后代数会变化，旧句柄自然失效
+class timer_handle
+{
+public:
+    enum { NO_SLOT = 0xffffffff };
+
+    timer_handle(void)
+    : m_slot(NO_SLOT)
+    , m_generation(0)
+    {
+    }
+    timer_handle(uint32_t slot, uint32_t generation)
+    : m_slot(slot)
+    , m_generation(generation)
+    {
+    }
+    // 任务已被接受但不能取消(非定时队列)
+    static timer_handle accepted(void)
+    {
+        return timer_handle(NO_SLOT, 1);
+    }
+    explicit operator bool (void) const
+    {
+        return m_generation != 0;
+    }
+    uint32_t slot(void) const
+    {
+        return m_slot;
+    }
+    uint32_t generation(void) const
+    {
+        return m_generation;
+    }
+
+private:
+    uint32_t m_slot;
+    uint32_t m_generation;
+};
+
+// 4叉最小堆，堆里只放到期时间和槽位号，任务本身放在槽位里，
+// 槽位记录自己在堆中的位置，所以取消是O(log n)
+template<typename Item, typename Clock = std::chrono::steady_clock>
+class timer_heap
+{
+public:
+    using time_point = typename Clock::time_point;
+
+private:
+    struct node
+    {
+        time_point m_deadline;
+        uint32_t m_slot;
+    };
+    struct slot
+    {
+        Item m_item;
+        uint32_t m_generation;
+        uint32_t m_pos;
+    };
+    enum { ARITY = 4 };
+
+public:
+    size_t size(void) const
+    {
+        return m_heap.size();
+    }
+    bool empty(void) const
+    {
+        return m_heap.empty();
+    }
+    void clear(void)
+    {
+        m_heap.clear();
+        m_slots.clear();
+        m_free.clear();
+    }
+    const time_point& top_deadline(void) const
+    {
+        return m_heap.front().m_deadline;
+    }
+    timer_handle push(const time_point& deadline, Item&& item)
+    {
+        uint32_t index;
+        if(m_free.empty())
+        {
+            index = (uint32_t)m_slots.size();
+            m_slots.push_back(slot{ std::move(item), 1, 0 });
+        }
+        else
+        {
+            index = m_free.back();
+            m_free.pop_back();
+            m_slots[index].m_item = std::move(item);
+        }
+        m_heap.push_back(node{ deadline, index });
+        m_slots[index].m_pos = (uint32_t)(m_heap.size() - 1);
+        sift_up(m_heap.size() - 1);
+        return timer_handle(index, m_slots[index].m_generation);
+    }
+    // 任务还在堆中时取消，已经到期取走或已经取消过的返回false
+    bool cancel(const timer_handle& handle)
+    {
+        uint32_t index = handle.slot();
+        if(index >= m_slots.size() || m_slots[index].m_generation != handle.generation())
+        {
+            return false;
+        }
+        remove_at(m_slots[index].m_pos);
+        return true;
+    }
+    // 一次取出所有now之前到期的任务，追加到out后面，返回取出的个数
+    template<typename Container>
+    size_t pop_expired(const time_point& now, Container& out)
+    {
+        size_t ret = 0;
+        while(!m_heap.empty() && m_heap.front().m_deadline <= now)
+        {
+            out.push_back(std::move(m_slots[m_heap.front().m_slot].m_item));
+            remove_at(0);
+            ret++;
+        }
+        return ret;
+    }
+
+private:
+    void remove_at(size_t pos)
+    {
+        uint32_t index = m_heap[pos].m_slot;
+        slot& s = m_slots[index];
+        s.m_item = Item();
+        if(++s.m_generation == 0)
+        {
+            s.m_generation = 1;
+        }
+        m_free.push_back(index);
+        size_t last = m_heap.size() - 1;
+        if(pos != last)
+        {
+            m_heap[pos] = m_heap[last];
+            m_slots[m_heap[pos].m_slot].m_pos = (uint32_t)pos;
+        }
+        m_heap.pop_back();
+        if(pos < m_heap.size())
+        {
+            uint32_t moved = m_heap[pos].m_slot;
+            sift_up(pos);
+            sift_down(m_slots[moved].m_pos);
+        }
+    }
+    void sift_up(size_t pos)
+    {
+        node n = m_heap[pos];
+        while(pos > 0)
+        {
+            size_t parent = (pos - 1) / ARITY;
+            if(!(n.m_deadline < m_heap[parent].m_deadline))
+            {
+                break;
+            }
+            place(pos, m_heap[parent]);
+            pos = parent;
+        }
+        place(pos, n);
+    }
+    void sift_down(size_t pos)
+    {
+        node n = m_heap[pos];
+        size_t total = m_heap.size();
+        while(true)
+        {
+            size_t first = pos * ARITY + 1;
+            if(first >= total)
+            {
+                break;
+            }
+            size_t best = first;
+            size_t end = std::min(first + ARITY, total);
+            for(size_t i = first + 1; i < end; i++)
+            {
+                if(m_heap[i].m_deadline < m_heap[best].m_deadline)
+                {
+                    best = i;
+                }
+            }
+            if(!(m_heap[best].m_deadline < n.m_deadline))
+            {
+                break;
+            }
+            place(pos, m_heap[best]);
+            pos = best;
+        }
+        place(pos, n);
+    }
+    void place(size_t pos, const node& n)
+    {
+        m_heap[pos] = n;
+        m_slots[n.m_slot].m_pos = (uint32_t)pos;
+    }
+
+private:
+    std::vector<node> m_heap;
+    std::vector<slot> m_slots;
+    std::vector<uint32_t> m_free;
+};
+
+// 把本线程的timer slack调到最小，之后的定时睡眠(包括条件变量的超时等待)精度可以到几十微秒
+inline void use_precise_timer_slack(void)
+{
+#ifdef __linux__
+    static thread_local bool slack = false;
+    if(!slack)
+    {
+        prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+        slack = true;
+    }
+#endif // __linux__
+}
+
+} // namespace snower
+
+#endif // __SNOWER_TIMER_QUEUE_H__
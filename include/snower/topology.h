@@ -0,0 +1,215 @@
+#ifndef __SNOWER_TOPOLOGY_H__
+#define __SNOWER_TOPOLOGY_H__
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace snower
+{
+
+// 从sysfs读取的CPU/NUMA拓扑，没有node目录(单节点或非Linux)时退化为一个节点
+class cpu_topology
+{
+public:
+    // allowed_only时去掉不在本进程CPU亲和性掩码里的CPU(比如容器的cpuset)
+    cpu_topology(const std::string& sysfs_root = "/sys", bool allowed_only = true)
+    {
+        load(sysfs_root, allowed_only);
+    }
+
+    size_t node_count(void) const
+    {
+        return m_nodes.size();
+    }
+    const std::vector<int>& node_cpus(size_t node) const
+    {
+        return m_nodes[node % m_nodes.size()];
+    }
+    size_t cpu_count(void) const
+    {
+        size_t ret = 0;
+        for(const std::vector<int>& cpus : m_nodes)
+        {
+            ret += cpus.size();
+        }
+        return ret;
+    }
+    int node_of_cpu(int cpu) const
+    {
+        for(size_t i = 0; i < m_nodes.size(); i++)
+        {
+            if(std::find(m_nodes[i].begin(), m_nodes[i].end(), cpu) != m_nodes[i].end())
+            {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+    // 第index个工作线程所在的节点和CPU：节点间轮流分配，节点内依次使用各个CPU
+    size_t node_of_worker(size_t index) const
+    {
+        return index % m_nodes.size();
+    }
+    int cpu_of_worker(size_t index) const
+    {
+        const std::vector<int>& cpus = node_cpus(node_of_worker(index));
+        return cpus.empty() ? -1 : cpus[(index / m_nodes.size()) % cpus.size()];
+    }
+
+    static bool bind_this_thread(int cpu)
+    {
+#ifdef __linux__
+        if(cpu < 0)
+        {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif // __linux__
+    }
+    static bool bind_this_thread(const std::vector<int>& cpus)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif // __linux__
+    }
+    // 在绑定到node的临时线程上执行func，func里首次写入的内存会按first-touch分配在该节点上
+    void run_on_node(size_t node, const std::function<void ()>& func) const
+    {
+        if(m_nodes.size() <= 1)
+        {
+            func();
+            return;
+        }
+        const std::vector<int>& cpus = node_cpus(node);
+        std::thread t([&](){
+                bind_this_thread(cpus);
+                func();
+            });
+        t.join();
+    }
+
+    static std::vector<int> parse_cpu_list(const std::string& list)
+    {
+        using namespace std;
+        vector<int> ret;
+        size_t pos = 0;
+        while(pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            if(end == list.npos)
+            {
+                end = list.size();
+            }
+            string part = list.substr(pos, end - pos);
+            size_t dash = part.find('-');
+            if(!part.empty() && part[0] >= '0' && part[0] <= '9')
+            {
+                int first = atoi(part.c_str());
+                int last = (dash != part.npos) ? atoi(part.c_str() + dash + 1) : first;
+                for(int cpu = first; cpu <= last; cpu++)
+                {
+                    ret.push_back(cpu);
+                }
+            }
+            pos = end + 1;
+        }
+        return ret;
+    }
+
+private:
+    void load(const std::string& root, bool allowed_only)
+    {
+        using namespace std;
+        string node_dir = root + "/devices/system/node";
+        DIR* dir = opendir(node_dir.c_str());
+        vector<int> ids;
+        if(dir != nullptr)
+        {
+            struct dirent* ent;
+            while((ent = readdir(dir)) != nullptr)
+            {
+                if(strncmp(ent->d_name, "node", 4) == 0 && ent->d_name[4] >= '0' && ent->d_name[4] <= '9')
+                {
+                    ids.push_back(atoi(ent->d_name + 4));
+                }
+            }
+            closedir(dir);
+        }
+        sort(ids.begin(), ids.end());
+        for(int id : ids)
+        {
+            vector<int> cpus = parse_cpu_list(read_line(node_dir + "/node" + to_string(id) + "/cpulist"));
+            if(allowed_only)
+            {
+                filter_allowed(cpus);
+            }
+            if(!cpus.empty())
+            {
+                m_nodes.push_back(move(cpus));
+            }
+        }
+        if(m_nodes.empty())
+        {
+            vector<int> cpus = parse_cpu_list(read_line(root + "/devices/system/cpu/online"));
+            if(allowed_only)
+            {
+                filter_allowed(cpus);
+            }
+            if(cpus.empty())
+            {
+                for(unsigned i = 0; i < max(thread::hardware_concurrency(), 1u); i++)
+                {
+                    cpus.push_back(i);
+                }
+            }
+            m_nodes.push_back(move(cpus));
+        }
+    }
+    static void filter_allowed(std::vector<int>& cpus)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](int cpu){ return !CPU_ISSET(cpu, &set); }), cpus.end());
+        }
+#endif // __linux__
+    }
+    static std::string read_line(const std::string& file)
+    {
+        std::string ret;
+        std::ifstream in(file);
+        std::getline(in, ret);
+        return ret;
+    }
+
+private:
+    std::vector<std::vector<int>> m_nodes;
+};
+
+} // namespace snower
+
+#endif // __SNOWER_TOPOLOGY_H__
@@ -1,11 +1,16 @@
 #include <snower/actor/actor.h>
+#include <snower/actor/actor_system.h>
 
 namespace snower
 {
 namespace actor
 {
 
-actor::actor(void) {}
+actor::actor(void)
+: m_system(nullptr)
+, m_blocking(false)
+{
+}
 
 actor::~actor(void) {}
 
@@ -23,6 +28,11 @@ const actor_address& actor::get_self(void) const
     return m_self;
 }
 
+actor_system& actor::get_system(void) const
+{
+    return (m_system != nullptr) ? *m_system : singleton<actor_system>::get_instance();
+}
+
 const void actor::enroll_creator(void) const
 {
 }
@@ -31,6 +41,19 @@ void actor::quit(void)
 {
 }
 
+void actor::on_hibernate(void)
+{
+}
+
+void actor::on_wakeup(void)
+{
+}
+
+bool actor::yield_point(void)
+{
+    return actor_system::consume_reduction();
+}
+
 void actor::set_self(const actor_address& addr)
 {
     m_self = addr;
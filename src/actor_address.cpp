@@ -11,24 +11,28 @@ namespace actor
 actor_local_id::actor_local_id(void)
 : m_id(0)
 , m_name("")
+, m_system(nullptr)
 {
 }
 
 actor_local_id::actor_local_id(uint64_t id, const std::string& name)
 : m_id(id)
 , m_name(name)
+, m_system(nullptr)
 {
 }
 
 actor_local_id::actor_local_id(const actor_local_id& addr)
 : m_id(addr.m_id)
 , m_name(addr.m_name)
+, m_system(addr.m_system)
 {
 }
 
 actor_local_id::actor_local_id(actor_local_id&& addr)
 : m_id(addr.m_id)
 , m_name(std::move(addr.m_name))
+, m_system(addr.m_system)
 {
 }
 
@@ -36,6 +40,7 @@ actor_local_id& actor_local_id::operator = (const actor_local_id& addr)
 {
     m_id = addr.m_id;
     m_name = addr.m_name;
+    m_system = addr.m_system;
     return *this;
 }
 
@@ -43,6 +48,7 @@ actor_local_id& actor_local_id::operator = (actor_local_id&& addr)
 {
     m_id = addr.m_id;
     m_name = std::move(addr.m_name);
+    m_system = addr.m_system;
     return *this;
 }
 
@@ -218,6 +224,12 @@ bool actor_address::is_local(void) const
     return operator bool() && !is_remote();
 }
 
+actor_system* actor_address::get_system(void) const
+{
+    std::shared_ptr<actor_local_id> lid = m_local_id.lock();
+    return lid ? lid->m_system : nullptr;
+}
+
 actor_address::operator actor_local_id(void) const
 {
     std::shared_ptr<actor_local_id> ret = m_local_id.lock();
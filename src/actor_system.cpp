@@ -8,6 +8,10 @@ namespace actor
 actor_system::actor_ref actor_system::get_actor(const actor_local_id& addr)
 {
     using namespace std;
+    if(addr.m_system != nullptr && addr.m_system != this)
+    {
+        return addr.m_system->get_actor(addr);
+    }
     uint64_t id = addr.get_id();
     id_actor_map_type::iterator iter;
     {
@@ -25,6 +29,12 @@ actor_system::actor_ref actor_system::get_actor(const actor_local_id& addr)
 
 void actor_system::stop(const actor_address& addr)
 {
+    actor_system* owner = addr.get_system();
+    if(owner != nullptr && owner != this)
+    {
+        owner->stop(addr);
+        return;
+    }
     if(addr.is_local())
     {
         erase_actor((const actor_local_id&)addr);
@@ -36,25 +46,258 @@ bool actor_system::valid_name(const std::string& name) const
     return name.find_first_of("/#.@") != name.npos;
 }
 
-void actor_system::pool_mailbox(mailbox_ref mb)
+void actor_system::set_hibernate_seconds(uint32_t seconds)
+{
+    m_hibernate_sec = seconds;
+}
+
+void actor_system::hibernate_idle_actors(void)
+{
+    using namespace std;
+    using namespace std::chrono;
+    uint32_t sec = m_hibernate_sec;
+    // 按桶分批复制出邮箱和actor，每批只短暂持有m_lock_maps，不挡住spawn和send；
+    // 两批之间表被rehash时可能漏掉或重复检查一些actor，漏掉的下一轮再休眠，重复的hibernate()会拒绝
+    vector<pair<mailbox_ref, actor_ref>> chunk;
+    size_t bucket = 0;
+    while(true)
+    {
+        chunk.clear();
+        {
+            lock_guard<mutex> locker(m_lock_maps);
+            size_t buckets = m_actors.bucket_count();
+            if(bucket >= buckets)
+            {
+                break;
+            }
+            for(; bucket < buckets && chunk.size() < HIBERNATE_CHUNK; bucket++)
+            {
+                for(auto i = m_actors.begin(bucket); i != m_actors.end(bucket); ++i)
+                {
+                    chunk.emplace_back(get<1>(i->second), get<2>(i->second));
+                }
+            }
+        }
+        for(auto& i : chunk)
+        {
+            if(!i.first->hibernate(seconds(sec)))
+            {
+                continue;
+            }
+            i.second->on_hibernate();
+            i.first->hibernate_done();
+            if(i.first->add_to_pool())
+            {
+                pool_mailbox(i.first, i.second);
+            }
+        }
+    }
+}
+
+void actor_system::check_hibernate(void)
+{
+    using namespace std::chrono;
+    uint32_t sec = m_hibernate_sec;
+    if(sec == 0)
+    {
+        return;
+    }
+    steady_clock::rep now = steady_clock::now().time_since_epoch().count();
+    steady_clock::rep last = m_last_hibernate;
+    if((now - last) >= steady_clock::duration(seconds(sec)).count() && m_last_hibernate.compare_exchange_strong(last, now))
+    {
+        m_scheduled++;
+        if(!m_thread_pool.add_job([this](){ hibernate_idle_actors(); schedule_done(); }))
+        {
+            schedule_done();
+        }
+    }
+}
+
+bool actor_system::wait_for_all_actor_done(const std::chrono::steady_clock::time_point& deadline)
+{
+    using namespace std;
+    using namespace std::chrono;
+    unique_lock<mutex> locker(m_idle_mutex);
+    if(deadline == steady_clock::time_point::max())
+    {
+        m_idle_signal.wait(locker, [this](){ return quiescent(); });
+        return true;
+    }
+    return m_idle_signal.wait_until(locker, deadline, [this](){ return quiescent(); });
+}
+
+void actor_system::wait_for_all_actor_done(void)
+{
+    wait_for_all_actor_done(std::chrono::steady_clock::time_point::max());
+}
+
+bool actor_system::shutdown(const std::chrono::steady_clock::time_point& deadline)
+{
+    using namespace std;
+    m_accepting = false;
+    bool ret = wait_for_all_actor_done(deadline);
+    // 过了deadline，正在处理邮箱的线程做完手上这条消息就退出
+    m_expired = !ret;
+    m_thread_pool.stop();
+    m_blocking_pool.stop();
+    m_thread_pool.join();
+    m_blocking_pool.join();
+    if(!ret)
+    {
+        // 工作线程都已结束，丢掉没来得及处理的消息，放开被排进线程池的邮箱，以便之后还能start；
+        // 这时还在send_as里的线程计过的数不能清掉，只减去确实丢掉的消息
+        size_t dropped = 0;
+        {
+            lock_guard<mutex> locker(m_lock_maps);
+            for(auto& i : m_actors)
+            {
+                mailbox_ref& mb = get<1>(i.second);
+                dropped += mb->clear();
+                mb->thread_pool_leave();
+            }
+        }
+        // 线程池stop时丢掉的邮箱任务不会再执行到schedule_done
+        m_scheduled = 0;
+        message_done(dropped);
+    }
+    return ret;
+}
+
+void actor_system::start(void)
+{
+    using namespace std;
+    m_expired = false;
+    m_thread_pool.start();
+    m_blocking_pool.start();
+    m_accepting = true;
+    // shutdown超时以后和它并发的send_as还可能留下消息，这里重新调度
+    vector<pair<mailbox_ref, actor_ref>> pending;
+    {
+        lock_guard<mutex> locker(m_lock_maps);
+        for(auto& i : m_actors)
+        {
+            if(get<1>(i.second)->add_to_pool())
+            {
+                pending.emplace_back(get<1>(i.second), get<2>(i.second));
+            }
+        }
+    }
+    for(auto& i : pending)
+    {
+        pool_mailbox(i.first, i.second);
+    }
+}
+
+void actor_system::set_reduction_budget(uint32_t reductions)
+{
+    m_budget = reductions;
+}
+
+bool actor_system::consume_reduction(void)
+{
+    activation& act = current_activation();
+    if(!act.m_active)
+    {
+        return false;
+    }
+    act.m_reductions++;
+    return act.m_budget > 0 && act.m_reductions >= act.m_budget;
+}
+
+actor_system::activation& actor_system::current_activation(void)
+{
+    static thread_local activation act = { false, false, nullptr, 0, 0 };
+    return act;
+}
+
+// 只有普通actor的处理函数里需要补偿，阻塞线程池本来就会按需加线程
+bool actor_system::enter_blocking(void)
+{
+    activation& ctx = current_activation();
+    if(!ctx.m_active || ctx.m_blocking)
+    {
+        return false;
+    }
+    m_thread_pool.enter_blocking();
+    return true;
+}
+
+void actor_system::leave_blocking(void)
+{
+    m_thread_pool.leave_blocking();
+}
+
+bool actor_system::quiescent(void) const
+{
+    return m_inflight == 0 && m_scheduled == 0;
+}
+
+void actor_system::message_done(size_t count)
+{
+    if(count > 0 && (m_inflight -= count) == 0 && m_scheduled == 0)
+    {
+        std::lock_guard<std::mutex> locker(m_idle_mutex);
+        m_idle_signal.notify_all();
+    }
+}
+
+void actor_system::schedule_done(void)
+{
+    if(--m_scheduled == 0 && m_inflight == 0)
+    {
+        std::lock_guard<std::mutex> locker(m_idle_mutex);
+        m_idle_signal.notify_all();
+    }
+}
+
+void actor_system::pool_mailbox(mailbox_ref mb, actor_ref act)
 {
-    m_thread_pool.add_job([mb, this](){
-            logger& l = singletons<logger>::get_instance("actor_system");
+    m_scheduled++;
+    auto job = [mb, act, this]() mutable {
+            logger& l = SNOWER_LOGGER("actor_system");
             mb->thread_pool_enter();
+            if(mb->wakeup())
+            {
+                act->on_wakeup();
+            }
+            activation& ctx = current_activation();
+            ctx.m_active = true;
+            ctx.m_blocking = act->m_blocking;
+            ctx.m_system = this;
+            ctx.m_reductions = 0;
+            ctx.m_budget = m_budget;
             std::function<void()> func = mb->pop();
             while(func) 
             {
                 l.INFO("取到了有效的函数");
                 func();
-                func = mb->pop();
+                message_done();
+                // 预算用完就让出线程，邮箱里剩下的消息在下面重新排队
+                bool spent = consume_reduction();
+                func = (m_expired || spent) ? nullptr : mb->pop();
             };
-            l.WARN("没有有效的函数了，准备结束");
+            ctx.m_active = false;
+            l.WARN_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "没有有效的函数了，准备结束");
             mb->thread_pool_leave();
             if(mb->add_to_pool())
             {
-                pool_mailbox(mb);
+                pool_mailbox(mb, act);
             }
-        });
+            // 线程池销毁任务对象比这里晚，先放掉引用，等待结束的线程stop时actor能立即析构
+            act.reset();
+            mb.reset();
+            // 先把邮箱重新排进线程池再减计数，中间不会出现短暂的“空闲”
+            schedule_done();
+        };
+    bool added = act->m_blocking ? (bool)m_blocking_pool.add_job(std::move(job)) : (bool)m_thread_pool.add_job(std::move(job));
+    if(!added)
+    {
+        // 只有线程池已经停止时才会失败，放开邮箱，start时再调度
+        SNOWER_LOGGER("actor_system").WARN_LIMIT(SNOWER_LOG_LIMIT_PER_SECOND, "线程池已经停止，邮箱没有被调度");
+        mb->thread_pool_leave();
+        schedule_done();
+    }
 }
 
 uint64_t actor_system::gen_id(void)
@@ -78,6 +321,8 @@ std::string actor_system::rand_name(uint64_t id)
 actor_address actor_system::add_actor(actor_local_id* addr, class actor* a)
 {
     using namespace std;
+    addr->m_system = this;
+    a->m_system = this;
     addr_ref lid(addr, &actor_system::deletor<actor_local_id>);
     {
         lock_guard<mutex> locker(m_lock_maps);
@@ -94,14 +339,18 @@ void actor_system::erase_actor(const actor_local_id& addr)
     using namespace std;
     uint64_t id = addr.get_id();
     string name = addr.get_full_name();
-    lock_guard<mutex> locker(m_lock_maps);
-    auto iter = m_actors.find(id);
-    if(iter != m_actors.end())
+    size_t dropped = 0;
     {
-        get<1>(iter->second)->clear();
+        lock_guard<mutex> locker(m_lock_maps);
+        auto iter = m_actors.find(id);
+        if(iter != m_actors.end())
+        {
+            dropped = get<1>(iter->second)->clear();
+        }
+        m_name_id_map.erase(name);
+        m_actors.erase(id);
     }
-    m_name_id_map.erase(name);
-    m_actors.erase(id);
+    message_done(dropped);
 }
 
 actor_system::actor_bundle actor_system::get_actor_bundle(const actor_local_id& addr)
@@ -121,6 +370,44 @@ actor_system::actor_bundle actor_system::get_actor_bundle(const actor_local_id&
     return move(ret);
 }
 
+// 补偿的是当前线程所属实例的线程池
+blocking_section::blocking_section(void)
+: m_system(actor_system::current_activation().m_system)
+{
+    if(m_system != nullptr && !m_system->enter_blocking())
+    {
+        m_system = nullptr;
+    }
+}
+
+blocking_section::~blocking_section(void)
+{
+    if(m_system != nullptr)
+    {
+        m_system->leave_blocking();
+    }
+}
+
+void shutdown(void)
+{
+    singleton<actor_system>::get_instance().shutdown(std::chrono::steady_clock::time_point::max());
+}
+
+bool shutdown(const std::chrono::steady_clock::time_point& deadline)
+{
+    return singleton<actor_system>::get_instance().shutdown(deadline);
+}
+
+void wait_for_all_actor_done(void)
+{
+    singleton<actor_system>::get_instance().wait_for_all_actor_done();
+}
+
+bool wait_for_all_actor_done(const std::chrono::steady_clock::time_point& deadline)
+{
+    return singleton<actor_system>::get_instance().wait_for_all_actor_done(deadline);
+}
+
 }
 }
 
@@ -0,0 +1,487 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <snower/binary_log.h>
+
+namespace snower
+{
+
+const char binary_log_file::MAGIC[MAGIC_SIZE + 1] = "SNWBLOG1";
+
+binary_log_file::binary_log_file(const std::string& name, const std::string& format)
+: m_fd(-1)
+, m_serial(0)
+, m_format(log_format::compile(format))
+, m_defined(new std::atomic<bool>[MAX_SITES]())
+, m_running(false)
+{
+    static std::atomic<uint64_t> next_serial(1);
+    m_serial = next_serial++;
+    m_fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    native::log_buffer header;
+    header.append(MAGIC, MAGIC_SIZE);
+    native::put_value(header, (uint32_t)getpid());
+    native::put_value(header, (uint32_t)format.size());
+    header.append(format.data(), format.size());
+    write_all(header.text().data(), header.text().size());
+    m_running = true;
+    m_thread = std::thread(&binary_log_file::writer_thread, this);
+}
+
+binary_log_file::~binary_log_file(void)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_queue_mutex);
+        m_running = false;
+    }
+    m_queue_signal.notify_all();
+    m_thread.join();
+    flush();
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+uint16_t binary_log_file::define_logger(const std::string& name)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    auto iter = m_loggers.find(name);
+    if(iter != m_loggers.end())
+    {
+        return iter->second;
+    }
+    uint16_t id = (uint16_t)m_loggers.size();
+    m_loggers.emplace(name, id);
+    native::log_buffer entry;
+    native::put_value(entry, (uint8_t)ENTRY_LOGGER);
+    native::put_value(entry, id);
+    native::put_value(entry, (uint16_t)name.size());
+    entry.append(name.data(), name.size());
+    write_all(entry.text().data(), entry.text().size());
+    return id;
+}
+
+void binary_log_file::flush(void)
+{
+    collect(true);
+    write_queued();
+}
+
+uint32_t binary_log_file::assign_site_id(std::atomic<uint32_t>& slot)
+{
+    // 编号从1开始，0表示调用点还没有编号；几个线程同时分配时用先写进去的那个
+    static std::atomic<uint32_t> next_site(1);
+    uint32_t expected = 0;
+    uint32_t id = next_site++;
+    if(!slot.compare_exchange_strong(expected, id, std::memory_order_acq_rel))
+    {
+        return expected;
+    }
+    return id;
+}
+
+void binary_log_file::define_site(uint32_t site, const log_record& r, const uint8_t* types, size_t count)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    if(m_defined[site].load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    size_t file_len = strlen(r.m_file);
+    size_t func_len = strlen(r.m_func);
+    native::log_buffer entry;
+    native::put_value(entry, (uint8_t)ENTRY_SITE);
+    native::put_value(entry, site);
+    native::put_value(entry, (int32_t)r.m_line);
+    native::put_value(entry, (uint16_t)file_len);
+    entry.append(r.m_file, file_len);
+    native::put_value(entry, (uint16_t)func_len);
+    entry.append(r.m_func, func_len);
+    native::put_value(entry, (uint8_t)count);
+    entry.append(types, count);
+    write_all(entry.text().data(), entry.text().size());
+    m_defined[site].store(true, std::memory_order_release);
+}
+
+void binary_log_file::append(const std::string& data)
+{
+    chunk& c = local_chunk();
+    if(c.m_buffer->m_size + data.size() > CHUNK_SIZE)
+    {
+        rotate(c);
+    }
+    if(data.size() > CHUNK_SIZE)
+    {
+        // 放不进一个缓冲，先写完排在前面的再直接写
+        write_queued();
+        std::lock_guard<std::mutex> writer(m_write_mutex);
+        std::lock_guard<std::mutex> file_locker(m_file_mutex);
+        write_all(data.data(), data.size());
+        return;
+    }
+    buffer& b = *c.m_buffer;
+    memcpy(b.m_data + b.m_size, data.data(), data.size());
+    b.m_size += data.size();
+    c.m_committed.store(b.m_size, std::memory_order_release);
+}
+
+binary_log_file::chunk& binary_log_file::register_chunk(void)
+{
+    std::lock_guard<std::mutex> locker(m_chunks_mutex);
+    std::unique_ptr<chunk>& c = m_chunks[std::this_thread::get_id()];
+    if(!c)
+    {
+        c.reset(new chunk());
+        c->m_buffer = new_buffer();
+    }
+    return *c;
+}
+
+binary_log_file::buffer_ref binary_log_file::new_buffer(void)
+{
+    buffer_ref ret;
+    {
+        std::lock_guard<std::mutex> locker(m_queue_mutex);
+        if(!m_free.empty())
+        {
+            ret = std::move(m_free.back());
+            m_free.pop_back();
+        }
+    }
+    if(!ret)
+    {
+        ret.reset(new buffer);
+    }
+    ret->m_start = 0;
+    ret->m_size = 0;
+    return ret;
+}
+
+void binary_log_file::rotate(chunk& c)
+{
+    buffer_ref next = new_buffer();
+    bool backlog = false;
+    {
+        std::lock_guard<std::mutex> chunk_locker(c.m_mutex);
+        c.m_buffer->m_start = c.m_taken;
+        std::lock_guard<std::mutex> locker(m_queue_mutex);
+        m_queue.push_back(std::move(c.m_buffer));
+        backlog = m_queue.size() > MAX_PENDING;
+        c.m_buffer = std::move(next);
+        c.m_taken = 0;
+        c.m_committed.store(0, std::memory_order_relaxed);
+    }
+    m_queue_signal.notify_one();
+    // 后台线程跟不上时自己写，排队的缓冲不会无限增长
+    if(backlog)
+    {
+        write_queued();
+    }
+}
+
+void binary_log_file::collect(bool wait)
+{
+    std::lock_guard<std::mutex> locker(m_chunks_mutex);
+    for(auto& iter : m_chunks)
+    {
+        chunk& c = *iter.second;
+        std::unique_lock<std::mutex> chunk_locker(c.m_mutex, std::defer_lock);
+        if(wait)
+        {
+            chunk_locker.lock();
+        }
+        else if(!chunk_locker.try_lock())
+        {
+            continue;
+        }
+        // 写的线程还在往后面写，已经发布的部分不会再变，复制出来和之后换下来的缓冲按顺序排队
+        size_t committed = c.m_committed.load(std::memory_order_acquire);
+        if(committed <= c.m_taken)
+        {
+            continue;
+        }
+        buffer_ref copy = new_buffer();
+        copy->m_size = committed - c.m_taken;
+        memcpy(copy->m_data, c.m_buffer->m_data + c.m_taken, copy->m_size);
+        c.m_taken = committed;
+        std::lock_guard<std::mutex> queue_locker(m_queue_mutex);
+        m_queue.push_back(std::move(copy));
+    }
+}
+
+void binary_log_file::write_queued(void)
+{
+    std::lock_guard<std::mutex> writer(m_write_mutex);
+    while(true)
+    {
+        buffer_ref b;
+        {
+            std::lock_guard<std::mutex> locker(m_queue_mutex);
+            if(m_queue.empty())
+            {
+                return;
+            }
+            b = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        {
+            std::lock_guard<std::mutex> file_locker(m_file_mutex);
+            write_all(b->m_data + b->m_start, b->m_size - b->m_start);
+        }
+        std::lock_guard<std::mutex> locker(m_queue_mutex);
+        if(m_free.size() < MAX_FREE)
+        {
+            m_free.push_back(std::move(b));
+        }
+    }
+}
+
+void binary_log_file::writer_thread(void)
+{
+    using namespace std::chrono;
+    steady_clock::time_point next_collect = steady_clock::now() + milliseconds(FLUSH_INTERVAL_MS);
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> locker(m_queue_mutex);
+            m_queue_signal.wait_until(locker, next_collect, [this](){ return !m_running || !m_queue.empty(); });
+            if(!m_running)
+            {
+                break;
+            }
+        }
+        // 写得少的线程缓冲总也写不满，定时把攒着的日志收上来
+        if(steady_clock::now() >= next_collect)
+        {
+            collect(false);
+            next_collect = steady_clock::now() + milliseconds(FLUSH_INTERVAL_MS);
+        }
+        write_queued();
+    }
+}
+
+void binary_log_file::write_all(const char* data, size_t size)
+{
+    while(m_fd >= 0 && size > 0)
+    {
+        ssize_t ret = ::write(m_fd, data, size);
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += ret;
+        size -= ret;
+    }
+}
+
+binary_log_reader::binary_log_reader(std::istream& is, const std::string& format)
+: m_is(is)
+, m_pid(0)
+{
+    char magic[binary_log_file::MAGIC_SIZE];
+    uint32_t pid = 0;
+    std::string source;
+    if(!m_is.read(magic, sizeof(magic)) || memcmp(magic, binary_log_file::MAGIC, sizeof(magic)) != 0
+            || !get(pid) || !get_string<uint32_t>(source))
+    {
+        return;
+    }
+    m_pid = (pid_t)pid;
+    m_format = log_format::compile(format.empty() ? source : format);
+}
+
+bool binary_log_reader::next(std::ostream& os)
+{
+    uint8_t kind;
+    while(good() && get(kind))
+    {
+        switch(kind)
+        {
+        case binary_log_file::ENTRY_LOGGER:
+            {
+                uint16_t id;
+                std::string name;
+                if(!get(id) || !get_string<uint16_t>(name))
+                {
+                    return false;
+                }
+                m_loggers[id] = std::move(name);
+            }
+            break;
+
+        case binary_log_file::ENTRY_SITE:
+            if(!read_site())
+            {
+                return false;
+            }
+            break;
+
+        case binary_log_file::ENTRY_RECORD:
+            return read_record(os);
+
+        case binary_log_file::ENTRY_TEXT:
+            {
+                std::string text;
+                if(!get_string<uint32_t>(text))
+                {
+                    return false;
+                }
+                os << text;
+            }
+            return true;
+
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+bool binary_log_reader::read_site(void)
+{
+    uint32_t id;
+    int32_t line;
+    uint8_t count;
+    site_info site;
+    if(!get(id) || !get(line) || !get_string<uint16_t>(site.m_file) || !get_string<uint16_t>(site.m_func) || !get(count))
+    {
+        return false;
+    }
+    site.m_line = line;
+    site.m_types.resize(count);
+    if(count > 0 && m_is.read(reinterpret_cast<char*>(&site.m_types[0]), count).gcount() != count)
+    {
+        return false;
+    }
+    m_sites[id] = std::move(site);
+    return true;
+}
+
+bool binary_log_reader::read_record(std::ostream& os)
+{
+    uint32_t site_id;
+    uint16_t logger_id;
+    uint8_t level;
+    uint64_t time_us;
+    uint64_t tid;
+    if(!get(site_id) || !get(logger_id) || !get(level) || !get(time_us) || !get(tid))
+    {
+        return false;
+    }
+    auto site = m_sites.find(site_id);
+    if(site == m_sites.end())
+    {
+        return false;
+    }
+    const std::vector<uint8_t>& types = site->second.m_types;
+    m_args.resize(types.size());
+    for(size_t i = 0; i < types.size(); i++)
+    {
+        if(!read_arg(types[i], m_args[i]))
+        {
+            return false;
+        }
+    }
+    log_record r;
+    r.m_file = site->second.m_file.c_str();
+    r.m_func = site->second.m_func.c_str();
+    r.m_name = m_loggers[logger_id].c_str();
+    r.m_line = site->second.m_line;
+    r.m_level = level;
+    r.m_tid = tid;
+    r.m_pid = m_pid;
+    r.m_time.tv_sec = (time_t)(time_us / 1000000);
+    r.m_time.tv_usec = (suseconds_t)(time_us % 1000000);
+    m_format->render_texts(os, r, m_args);
+    return true;
+}
+
+bool binary_log_reader::read_arg(uint8_t type, std::string& text)
+{
+    // 用与写日志时相同的方式输出，结果和直接格式化一样
+    m_text.reset();
+    switch(type)
+    {
+    case binary_log_file::ARG_BOOL:
+        {
+            uint8_t value;
+            if(!get(value))
+            {
+                return false;
+            }
+            m_text << (value != 0);
+        }
+        break;
+
+    case binary_log_file::ARG_CHAR:
+        {
+            char value;
+            if(!get(value))
+            {
+                return false;
+            }
+            m_text << value;
+        }
+        break;
+
+    case binary_log_file::ARG_INT:
+        {
+            int64_t value;
+            if(!get(value))
+            {
+                return false;
+            }
+            m_text << value;
+        }
+        break;
+
+    case binary_log_file::ARG_UINT:
+        {
+            uint64_t value;
+            if(!get(value))
+            {
+                return false;
+            }
+            m_text << value;
+        }
+        break;
+
+    case binary_log_file::ARG_DOUBLE:
+        {
+            double value;
+            if(!get(value))
+            {
+                return false;
+            }
+            m_text << value;
+        }
+        break;
+
+    case binary_log_file::ARG_POINTER:
+        {
+            uint64_t value;
+            if(!get(value))
+            {
+                return false;
+            }
+            m_text << (const void*)(uintptr_t)value;
+        }
+        break;
+
+    case binary_log_file::ARG_STRING:
+    case binary_log_file::ARG_TEXT:
+        return get_string<uint32_t>(text);
+
+    default:
+        return false;
+    }
+    text = m_text.text();
+    return true;
+}
+
+} // namespace snower
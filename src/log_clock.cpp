@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <snower/log_clock.h>
+
+namespace snower
+{
+
+static int64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t read_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return (uint64_t)clock_ns(CLOCK_MONOTONIC);
+#endif
+}
+
+// 每个节拍的纳秒数：对着CLOCK_MONOTONIC数CALIBRATE_MS毫秒的节拍，只在第一次使用TSC时测一次
+static double calibrate_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    int64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+    uint64_t start = read_ticks();
+    int64_t end_ns = start_ns;
+    while(end_ns - start_ns < log_clock::CALIBRATE_MS * 1000000)
+    {
+        end_ns = clock_ns(CLOCK_MONOTONIC);
+    }
+    uint64_t end = read_ticks();
+    return (end > start) ? (double)(end_ns - start_ns) / (end - start) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+void log_clock::now_tsc(struct timeval& tv)
+{
+    struct anchor
+    {
+        uint64_t m_ticks;
+        int64_t m_real_ns;
+        uint64_t m_resync;
+    };
+    static const double ns_per_tick = calibrate_ticks();
+    // 每个线程有自己的基准，不用同步；TSC回退(换到了TSC不同步的CPU上)时也重新校准
+    static thread_local anchor a = { 0, 0, 0 };
+    uint64_t ticks = read_ticks();
+    if(a.m_resync == 0 || ticks - a.m_ticks >= a.m_resync)
+    {
+        a.m_real_ns = clock_ns(CLOCK_REALTIME);
+        a.m_ticks = ticks = read_ticks();
+        a.m_resync = (uint64_t)(RESYNC_MS * 1000000 / ns_per_tick);
+    }
+    int64_t ns = a.m_real_ns + (int64_t)((ticks - a.m_ticks) * ns_per_tick);
+    tv.tv_sec = (time_t)(ns / 1000000000);
+    tv.tv_usec = (suseconds_t)(ns % 1000000000 / 1000);
+}
+
+size_t log_clock::format(char* buf, const struct timeval& tv, bool utc)
+{
+    struct cache
+    {
+        time_t m_sec;
+        size_t m_len;
+        char m_prefix[TIME_BUFFER_SIZE];
+    };
+    // 本地时间和UTC各缓存一份，两种格式混用时不会互相冲掉
+    static thread_local cache caches[2] = { { -1, 0, { 0 } }, { -1, 0, { 0 } } };
+    cache& c = caches[utc ? 1 : 0];
+    if(c.m_sec != tv.tv_sec)
+    {
+        // 格式化为：2007-12-25 01:45:32:
+        time_t sec = tv.tv_sec;
+        struct tm t;
+        if(utc)
+        {
+            gmtime_r(&sec, &t);
+        }
+        else
+        {
+            localtime_r(&sec, &t);
+        }
+        int len = snprintf(c.m_prefix, sizeof(c.m_prefix) - 6, "%4d-%02d-%02d %02d:%02d:%02d:"
+                , t.tm_year + 1900, t.tm_mon + 1, t.tm_mday
+                , t.tm_hour, t.tm_min, t.tm_sec);
+        c.m_len = (len > 0) ? std::min((size_t)len, sizeof(c.m_prefix) - 7) : 0;
+        c.m_sec = tv.tv_sec;
+    }
+    memcpy(buf, c.m_prefix, c.m_len);
+    long usec = (long)tv.tv_usec;
+    for(size_t i = c.m_len + 6; i > c.m_len; i--)
+    {
+        buf[i - 1] = (char)('0' + usec % 10);
+        usec /= 10;
+    }
+    return c.m_len + 6;
+}
+
+} // namespace snower
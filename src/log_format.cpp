@@ -0,0 +1,297 @@
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <snower/log_clock.h>
+#include <snower/log_format.h>
+#include <snower/logger.h>
+
+namespace snower
+{
+
+log_format::log_format(const std::string& format)
+: m_source(format)
+{
+    token text = { TOKEN_TEXT, std::string() };
+    for(size_t i = 0; i < format.size(); i++)
+    {
+        char c = format[i];
+        if(c != '%')
+        {
+            text.m_text.push_back(c);
+            continue;
+        }
+        if(++i >= format.size())
+        {
+            break;
+        }
+        token t = { TOKEN_UNKNOWN, std::string(1, format[i]) };
+        switch(format[i])
+        {
+        case 'F': t.m_kind = TOKEN_FILE; break;
+        case 'f': t.m_kind = TOKEN_FUNC; break;
+        case 'l': t.m_kind = TOKEN_LINE; break;
+        case 'N': t.m_kind = TOKEN_NAME; break;
+        case 'L': t.m_kind = TOKEN_LEVEL; break;
+        case 'p': t.m_kind = TOKEN_PID; break;
+        case 't': t.m_kind = TOKEN_TID; break;
+        case 'T': t.m_kind = TOKEN_TIME; break;
+        case 'U': t.m_kind = TOKEN_UTC_TIME; break;
+        case 'm': t.m_kind = TOKEN_NEXT_ARG; break;
+        case 'M': t.m_kind = TOKEN_ALL_ARGS; break;
+        case '%':
+            text.m_text.push_back('%');
+            continue;
+        }
+        if(!text.m_text.empty())
+        {
+            m_tokens.push_back(std::move(text));
+            text = token{ TOKEN_TEXT, std::string() };
+        }
+        m_tokens.push_back(std::move(t));
+    }
+    if(!text.m_text.empty())
+    {
+        m_tokens.push_back(std::move(text));
+    }
+}
+
+std::shared_ptr<const log_format> log_format::compile(const std::string& format)
+{
+    using namespace std;
+    static map<string, shared_ptr<const log_format>> formats;
+    static mutex lock;
+    lock_guard<mutex> locker(lock);
+    auto iter = formats.find(format);
+    if(iter == formats.end())
+    {
+        iter = formats.emplace(format, make_shared<log_format>(format)).first;
+    }
+    return iter->second;
+}
+
+void log_format::render_from(std::ostream& os, const log_record& r, size_t index) const
+{
+    for(size_t i = index; i < m_tokens.size(); i++)
+    {
+        const token& t = m_tokens[i];
+        switch(t.m_kind)
+        {
+        case TOKEN_NEXT_ARG:
+            os << "%m"; break;
+
+        case TOKEN_ALL_ARGS:
+            os << "%M"; break;
+
+        case TOKEN_UNKNOWN:
+            os << '%' << t.m_text; break;
+
+        default:
+            render_token(os, r, t);
+        }
+    }
+}
+
+void log_format::render_texts(std::ostream& os, const log_record& r, const std::vector<std::string>& args) const
+{
+    size_t next = 0;
+    size_t i = 0;
+    for(; i < m_tokens.size() && next < args.size(); i++)
+    {
+        const token& t = m_tokens[i];
+        switch(t.m_kind)
+        {
+        case TOKEN_NEXT_ARG:
+            os << args[next++]; break;
+
+        case TOKEN_ALL_ARGS:
+            for(size_t k = next; k < args.size(); k++)
+            {
+                os << args[k];
+            }
+            break;
+
+        case TOKEN_UNKNOWN:
+            break;
+
+        default:
+            render_token(os, r, t);
+        }
+    }
+    render_from(os, r, i);
+    os << '\n';
+}
+
+void log_format::render_token(std::ostream& os, const log_record& r, const token& t) const
+{
+    switch(t.m_kind)
+    {
+    case TOKEN_TEXT:
+        os << t.m_text; break;
+
+    case TOKEN_FILE:
+        os << r.m_file; break;
+
+    case TOKEN_FUNC:
+        os << r.m_func; break;
+
+    case TOKEN_LINE:
+        os << r.m_line; break;
+
+    case TOKEN_NAME:
+        os << r.m_name; break;
+
+    case TOKEN_LEVEL:
+        os << level_name(r.m_level); break;
+
+    case TOKEN_PID:
+        os << ((r.m_pid != 0) ? r.m_pid : getpid()); break;
+
+    case TOKEN_TID:
+        os << r.m_tid; break;
+
+    case TOKEN_TIME:
+    case TOKEN_UTC_TIME:
+        {
+            // 格式化为：2007-12-25 01:45:32:123456
+            char buff[log_clock::TIME_BUFFER_SIZE];
+            os.write(buff, log_clock::format(buff, r.m_time, t.m_kind == TOKEN_UTC_TIME));
+        }
+        break;
+
+    default:;
+    }
+}
+
+const char* log_format::level_name(int level)
+{
+    switch(level)
+    {
+
+    case logger::LEVEL_TRACE:
+        return "TRACE";
+
+    case logger::LEVEL_DEBUG:
+        return "DEBUG";
+
+    case logger::LEVEL_INFO:
+        return "INFO";
+
+    case logger::LEVEL_LOG:
+        return "LOG";
+
+    case logger::LEVEL_WARN:
+        return "WARN";
+
+    case logger::LEVEL_ERROR:
+        return "ERROR";
+
+    case logger::LEVEL_FATAL:
+        return "FATAL";
+    }
+    if(level < logger::LEVEL_TRACE)
+    {
+        return "TRACE-";
+    }
+    else if(level < (logger::LEVEL_DEBUG - (logger::LEVEL_DEBUG - logger::LEVEL_TRACE) / 2))
+    {
+        return "TRACE+";
+    }
+    else if(level < logger::LEVEL_DEBUG)
+    {
+        return "DEBUG-";
+    }
+    else if(level < (logger::LEVEL_INFO - (logger::LEVEL_INFO - logger::LEVEL_DEBUG) / 2))
+    {
+        return "DEBUG+";
+    }
+    else if(level < logger::LEVEL_INFO)
+    {
+        return "INFO-";
+    }
+    else if(level < (logger::LEVEL_LOG - (logger::LEVEL_LOG - logger::LEVEL_INFO) / 2))
+    {
+        return "INFO+";
+    }
+    else if(level < logger::LEVEL_LOG)
+    {
+        return "LOG-";
+    }
+    else if(level < (logger::LEVEL_WARN - (logger::LEVEL_WARN - logger::LEVEL_LOG) / 2))
+    {
+        return "LOG+";
+    }
+    else if(level < logger::LEVEL_WARN)
+    {
+        return "WARN-";
+    }
+    else if(level < (logger::LEVEL_ERROR - (logger::LEVEL_ERROR - logger::LEVEL_WARN) / 2))
+    {
+        return "WARN+";
+    }
+    else if(level < logger::LEVEL_ERROR)
+    {
+        return "ERROR-";
+    }
+    else if(level < (logger::LEVEL_FATAL - (logger::LEVEL_FATAL - logger::LEVEL_ERROR) / 2))
+    {
+        return "ERROR+";
+    }
+    else if(level < logger::LEVEL_FATAL)
+    {
+        return "FATAL-";
+    }
+    else
+    {
+        return "FATAL+";
+    }
+}
+
+namespace native
+{
+
+static std::deque<std::vector<std::unique_ptr<log_buffer>>>& buffer_sets(void)
+{
+    static thread_local std::deque<std::vector<std::unique_ptr<log_buffer>>> sets;
+    return sets;
+}
+
+static size_t& buffer_depth(void)
+{
+    static thread_local size_t depth = 0;
+    return depth;
+}
+
+static std::vector<std::unique_ptr<log_buffer>>& acquire_buffers(void)
+{
+    std::deque<std::vector<std::unique_ptr<log_buffer>>>& sets = buffer_sets();
+    size_t& depth = buffer_depth();
+    if(depth == sets.size())
+    {
+        sets.emplace_back();
+    }
+    return sets[depth++];
+}
+
+log_buffer_scope::log_buffer_scope(void)
+: m_buffers(acquire_buffers())
+{
+}
+
+log_buffer_scope::~log_buffer_scope(void)
+{
+    buffer_depth()--;
+}
+
+log_buffer& log_buffer_scope::get(size_t index)
+{
+    while(m_buffers.size() <= index)
+    {
+        m_buffers.emplace_back(new log_buffer());
+    }
+    return *m_buffers[index];
+}
+
+} // namespace native
+
+} // namespace snower
@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <snower/log_rotator.h>
+
+extern char** environ;
+
+namespace snower
+{
+
+static std::atomic<log_rotator*> s_rotator(nullptr);
+
+log_rotator::log_rotator(void)
+: m_posted(0)
+, m_done(0)
+, m_running(true)
+, m_has_ticks(false)
+{
+    m_thread = std::thread(&log_rotator::worker_thread, this);
+}
+
+log_rotator& log_rotator::get_instance(void)
+{
+    static std::once_flag once;
+    std::call_once(once, [](){
+            s_rotator = new log_rotator();
+            atexit(&log_rotator::on_exit);
+            pthread_atfork(&log_rotator::prepare_fork, &log_rotator::after_fork_parent, &log_rotator::after_fork_child);
+        });
+    return *s_rotator.load(std::memory_order_acquire);
+}
+
+void log_rotator::post(task&& job)
+{
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        if(m_running)
+        {
+            m_jobs.push_back(std::move(job));
+            m_posted++;
+            queued = true;
+        }
+    }
+    if(!queued)
+    {
+        job();
+        return;
+    }
+    m_signal.notify_one();
+}
+
+void log_rotator::wait(void)
+{
+    std::unique_lock<std::mutex> locker(m_mutex);
+    uint64_t target = m_posted;
+    m_done_signal.wait(locker, [this, target](){ return m_done >= target; });
+}
+
+void log_rotator::stop(void)
+{
+    std::lock_guard<std::mutex> locker(m_thread_mutex);
+    {
+        std::lock_guard<std::mutex> jobs_locker(m_mutex);
+        m_running = false;
+    }
+    m_signal.notify_all();
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+void log_rotator::add_tick(const void* owner, std::function<void ()>&& tick)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_ticks_mutex);
+        m_ticks[owner] = std::move(tick);
+        m_has_ticks = true;
+    }
+    // 后台线程可能正在不带超时地等任务
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+    }
+    m_signal.notify_all();
+}
+
+void log_rotator::remove_tick(const void* owner)
+{
+    std::lock_guard<std::mutex> locker(m_ticks_mutex);
+    m_ticks.erase(owner);
+    m_has_ticks = !m_ticks.empty();
+}
+
+bool log_rotator::gzip(const std::string& name)
+{
+    char* argv[] = { const_cast<char*>("gzip"), const_cast<char*>("-f"), const_cast<char*>("-q"), const_cast<char*>(name.c_str()), nullptr };
+    pid_t pid;
+    if(posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) != 0)
+    {
+        return false;
+    }
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0)
+    {
+        if(errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void log_rotator::worker_thread(void)
+{
+    using namespace std::chrono;
+    // 停止时先做完已经提交的任务才退出，改名和关闭文件不会丢
+    steady_clock::time_point next_tick = steady_clock::now() + milliseconds(TICK_MS);
+    while(true)
+    {
+        task job;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            auto ready = [this](){ return !m_running || !m_jobs.empty(); };
+            if(m_has_ticks)
+            {
+                m_signal.wait_until(locker, next_tick, ready);
+            }
+            else
+            {
+                m_signal.wait(locker, [&](){ return ready() || m_has_ticks; });
+                next_tick = steady_clock::now() + milliseconds(TICK_MS);
+            }
+            if(!m_jobs.empty())
+            {
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            else if(!m_running)
+            {
+                break;
+            }
+        }
+        if(steady_clock::now() >= next_tick)
+        {
+            run_ticks();
+            next_tick = steady_clock::now() + milliseconds(TICK_MS);
+        }
+        if(!job)
+        {
+            continue;
+        }
+        job();
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_done++;
+        }
+        m_done_signal.notify_all();
+    }
+}
+
+void log_rotator::run_ticks(void)
+{
+    std::lock_guard<std::mutex> locker(m_ticks_mutex);
+    for(auto& i : m_ticks)
+    {
+        i.second();
+    }
+}
+
+void log_rotator::on_exit(void)
+{
+    get_instance().stop();
+}
+
+void log_rotator::prepare_fork(void)
+{
+    s_rotator.load()->m_ticks_mutex.lock();
+}
+
+void log_rotator::after_fork_parent(void)
+{
+    s_rotator.load()->m_ticks_mutex.unlock();
+}
+
+void log_rotator::after_fork_child(void)
+{
+    // 子进程里没有后台线程，旧实例的任务锁也可能被它拿着；没做完的任务属于父进程，这里不管，tick留给新实例
+    log_rotator* old = s_rotator.load();
+    log_rotator* r = new log_rotator();
+    for(auto& i : old->m_ticks)
+    {
+        r->add_tick(i.first, std::function<void ()>(i.second));
+    }
+    old->m_ticks_mutex.unlock();
+    s_rotator = r;
+}
+
+} // namespace snower
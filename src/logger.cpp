@@ -1,6 +1,16 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <snower/logger.h>
 #include <snower/singleton.h>
@@ -11,85 +21,48 @@ using namespace snower;
 namespace snower
 {
 
-void log_to_stream(std::ostream& os, const log_datas& ld, const char* format)
+log_appender::log_appender(const char* format)
+: m_format(log_format::compile(format))
 {
-    for(; *format != '\0'; format++)
-    {
-        if(*format == '%')
-        {
-            format++;
-            if(*format != '\0')
-            {
-                switch(*format)
-                {
-                case 'F':
-                    ld[0](os); break;
-
-                case 'T':
-                    ld[7](os); break;
-
-                case 'f':
-                    ld[1](os); break;
-
-                case 'p':
-                    ld[5](os); break;
-
-                case 't':
-                    ld[6](os); break;
-
-                case 'l':
-                    ld[2](os); break;
-
-                case 'L':
-                    ld[4](os); break;
-
-                case 'N':
-                    ld[3](os); break;
-
-                case '%':
-                    os << '%'; break;
-
-                case 'm':
-                    os << "%m"; break;
-
-                case 'M':
-                    os << "%M"; break;
+}
 
-                default:
-                    os << '%' << *format; break;
-                }
-            }
-        }
-        else
-        {
-            os << *format;
-        }
-    }
+log_appender::log_appender(const std::string& format)
+: m_format(log_format::compile(format))
+{
 }
 
-log_appender::log_appender(const char* format)
-: m_format(format)
+log_appender::log_appender(std::string&& format)
+: m_format(log_format::compile(format))
 {
 }
 
-log_appender::log_appender(const std::string& format)
-: m_format(format)
+static std::mutex& console_mutex(void)
 {
+    static std::mutex write_mutex;
+    return write_mutex;
 }
 
-log_appender::log_appender(std::string&& format)
-: m_format(std::move(format))
+void console_appender::flush(void)
 {
+    using namespace std;
+    lock_guard<mutex> locker(console_mutex());
+    cout.flush();
 }
 
 void console_appender::do_write(const std::string& log_msg)
 {
     using namespace std;
-    static mutex write_mutex;
-    lock_guard<mutex> locker(write_mutex);
+    lock_guard<mutex> locker(console_mutex());
     cout << log_msg;
 }
 
+void stderr_appender::flush(void)
+{
+    using namespace std;
+    lock_guard<mutex> locker(m_write_mutex);
+    cerr.flush();
+}
+
 void stderr_appender::do_write(const std::string& log_msg)
 {
     using namespace std;
@@ -183,12 +156,15 @@ template<>
 file_object_base::file_object_base(const std::string& name, size_t size, std::chrono::hours&& rel_time)
 : m_file_name(get_abs_path_name(name))
 , m_truncate_size(size)
+, m_fd(-1)
 , m_file_size(0)
 {
     using namespace std;
     using namespace std::chrono;
-    get_next_open_time = [&](const system_clock::time_point& t) ->system_clock::time_point {
-        hours delta = move(rel_time);
+    init_file();
+    // 按值保存，rel_time在构造函数返回后就不存在了
+    hours delta = rel_time;
+    get_next_open_time = [delta](const system_clock::time_point& t) ->system_clock::time_point {
         time_t tm_t = system_clock::to_time_t(t);
         tm ltm = *(std::localtime(&tm_t));
         ltm.tm_min = 0;
@@ -208,12 +184,15 @@ template<>
 file_object_base::file_object_base(const std::string& name, size_t size, std::chrono::minutes&& rel_time)
 : m_file_name(get_abs_path_name(name))
 , m_truncate_size(size)
+, m_fd(-1)
 , m_file_size(0)
 {
     using namespace std;
     using namespace std::chrono;
-    get_next_open_time = [&](const system_clock::time_point& t) ->system_clock::time_point {
-        minutes delta = move(rel_time);
+    init_file();
+    // 按值保存，rel_time在构造函数返回后就不存在了
+    minutes delta = rel_time;
+    get_next_open_time = [delta](const system_clock::time_point& t) ->system_clock::time_point {
         time_t tm_t = system_clock::to_time_t(t);
         tm ltm = *(std::localtime(&tm_t));
         ltm.tm_min = 0;
@@ -232,12 +211,15 @@ template<>
 file_object_base::file_object_base(const std::string& name, size_t size, std::chrono::seconds&& rel_time)
 : m_file_name(get_abs_path_name(name))
 , m_truncate_size(size)
+, m_fd(-1)
 , m_file_size(0)
 {
     using namespace std;
     using namespace std::chrono;
-    get_next_open_time = [&](const system_clock::time_point& t) ->system_clock::time_point {
-        seconds delta = move(rel_time);
+    init_file();
+    // 按值保存，rel_time在构造函数返回后就不存在了
+    seconds delta = rel_time;
+    get_next_open_time = [delta](const system_clock::time_point& t) ->system_clock::time_point {
         time_t tm_t = system_clock::to_time_t(t);
         return system_clock::from_time_t(tm_t) + delta;
     };
@@ -245,13 +227,19 @@ file_object_base::file_object_base(const std::string& name, size_t size, std::ch
 
 file_object_base::~file_object_base(void)
 {
-    if(m_file.is_open())
+    log_rotator::get_instance().remove_tick(this);
+    close_file();
+    std::lock_guard<std::mutex> locker(m_rotation->m_mutex);
+    m_rotation->m_closed = true;
+    if(m_rotation->m_next_fd >= 0)
     {
-        m_file.close();
+        close(m_rotation->m_next_fd);
+        unlink(m_rotation->m_next_name.c_str());
+        m_rotation->m_next_fd = -1;
     }
 }
 
-void file_object_base::write(const std::string& msg)
+void file_object_base::write(const std::string& msg, int level)
 {
     using namespace std;
     using namespace std::chrono;
@@ -259,19 +247,261 @@ void file_object_base::write(const std::string& msg)
     system_clock::time_point now = system_clock::now();
     if(get_next_open_time)
     {
-        now = system_clock::now();
         time_out = (now >= m_file_open_time);
     }
     lock_guard<mutex> locker(m_file_mutex);
     check_file(msg.length(), time_out, now);
-    if(m_file.is_open())
+    if(m_fd < 0)
+    {
+        return;
+    }
+    if(m_buffered + msg.length() > m_buffer_size)
+    {
+        write_through(msg);
+        m_last_flush = now;
+    }
+    else
+    {
+        memcpy(m_buffer.get() + m_buffered, msg.data(), msg.length());
+        m_buffered += msg.length();
+        // 时钟往回调时也写一次，免得一直等下去
+        if(level >= m_flush_level || now - m_last_flush >= m_flush_interval || now < m_last_flush)
+        {
+            flush_buffer();
+            m_last_flush = now;
+        }
+    }
+    m_file_size += msg.length();
+    if(time_out)
+    {
+        m_file_open_time = get_next_open_time(now);
+    }
+}
+
+void file_object_base::flush(void)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    flush_buffer();
+    m_last_flush = std::chrono::system_clock::now();
+}
+
+void file_object_base::set_buffer_size(size_t size)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    flush_buffer();
+    m_buffer.reset(size > 0 ? new char[size] : nullptr);
+    m_buffer_size = size;
+}
+
+void file_object_base::set_flush_interval(const std::chrono::milliseconds& interval)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    m_flush_interval = interval;
+}
+
+void file_object_base::set_flush_level(int level)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    m_flush_level = level;
+}
+
+void file_object_base::open_file(const std::string& name, bool truncate)
+{
+    close_file();
+    m_fd = open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+}
+
+void file_object_base::close_file(void)
+{
+    flush_buffer();
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void file_object_base::rotate_file(const std::function<std::string ()>& name, const std::function<void (const std::string&)>& closed)
+{
+    using namespace std;
+    rotation_ref state = m_rotation;
+    string base = m_file_name;
+    if(m_fd < 0)
+    {
+        string first = name();
+        m_fd = open(first.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        {
+            lock_guard<mutex> locker(state->m_mutex);
+            state->m_current = first;
+        }
+        log_rotator::get_instance().post([state, base](){ prepare_next(state, base); });
+        return;
+    }
+    flush_buffer();
+    int old_fd = m_fd;
+    string temp;
+    {
+        lock_guard<mutex> locker(state->m_mutex);
+        if(state->m_next_fd >= 0)
+        {
+            m_fd = state->m_next_fd;
+            temp.swap(state->m_next_name);
+            state->m_next_fd = -1;
+        }
+        else
+        {
+            temp = temp_name(*state, base);
+        }
+    }
+    if(m_fd == old_fd)
     {
-        m_file << msg;
-        m_file_size += msg.length();
-        if(time_out)
+        // 切换得太频繁，后台还没准备好下一个文件，只好在这里打开；打不开就继续写旧文件
+        int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0)
         {
-            m_file_open_time = get_next_open_time(now);
+            return;
         }
+        m_fd = fd;
+    }
+    log_rotator::get_instance().post([state, base, old_fd, temp, name, closed](){
+            close(old_fd);
+            string target = name();
+            rename(temp.c_str(), target.c_str());
+            string old;
+            {
+                lock_guard<mutex> locker(state->m_mutex);
+                old.swap(state->m_current);
+                state->m_current = target;
+            }
+            if(closed && !old.empty() && old != target)
+            {
+                closed(old);
+            }
+            prepare_next(state, base);
+        });
+}
+
+std::string file_object_base::temp_name(rotation_state& state, const std::string& base)
+{
+    // 带上进程号，fork出的子进程用同一个文件对象时不会冲突
+    std::stringstream ss;
+    ss << base << ".next." << getpid() << "." << ++state.m_serial;
+    return ss.str();
+}
+
+void file_object_base::prepare_next(const rotation_ref& state, const std::string& base)
+{
+    using namespace std;
+    string name;
+    {
+        lock_guard<mutex> locker(state->m_mutex);
+        if(state->m_closed || state->m_next_fd >= 0)
+        {
+            return;
+        }
+        name = temp_name(*state, base);
+    }
+    // 打开文件时不拿着锁，写日志的线程这时切换文件也不用等
+    int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        return;
+    }
+    lock_guard<mutex> locker(state->m_mutex);
+    if(state->m_closed || state->m_next_fd >= 0)
+    {
+        close(fd);
+        unlink(name.c_str());
+        return;
+    }
+    state->m_next_fd = fd;
+    state->m_next_name = name;
+}
+
+void file_object_base::init_file(void)
+{
+    m_keep_files = 0;
+    m_rotation = std::make_shared<rotation_state>();
+    m_rotation->m_next_fd = -1;
+    m_rotation->m_serial = 0;
+    m_rotation->m_closed = false;
+    m_buffer.reset(new char[DEFAULT_BUFFER_SIZE]);
+    m_buffer_size = DEFAULT_BUFFER_SIZE;
+    m_buffered = 0;
+    m_flush_interval = std::chrono::milliseconds(DEFAULT_FLUSH_INTERVAL_MS);
+    m_flush_level = DEFAULT_FLUSH_LEVEL;
+    m_last_flush = std::chrono::system_clock::now();
+    log_rotator::get_instance().add_tick(this, [this](){ flush_due(); });
+}
+
+void file_object_base::flush_due(void)
+{
+    using namespace std::chrono;
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    system_clock::time_point now = system_clock::now();
+    if(m_buffered > 0 && (now - m_last_flush >= m_flush_interval || now < m_last_flush))
+    {
+        flush_buffer();
+        m_last_flush = now;
+    }
+}
+
+void file_object_base::flush_buffer(void)
+{
+    if(m_buffered > 0)
+    {
+        write_all(m_buffer.get(), m_buffered);
+        m_buffered = 0;
+    }
+}
+
+void file_object_base::write_through(const std::string& msg)
+{
+    // 缓冲放不下这一行：缓冲里的内容和这一行用一次writev写出去，不用先拷进缓冲
+    if(m_buffered == 0)
+    {
+        write_all(msg.data(), msg.length());
+        return;
+    }
+    struct iovec iov[2];
+    iov[0].iov_base = m_buffer.get();
+    iov[0].iov_len = m_buffered;
+    iov[1].iov_base = const_cast<char*>(msg.data());
+    iov[1].iov_len = msg.length();
+    ssize_t ret = -1;
+    do
+    {
+        ret = writev(m_fd, iov, 2);
+    } while(ret < 0 && errno == EINTR);
+    size_t done = (ret < 0) ? 0 : (size_t)ret;
+    if(ret >= 0 && done < m_buffered)
+    {
+        write_all(m_buffer.get() + done, m_buffered - done);
+        done = m_buffered;
+    }
+    if(ret >= 0)
+    {
+        done -= m_buffered;
+        write_all(msg.data() + done, msg.length() - done);
+    }
+    m_buffered = 0;
+}
+
+void file_object_base::write_all(const char* data, size_t size)
+{
+    while(m_fd >= 0 && size > 0)
+    {
+        ssize_t ret = ::write(m_fd, data, size);
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += ret;
+        size -= ret;
     }
 }
 
@@ -323,9 +553,9 @@ file_infinite::~file_infinite(void)
 
 void file_infinite::check_file(size_t add_len, bool time_out, const std::chrono::system_clock::time_point& now)
 {
-    if(!m_file.is_open())
+    if(!is_open())
     {
-        m_file.open(m_file_name, std::ios_base::out | std::ios_base::app);
+        open_file(m_file_name, false);
     }
 }
 
@@ -336,13 +566,11 @@ file_truncated::~file_truncated(void)
 void file_truncated::check_file(size_t add_len, bool time_out, const std::chrono::system_clock::time_point& now)
 {
     using namespace std;
-    if(!m_file.is_open() || ((m_file_size + add_len) > m_truncate_size) || time_out)
+    if(!is_open() || ((m_file_size + add_len) > m_truncate_size) || time_out)
     {
-        if(m_file.is_open())
-        {
-            m_file.close();
-        }
-        m_file.open(m_file_name, ios_base::out | ios_base::trunc);
+        // 新文件在后台改名覆盖掉旧文件，效果和截断一样
+        string name = m_file_name;
+        rotate_file([name](){ return name; });
         m_file_size = 0;
     }
 }
@@ -351,62 +579,469 @@ file_splitted::~file_splitted(void)
 {
 }
 
-void file_splitted::check_file(size_t add_len, bool time_out, const std::chrono::system_clock::time_point& now)
+void file_splitted::set_max_files(size_t count)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    m_keep_files = count;
+}
+
+void file_splitted::set_compressor(const std::function<void (const std::string&)>& compress)
+{
+    std::lock_guard<std::mutex> locker(m_file_mutex);
+    m_compress = compress;
+}
+
+struct split_file
+{
+    std::string m_name;
+    struct timespec m_mtime;
+
+    bool operator < (const split_file& other) const
+    {
+        if(m_mtime.tv_sec != other.m_mtime.tv_sec)
+        {
+            return m_mtime.tv_sec < other.m_mtime.tv_sec;
+        }
+        if(m_mtime.tv_nsec != other.m_mtime.tv_nsec)
+        {
+            return m_mtime.tv_nsec < other.m_mtime.tv_nsec;
+        }
+        return m_name < other.m_name;
+    }
+};
+
+// 按修改时间删掉最早的，同一秒切出的文件名字带序号，按名字排不出先后
+static void remove_old_files(const std::string& base, size_t keep)
 {
     using namespace std;
-    if(!m_file.is_open() || ((m_file_size + add_len) > m_truncate_size) || time_out)
+    glob_t found;
+    vector<split_file> files;
+    if(glob((base + ".[0-9]*").c_str(), 0, nullptr, &found) == 0)
     {
-        if(m_file.is_open())
+        for(size_t i = 0; i < found.gl_pathc; i++)
         {
-            m_file.close();
+            struct stat st;
+            if(stat(found.gl_pathv[i], &st) == 0)
+            {
+                files.push_back(split_file{ found.gl_pathv[i], st.st_mtim });
+            }
         }
-        stringstream ss;
-        ss << m_file_name << "." << get_postfix_from_time(now);
-        m_file.open(ss.str(), ios_base::out | ios_base::trunc);
+    }
+    globfree(&found);
+    if(files.size() <= keep)
+    {
+        return;
+    }
+    sort(files.begin(), files.end());
+    for(size_t i = 0; i < files.size() - keep; i++)
+    {
+        unlink(files[i].m_name.c_str());
+    }
+}
+
+void file_splitted::check_file(size_t add_len, bool time_out, const std::chrono::system_clock::time_point& now)
+{
+    using namespace std;
+    if(!is_open() || ((m_file_size + add_len) > m_truncate_size) || time_out)
+    {
+        // 格式化文件名也放到后台；同一秒里切出的文件加上序号，不会互相覆盖
+        string base = m_file_name;
+        function<string (const chrono::system_clock::time_point&)> postfix = get_postfix_from_time;
+        chrono::system_clock::time_point when = now;
+        size_t keep = m_keep_files;
+        function<void (const string&)> compress = m_compress;
+        rotate_file([base, postfix, when]() -> string {
+                string name = base + "." + postfix(when);
+                string ret = name;
+                for(int i = 1; access(ret.c_str(), F_OK) == 0; i++)
+                {
+                    ret = name + "." + to_string(i);
+                }
+                return ret;
+            },
+            [base, keep, compress](const string& old){
+                if(compress)
+                {
+                    compress(old);
+                }
+                if(keep > 0)
+                {
+                    remove_old_files(base, keep);
+                }
+            });
         m_file_size = 0;
     }
 }
 
+async_log_writer::async_log_writer(void)
+: m_capacity(DEFAULT_CAPACITY)
+, m_overflow(OVERFLOW_BLOCK)
+, m_dropped(0)
+, m_consuming(false)
+, m_running(true)
+, m_flush_requests(0)
+, m_flush_done(0)
+{
+    m_thread = std::thread(&async_log_writer::writer_thread, this);
+}
+
+static std::atomic<async_log_writer*> s_async_writer(nullptr);
+
+async_log_writer& async_log_writer::get_instance(void)
+{
+    static std::once_flag once;
+    std::call_once(once, [](){
+            s_async_writer = new async_log_writer();
+            atexit(&async_log_writer::on_exit);
+            pthread_atfork(&async_log_writer::prepare_fork, &async_log_writer::after_fork_parent, &async_log_writer::after_fork_child);
+        });
+    return *s_async_writer.load(std::memory_order_acquire);
+}
+
+void async_log_writer::stop(void)
+{
+    std::lock_guard<std::mutex> locker(m_thread_mutex);
+    m_running = false;
+    m_wakeup.notify_all();
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    // 后台线程退出前已经写完了所有缓冲，这里再收一下停止前后刚提交的
+    in_writer() = true;
+    while(drain(SIZE_MAX) > 0)
+    {
+    }
+    run_flush_hooks();
+    in_writer() = false;
+}
+
+bool async_log_writer::post(record_task&& record)
+{
+    using namespace std;
+    // appender自己写日志时已经在后台线程上了，直接执行，避免等自己腾出空间；停止以后也直接执行
+    if(in_writer() || !m_running)
+    {
+        record();
+        return true;
+    }
+    ring_type& ring = local_ring();
+    if(!ring.try_push(move(record)))
+    {
+        if(m_overflow == OVERFLOW_DROP)
+        {
+            m_dropped.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        while(!ring.try_push(move(record)))
+        {
+            m_wakeup.notify_one();
+            this_thread::yield();
+        }
+    }
+    m_wakeup.notify_one();
+    return true;
+}
+
+void async_log_writer::flush(void)
+{
+    using namespace std;
+    using namespace std::chrono;
+    if(in_writer())
+    {
+        return;
+    }
+    if(!m_running)
+    {
+        run_flush_hooks();
+        return;
+    }
+    vector<pair<ring_ref, uint64_t>> targets;
+    {
+        lock_guard<mutex> locker(m_rings_mutex);
+        for(ring_ref& r : m_rings)
+        {
+            targets.emplace_back(r, r->pushed());
+        }
+    }
+    m_wakeup.notify_all();
+    unique_lock<mutex> locker(m_flush_mutex);
+    for(auto& t : targets)
+    {
+        while(t.first->popped() < t.second)
+        {
+            m_flush_signal.wait_for(locker, milliseconds(1));
+        }
+    }
+    // 日志都执行过了，再让后台线程刷新一次appender
+    uint64_t request = ++m_flush_requests;
+    while(m_flush_done < request && m_running)
+    {
+        m_wakeup.notify_all();
+        m_flush_signal.wait_for(locker, milliseconds(1));
+    }
+}
+
+void async_log_writer::set_overflow_policy(overflow_policy policy)
+{
+    m_overflow = policy;
+}
+
+void async_log_writer::set_ring_capacity(size_t capacity)
+{
+    m_capacity = capacity;
+}
+
+uint64_t async_log_writer::dropped(void) const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+void async_log_writer::add_flush_hook(const void* owner, std::function<void ()>&& hook)
+{
+    std::lock_guard<std::mutex> locker(m_hooks_mutex);
+    m_hooks[owner] = std::move(hook);
+}
+
+void async_log_writer::remove_flush_hook(const void* owner)
+{
+    std::lock_guard<std::mutex> locker(m_hooks_mutex);
+    m_hooks.erase(owner);
+}
+
+void async_log_writer::install_crash_handler(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &async_log_writer::on_fatal_signal;
+    sigemptyset(&sa.sa_mask);
+    // 处理函数只执行一次，之后恢复默认处理，重新发出的信号会让进程按原样结束
+    sa.sa_flags = SA_RESETHAND;
+    for(int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT })
+    {
+        sigaction(sig, &sa, nullptr);
+    }
+}
+
+async_log_writer::ring_type& async_log_writer::local_ring(void)
+{
+    // 线程退出后缓冲只剩后台线程持有，写完以后由后台线程移除；fork之后换了实例，要重新登记
+    static thread_local const async_log_writer* owner = nullptr;
+    static thread_local ring_ref ring;
+    if(owner != this)
+    {
+        ring = std::make_shared<ring_type>(m_capacity);
+        std::lock_guard<std::mutex> locker(m_rings_mutex);
+        m_rings.push_back(ring);
+        owner = this;
+    }
+    return *ring;
+}
+
+void async_log_writer::writer_thread(void)
+{
+    using namespace std;
+    using namespace std::chrono;
+    in_writer() = true;
+    bool dirty = false;
+    while(true)
+    {
+        size_t done = drain(BATCH);
+        if(done > 0)
+        {
+            dirty = true;
+            lock_guard<mutex> locker(m_flush_mutex);
+            m_flush_signal.notify_all();
+            continue;
+        }
+        // 缓冲都空了：把这一批一起刷到appender，顺便应答flush
+        uint64_t request = m_flush_requests;
+        if(dirty || request != m_flush_done)
+        {
+            run_flush_hooks();
+            dirty = false;
+            m_flush_done = request;
+            lock_guard<mutex> locker(m_flush_mutex);
+            m_flush_signal.notify_all();
+        }
+        if(!m_running)
+        {
+            break;
+        }
+        event_count::key_type key = m_wakeup.prepare_wait();
+        if(!m_running || m_flush_requests != m_flush_done || drain(BATCH) > 0)
+        {
+            m_wakeup.cancel_wait();
+            dirty = true;
+            continue;
+        }
+        m_wakeup.wait_for(key, milliseconds(100));
+    }
+}
+
+size_t async_log_writer::drain(size_t max, bool force)
+{
+    using namespace std;
+    bool expected = false;
+    if(!m_consuming.compare_exchange_strong(expected, true) && !force)
+    {
+        return 0;
+    }
+    size_t ret = 0;
+    {
+        lock_guard<mutex> locker(m_rings_mutex);
+        for(size_t i = 0; i < m_rings.size();)
+        {
+            ret += m_rings[i]->consume([](record_task& record){ record(); }, max);
+            if(m_rings[i].use_count() == 1 && m_rings[i]->empty())
+            {
+                m_rings[i].swap(m_rings.back());
+                m_rings.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+    m_consuming = false;
+    return ret;
+}
+
+void async_log_writer::run_flush_hooks(void)
+{
+    std::lock_guard<std::mutex> locker(m_hooks_mutex);
+    for(auto& h : m_hooks)
+    {
+        h.second();
+    }
+}
+
+void async_log_writer::on_exit(void)
+{
+    get_instance().stop();
+}
+
+// fork时拿着这两个锁，子进程复制到的钩子和缓冲列表是完整的
+void async_log_writer::prepare_fork(void)
+{
+    async_log_writer& w = *s_async_writer.load();
+    w.m_hooks_mutex.lock();
+    w.m_rings_mutex.lock();
+}
+
+void async_log_writer::after_fork_parent(void)
+{
+    async_log_writer& w = *s_async_writer.load();
+    w.m_rings_mutex.unlock();
+    w.m_hooks_mutex.unlock();
+}
+
+void async_log_writer::after_fork_child(void)
+{
+    // 子进程里只有调用fork的线程，旧实例的后台线程不存在，它的其他锁也可能永远拿不到了；
+    // 换一个新实例，保留钩子和设置，旧缓冲里是父进程还没写的日志，由父进程负责，这里丢掉
+    async_log_writer* old = s_async_writer.load();
+    async_log_writer* w = new async_log_writer();
+    w->m_hooks = old->m_hooks;
+    w->m_capacity = old->m_capacity.load();
+    w->m_overflow = old->m_overflow.load();
+    old->m_rings_mutex.unlock();
+    old->m_hooks_mutex.unlock();
+    s_async_writer = w;
+}
+
+bool& async_log_writer::in_writer(void)
+{
+    static thread_local bool ret = false;
+    return ret;
+}
+
+void async_log_writer::on_fatal_signal(int sig)
+{
+    using namespace std::chrono;
+    // 这里调用的函数都不是异步信号安全的，只是尽力而为：进程本来就要结束了，多写出一些日志总比全部丢掉好
+    async_log_writer& w = get_instance();
+    // 后台线程自己崩溃时它手里还拿着锁，不能再去消费缓冲
+    if(in_writer())
+    {
+        raise(sig);
+        return;
+    }
+    in_writer() = true;
+    size_t done = 0;
+    steady_clock::time_point deadline = steady_clock::now() + seconds(1);
+    while(w.m_consuming && steady_clock::now() < deadline)
+    {
+        usleep(1000);
+    }
+    // 等了一秒后台线程还没让出缓冲，大概已经卡住了，只好强行去写
+    do
+    {
+        done = w.drain(SIZE_MAX, true);
+    } while(done > 0);
+    w.run_flush_hooks();
+    raise(sig);
+}
+
 logger::logger(const std::string& name, int level)
 : m_logger_name(name)
 , m_enable(true)
-, m_level(level)
+, m_async(false)
 , m_top_level(LEVEL_NONE)
+, m_level(level)
+, m_clock(log_clock::CLOCK_SOURCE_REALTIME)
+, m_binary_logger(0)
 {
-    m_get_time_func = std::bind(&logger::get_time_string, this);
+    update_floor();
 }
 
 logger::logger(std::string&& name, int level)
 : m_logger_name(std::move(name))
 , m_enable(true)
-, m_level(level)
+, m_async(false)
 , m_top_level(LEVEL_NONE)
+, m_level(level)
+, m_clock(log_clock::CLOCK_SOURCE_REALTIME)
+, m_binary_logger(0)
 {
-    m_get_time_func = std::bind(&logger::get_time_string, this);
+    update_floor();
 }
 
 logger::logger(const logger& l)
 : m_logger_name(l.m_logger_name)
 , m_enable(l.m_enable)
-, m_level(l.m_level)
+, m_async(false)
 , m_top_level(LEVEL_NONE)
+, m_level(l.m_level)
+, m_clock(l.m_clock)
+, m_binary(l.m_binary)
+, m_binary_logger(l.m_binary_logger)
 , m_appenders(l.m_appenders)
 {
-    m_get_time_func = std::bind(&logger::get_time_string, this);
+    update_floor();
+    set_async(l.m_async);
 }
 
 logger::logger(logger&& l)
 : m_logger_name(std::move(l.m_logger_name))
 , m_enable(l.m_enable)
-, m_level(l.m_level)
+, m_async(false)
 , m_top_level(LEVEL_NONE)
+, m_level(l.m_level)
+, m_clock(l.m_clock)
+, m_binary(std::move(l.m_binary))
+, m_binary_logger(l.m_binary_logger)
 , m_appenders(std::move(l.m_appenders))
 {
-    m_get_time_func = std::bind(&logger::get_time_string, this);
+    update_floor();
+    set_async(l.m_async);
 }
 
 logger::~logger(void)
 {
+    set_async(false);
+    log_limiter::forget(this);
 }
 
 logger& logger::add_appender(log_appender* appender)
@@ -416,24 +1051,93 @@ logger& logger::add_appender(log_appender* appender)
 
 logger& logger::add_appender(const log_appender_ref& appender)
 {
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
     m_appenders.push_back(appender);
+    update_floor();
     return *this;
 }
 
 logger& logger::add_appender(log_appender_ref&& appender)
 {
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
     m_appenders.push_back(std::move(appender));
+    update_floor();
     return *this;
 }
 
 void logger::clear_appender(void)
 {
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
     m_appenders.clear();
+    update_floor();
 }
 
 void logger::enable(bool on)
 {
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
     m_enable = on;
+    update_floor();
+}
+
+void logger::set_async(bool on)
+{
+    if(on == m_async)
+    {
+        return;
+    }
+    async_log_writer& w = async_log_writer::get_instance();
+    if(on)
+    {
+        w.add_flush_hook(this, [this](){ flush_appenders(); });
+        m_async = true;
+    }
+    else
+    {
+        // 先把已经提交的日志写完，之后的日志在调用者线程上同步写
+        m_async = false;
+        w.flush();
+        w.remove_flush_hook(this);
+    }
+}
+
+void logger::set_clock(log_clock::source src)
+{
+    m_clock = src;
+}
+
+void logger::set_binary(const binary_log_ref& file)
+{
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
+    m_binary_logger = file ? file->define_logger(m_logger_name) : 0;
+    m_binary = file;
+    update_floor();
+}
+
+void logger::flush(void)
+{
+    // 先写出限流的调用点还没汇总的丢弃条数
+    log_limiter::report_pending(this);
+    if(m_binary)
+    {
+        m_binary->flush();
+    }
+    if(m_async)
+    {
+        async_log_writer::get_instance().flush();
+    }
+    else
+    {
+        flush_appenders();
+    }
+}
+
+void logger::flush_appenders(void)
+{
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
+    for(log_appender_ref& a : m_appenders)
+    {
+        a->flush();
+    }
 }
 
 void logger::set_top_level(int level)
@@ -446,7 +1150,7 @@ void logger::set_top_level(int level)
     {
         level = LEVEL_ALL;
     }
-    m_top_level = level;
+    m_top_level.store(level, std::memory_order_relaxed);
 }
 
 void logger::set_level(int level)
@@ -459,108 +1163,286 @@ void logger::set_level(int level)
     {
         level = LEVEL_ALL;
     }
+    std::lock_guard<std::mutex> locker(m_appenders_mutex);
     m_level = level;
+    update_floor();
 }
 
-std::string logger::get_time_string(void)
+void logger::update_floor(void)
 {
-    using namespace std;
-    string ret;
-    char buff[64] = {0};
-    struct timeval tmval;
-    gettimeofday(&tmval, NULL);
-    time_t now = tmval.tv_sec;
-    struct tm newTimeObj;
-    struct tm* newTime = localtime_r(&now, &newTimeObj);
-    // 格式化为：2007-12-25 01:45:32:123456
-    snprintf(buff, 63, "%4d-%02d-%02d %02d:%02d:%02d:%06ld"
-            , newTime->tm_year + 1900, newTime->tm_mon + 1
-            , newTime->tm_mday, newTime->tm_hour
-            , newTime->tm_min, newTime->tm_sec, (long int)tmval.tv_usec);
-    return move(string(buff));
+    m_floor.store((m_enable && (!m_appenders.empty() || m_binary)) ? m_level : (LEVEL_NONE + 1), std::memory_order_relaxed);
 }
 
-std::string logger::level_to_name(int level)
+log_registry::log_registry(void)
 {
-    switch(level)
+    for(std::atomic<entry*>& b : m_buckets)
     {
+        b.store(nullptr, std::memory_order_relaxed);
+    }
+}
 
-    case LEVEL_TRACE:
-        return "TRACE";
-
-    case LEVEL_DEBUG:
-        return "DEBUG";
+log_registry::~log_registry(void)
+{
+    for(std::atomic<entry*>& b : m_buckets)
+    {
+        entry* e = b.load(std::memory_order_relaxed);
+        while(e != nullptr)
+        {
+            entry* next = e->m_next;
+            delete e;
+            e = next;
+        }
+    }
+}
 
-    case LEVEL_INFO:
-        return "INFO";
+log_registry& log_registry::get_instance(void)
+{
+    static log_registry instance;
+    return instance;
+}
 
-    case LEVEL_LOG:
-        return "LOG";
+logger& log_registry::get(const std::string& name)
+{
+    size_t bucket = std::hash<std::string>()(name) % BUCKETS;
+    entry* e = lookup(name, bucket);
+    if(e != nullptr)
+    {
+        return e->m_logger;
+    }
+    std::lock_guard<std::mutex> locker(m_mutex);
+    e = lookup(name, bucket);
+    if(e == nullptr)
+    {
+        // 建好以后再挂到链表头上，读的一方要么看不到，要么看到完整的logger
+        e = new entry(name);
+        e->m_next = m_buckets[bucket].load(std::memory_order_relaxed);
+        m_buckets[bucket].store(e, std::memory_order_release);
+    }
+    return e->m_logger;
+}
 
-    case LEVEL_WARN:
-        return "WARN";
+logger* log_registry::find(const std::string& name) const
+{
+    entry* e = lookup(name, std::hash<std::string>()(name) % BUCKETS);
+    return (e != nullptr) ? &e->m_logger : nullptr;
+}
 
-    case LEVEL_ERROR:
-        return "ERROR";
+void log_registry::set_level(const std::string& name, int level)
+{
+    get(name).set_level(level);
+}
 
-    case LEVEL_FATAL:
-        return "FATAL";
+void log_registry::set_level(int level)
+{
+    for(const std::atomic<entry*>& b : m_buckets)
+    {
+        for(entry* e = b.load(std::memory_order_acquire); e != nullptr; e = e->m_next)
+        {
+            e->m_logger.set_level(level);
+        }
     }
-    if(level < LEVEL_TRACE)
+}
+
+void log_registry::flush(void)
+{
+    for(const std::atomic<entry*>& b : m_buckets)
     {
-        return "TRACE-";
+        for(entry* e = b.load(std::memory_order_acquire); e != nullptr; e = e->m_next)
+        {
+            e->m_logger.flush();
+        }
     }
-    else if(level < (LEVEL_DEBUG - (LEVEL_DEBUG - LEVEL_TRACE) / 2))
+}
+
+log_registry::entry* log_registry::lookup(const std::string& name, size_t bucket) const
+{
+    for(entry* e = m_buckets[bucket].load(std::memory_order_acquire); e != nullptr; e = e->m_next)
     {
-        return "TRACE+";
+        if(e->m_name == name)
+        {
+            return e;
+        }
     }
-    else if(level < LEVEL_DEBUG)
+    return nullptr;
+}
+
+// 所有限流器的表，log_rotator的tick定期检查其中有没汇总的丢弃的；
+// 和async_log_writer一样故意不析构，进程退出时限流器和logger析构的先后不定，都还要用到它
+struct limiter_registry
+{
+    limiter_registry(void)
+    : m_ticking(false)
     {
-        return "DEBUG-";
     }
-    else if(level < (LEVEL_INFO - (LEVEL_INFO - LEVEL_DEBUG) / 2))
+
+    std::recursive_mutex m_mutex;
+    std::set<log_limiter*> m_limiters;
+    bool m_ticking;
+};
+
+static limiter_registry& limiters(void)
+{
+    static limiter_registry* ret = new limiter_registry();
+    return *ret;
+}
+
+log_limiter::log_limiter(uint32_t per_second, uint32_t one_in, uint32_t burst)
+: m_interval(per_second > 0 ? 1000000000LL / per_second : 0)
+, m_tolerance(m_interval * ((burst > 0 ? burst : per_second) - 1))
+, m_one_in(one_in)
+, m_tat(0)
+, m_count(0)
+, m_pending(0)
+, m_total(0)
+, m_last_report(0)
+, m_slot(0)
+, m_site_logger(nullptr)
+, m_site_level(0)
+, m_site_file(nullptr)
+, m_site_func(nullptr)
+, m_site_line(0)
+{
+    limiter_registry& r = limiters();
+    bool first = false;
     {
-        return "DEBUG+";
+        std::lock_guard<std::recursive_mutex> locker(r.m_mutex);
+        first = !r.m_ticking;
+        r.m_ticking = true;
+        r.m_limiters.insert(this);
     }
-    else if(level < LEVEL_INFO)
+    // 不能拿着表的锁加tick：后台线程是先拿tick的锁再来拿表的锁
+    if(first)
     {
-        return "INFO-";
+        log_rotator::get_instance().add_tick(&r, [](){ log_limiter::report_pending(); });
     }
-    else if(level < (LEVEL_LOG - (LEVEL_LOG - LEVEL_INFO) / 2))
+}
+
+log_limiter::~log_limiter(void)
+{
+    limiter_registry& r = limiters();
+    std::lock_guard<std::recursive_mutex> locker(r.m_mutex);
+    r.m_limiters.erase(this);
+}
+
+void log_limiter::forget(const logger* l)
+{
+    limiter_registry& r = limiters();
+    std::lock_guard<std::recursive_mutex> locker(r.m_mutex);
+    for(log_limiter* limiter : r.m_limiters)
     {
-        return "INFO+";
+        std::lock_guard<std::mutex> site_locker(limiter->m_site_mutex);
+        if(limiter->m_site_logger == l)
+        {
+            limiter->m_site_logger = nullptr;
+        }
     }
-    else if(level < LEVEL_LOG)
+}
+
+void log_limiter::report_pending(const logger* only)
+{
+    using namespace std::chrono;
+    int64_t now = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    limiter_registry& r = limiters();
+    // 写汇总时可能又用到限流的调用点，所以是递归锁；std::set插入时不会让正在用的迭代器失效
+    std::lock_guard<std::recursive_mutex> locker(r.m_mutex);
+    for(log_limiter* l : r.m_limiters)
     {
-        return "LOG-";
+        if(l->m_pending.load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+        logger* target = nullptr;
+        int level = 0;
+        const char* file = nullptr;
+        const char* func = nullptr;
+        int line = 0;
+        {
+            std::lock_guard<std::mutex> site_locker(l->m_site_mutex);
+            target = l->m_site_logger;
+            level = l->m_site_level;
+            file = l->m_site_file;
+            func = l->m_site_func;
+            line = l->m_site_line;
+        }
+        if(target == nullptr || (only != nullptr && target != only))
+        {
+            continue;
+        }
+        l->report(log_site(*target, level, file, func, line), now, only != nullptr);
     }
-    else if(level < (LEVEL_WARN - (LEVEL_WARN - LEVEL_LOG) / 2))
+}
+
+bool log_limiter::pass(const log_site& site)
+{
+    using namespace std::chrono;
+    int64_t now = 0;
+    bool ok = (m_one_in < 2) || (m_count.fetch_add(1, std::memory_order_relaxed) % m_one_in == 0);
+    if(ok && m_interval > 0)
     {
-        return "LOG+";
+        now = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+        ok = take(now);
     }
-    else if(level < LEVEL_WARN)
+    if(!ok)
     {
-        return "WARN-";
+        if(m_pending.fetch_add(1, std::memory_order_relaxed) == 0)
+        {
+            std::lock_guard<std::mutex> locker(m_site_mutex);
+            m_site_logger = &site.m_logger;
+            m_site_level = site.m_level;
+            m_site_file = site.m_file;
+            m_site_func = site.m_func;
+            m_site_line = site.m_line;
+        }
+        m_total.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
-    else if(level < (LEVEL_ERROR - (LEVEL_ERROR - LEVEL_WARN) / 2))
+    if(m_pending.load(std::memory_order_relaxed) > 0)
     {
-        return "WARN+";
+        if(now == 0)
+        {
+            now = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+        }
+        report(site, now);
     }
-    else if(level < LEVEL_ERROR)
+    return true;
+}
+
+bool log_limiter::take(int64_t now)
+{
+    // 理论到达时间超前现在不到容忍量就放行，并往后推一个间隔；空闲时不会攒下超过burst的额度
+    int64_t tat = m_tat.load(std::memory_order_relaxed);
+    while(true)
     {
-        return "ERROR-";
+        int64_t start = std::max(tat, now);
+        if(start - now > m_tolerance)
+        {
+            return false;
+        }
+        if(m_tat.compare_exchange_weak(tat, start + m_interval, std::memory_order_relaxed))
+        {
+            return true;
+        }
     }
-    else if(level < (LEVEL_FATAL - (LEVEL_FATAL - LEVEL_ERROR) / 2))
+}
+
+void log_limiter::report(const log_site& site, int64_t now, bool force)
+{
+    // 同一时刻只有抢到的那个线程写汇总
+    int64_t last = m_last_report.load(std::memory_order_relaxed);
+    if((!force && now - last < (int64_t)REPORT_INTERVAL_MS * 1000000) || !m_last_report.compare_exchange_strong(last, now, std::memory_order_relaxed))
     {
-        return "ERROR+";
+        return;
     }
-    else if(level < LEVEL_FATAL)
+    // 汇总行也算在每秒的行数里，logger::flush要求的汇总除外
+    if(!force && m_interval > 0 && !take(now))
     {
-        return "FATAL-";
+        m_last_report.store(last, std::memory_order_relaxed);
+        return;
     }
-    else
+    uint64_t count = m_pending.exchange(0, std::memory_order_relaxed);
+    if(count > 0)
     {
-        return "FATAL+";
+        site.at(m_slot)("[限流] 这里有", count, "条日志被丢掉");
     }
 }
 
@@ -0,0 +1,380 @@
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <snower/log_rotator.h>
+#include <snower/mmap_log.h>
+
+namespace snower
+{
+
+const char mmap_log_file::MAGIC[MAGIC_SIZE + 1] = "SNWMLOG1";
+
+// 段里的u32标记字：写日志的线程和读的进程通过映射的内存直接交换，用原子操作读写
+static inline uint32_t load_word(const char* p)
+{
+    return __atomic_load_n(reinterpret_cast<const uint32_t*>(p), __ATOMIC_ACQUIRE);
+}
+
+static inline void store_word(char* p, uint32_t value)
+{
+    __atomic_store_n(reinterpret_cast<uint32_t*>(p), value, __ATOMIC_RELEASE);
+}
+
+static inline size_t record_size(size_t len)
+{
+    return (mmap_log_file::RECORD_HEADER + len + mmap_log_file::RECORD_ALIGN - 1) & ~(size_t)(mmap_log_file::RECORD_ALIGN - 1);
+}
+
+mmap_log_file::mmap_log_file(const std::string& name, size_t segment_size)
+: m_name(name)
+, m_segment_size(std::min(std::max(segment_size, (size_t)MIN_SEGMENT_SIZE), (size_t)MAX_SEGMENT_SIZE) & ~(size_t)(RECORD_ALIGN - 1))
+, m_limit(m_segment_size - RECORD_HEADER)
+, m_max_record(((m_limit - HEADER_SIZE) & ~(size_t)(RECORD_ALIGN - 1)) - RECORD_HEADER)
+, m_current(0)
+{
+    for(segment& s : m_segments)
+    {
+        s.m_seq = 0;
+        s.m_tail = m_segment_size;
+        s.m_base = nullptr;
+        s.m_fd = -1;
+    }
+    std::vector<uint64_t> exists = list_segments(m_name);
+    uint64_t first = exists.empty() ? 1 : exists.back() + 1;
+    {
+        std::lock_guard<std::mutex> locker(m_segments_mutex);
+        prepare(first);
+    }
+    m_current.store(first, std::memory_order_release);
+    log_rotator::get_instance().post([this, first](){
+            std::lock_guard<std::mutex> locker(m_segments_mutex);
+            prepare(first + 1);
+        });
+}
+
+mmap_log_file::~mmap_log_file(void)
+{
+    // 后台任务拿着this
+    log_rotator::get_instance().wait();
+    std::lock_guard<std::mutex> locker(m_segments_mutex);
+    uint64_t seq = m_current.load(std::memory_order_acquire);
+    segment& s = slot(seq);
+    size_t offset = s.m_tail.exchange(m_segment_size, std::memory_order_acq_rel);
+    char* base = s.m_base.load(std::memory_order_acquire);
+    if(base != nullptr && offset <= m_limit)
+    {
+        store_word(base + offset, RECORD_END);
+    }
+    for(segment& other : m_segments)
+    {
+        uint64_t owner = other.m_seq.load(std::memory_order_relaxed);
+        if(owner == 0)
+        {
+            continue;
+        }
+        retire(other);
+        // 预先建好还没用上的段
+        if(owner > seq)
+        {
+            unlink(segment_name(m_name, owner).c_str());
+        }
+    }
+}
+
+void mmap_log_file::write(const std::string& msg, int)
+{
+    size_t len = std::min(msg.size(), m_max_record);
+    size_t need = record_size(len);
+    while(true)
+    {
+        segment& s = slot(m_current.load(std::memory_order_acquire));
+        size_t offset = s.m_tail.fetch_add(need, std::memory_order_acq_rel);
+        // 拿到旧序号的线程可能落在已经换成新段的位置上，以这里看到的为准
+        uint64_t owner = s.m_seq.load(std::memory_order_acquire);
+        char* base = s.m_base.load(std::memory_order_acquire);
+        if(offset + need <= m_limit)
+        {
+            if(base != nullptr)
+            {
+                char* p = base + offset;
+                __atomic_store_n(reinterpret_cast<uint32_t*>(p), (uint32_t)len, __ATOMIC_RELAXED);
+                memcpy(p + RECORD_HEADER, msg.data(), len);
+                store_word(p, (uint32_t)len | RECORD_COMMITTED);
+            }
+            return;
+        }
+        if(offset <= m_limit)
+        {
+            // 第一个放不下的线程封上这个段并换到下一个段，其他放不下的等它换完
+            if(base != nullptr)
+            {
+                store_word(base + offset, RECORD_NEXT);
+            }
+            rollover(owner);
+            continue;
+        }
+        while(owner != 0 && m_current.load(std::memory_order_acquire) == owner)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void mmap_log_file::flush(void)
+{
+    char* base = slot(m_current.load(std::memory_order_acquire)).m_base.load(std::memory_order_acquire);
+    if(base != nullptr)
+    {
+        msync(base, m_segment_size, MS_ASYNC);
+    }
+}
+
+std::string mmap_log_file::segment_name(const std::string& name, uint64_t seq)
+{
+    char postfix[32];
+    snprintf(postfix, sizeof(postfix), ".%06llu", (unsigned long long)seq);
+    return name + postfix;
+}
+
+std::vector<uint64_t> mmap_log_file::list_segments(const std::string& name)
+{
+    std::vector<uint64_t> ret;
+    glob_t files;
+    if(glob((name + ".[0-9]*").c_str(), 0, nullptr, &files) == 0)
+    {
+        for(size_t i = 0; i < files.gl_pathc; i++)
+        {
+            const char* postfix = files.gl_pathv[i] + name.size() + 1;
+            char* end = nullptr;
+            unsigned long long seq = strtoull(postfix, &end, 10);
+            if(seq != 0 && *end == '\0')
+            {
+                ret.push_back(seq);
+            }
+        }
+    }
+    globfree(&files);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+void mmap_log_file::rollover(uint64_t seq)
+{
+    if(slot(seq + 1).m_seq.load(std::memory_order_acquire) != seq + 1)
+    {
+        // 后台还没建好下一个段，只能自己建
+        std::lock_guard<std::mutex> locker(m_segments_mutex);
+        prepare(seq + 1);
+    }
+    m_current.store(seq + 1, std::memory_order_release);
+    log_rotator::get_instance().post([this, seq](){
+            std::lock_guard<std::mutex> locker(m_segments_mutex);
+            prepare(seq + 2);
+            segment& s = slot(seq);
+            if(s.m_seq.load(std::memory_order_relaxed) == seq)
+            {
+                retire(s);
+            }
+        });
+}
+
+void mmap_log_file::prepare(uint64_t seq)
+{
+    // 后台落后时任务里的序号可能已经用过了，不能再建一遍把写好的段截掉
+    segment& s = slot(seq);
+    if(s.m_seq.load(std::memory_order_relaxed) >= seq || seq <= m_current.load(std::memory_order_acquire))
+    {
+        return;
+    }
+    if(s.m_seq.load(std::memory_order_relaxed) != 0)
+    {
+        retire(s);
+    }
+    // 空间一次分配好，写满磁盘时不会在写日志的线程上收到SIGBUS；MAP_POPULATE预先建好页表
+    char* base = nullptr;
+    int fd = open(segment_name(m_name, seq).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd >= 0)
+    {
+        if(posix_fallocate(fd, 0, m_segment_size) != 0 && ftruncate(fd, m_segment_size) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(fd >= 0)
+    {
+        void* p = mmap(nullptr, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if(p != MAP_FAILED)
+        {
+            base = static_cast<char*>(p);
+            uint64_t size = m_segment_size;
+            uint32_t pid = (uint32_t)getpid();
+            memcpy(base + MAGIC_SIZE, &seq, sizeof(seq));
+            memcpy(base + MAGIC_SIZE + 8, &size, sizeof(size));
+            memcpy(base + MAGIC_SIZE + 16, &pid, sizeof(pid));
+            memcpy(base, MAGIC, MAGIC_SIZE);
+        }
+    }
+    // 映射失败时段照样轮换，只是写进去的日志被丢掉
+    s.m_fd = fd;
+    s.m_base.store(base, std::memory_order_relaxed);
+    s.m_seq.store(seq, std::memory_order_release);
+    s.m_tail.store(HEADER_SIZE, std::memory_order_release);
+}
+
+void mmap_log_file::retire(segment& s)
+{
+    char* base = s.m_base.load(std::memory_order_acquire);
+    if(base != nullptr)
+    {
+        wait_committed(base, std::min(s.m_tail.load(std::memory_order_acquire), m_limit + 1));
+        munmap(base, m_segment_size);
+    }
+    if(s.m_fd >= 0)
+    {
+        close(s.m_fd);
+    }
+    s.m_fd = -1;
+    s.m_base.store(nullptr, std::memory_order_relaxed);
+    s.m_seq.store(0, std::memory_order_release);
+}
+
+void mmap_log_file::wait_committed(const char* base, size_t end)
+{
+    // 段已经封上，end之前到RECORD_NEXT/RECORD_END为止的地方都被占了，等还在复制的线程写完
+    size_t pos = HEADER_SIZE;
+    while(pos < end)
+    {
+        uint32_t word = load_word(base + pos);
+        if(word == RECORD_NEXT || word == RECORD_END)
+        {
+            break;
+        }
+        if((word & RECORD_COMMITTED) == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        pos += record_size(word & ~RECORD_COMMITTED);
+    }
+}
+
+mmap_log_reader::mmap_log_reader(const std::string& segment_file)
+: m_base(nullptr)
+, m_size(0)
+, m_pos(mmap_log_file::HEADER_SIZE)
+, m_seq(0)
+, m_state(READ_EMPTY)
+{
+    int fd = open(segment_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size >= mmap_log_file::HEADER_SIZE)
+    {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(p != MAP_FAILED)
+        {
+            m_base = static_cast<const char*>(p);
+            m_size = st.st_size;
+        }
+    }
+    close(fd);
+    // 刚建出来还没写段头的也当作打不开
+    if(m_base != nullptr && memcmp(m_base, mmap_log_file::MAGIC, mmap_log_file::MAGIC_SIZE) != 0)
+    {
+        munmap(const_cast<char*>(m_base), m_size);
+        m_base = nullptr;
+        return;
+    }
+    if(m_base != nullptr)
+    {
+        memcpy(&m_seq, m_base + mmap_log_file::MAGIC_SIZE, sizeof(m_seq));
+    }
+}
+
+mmap_log_reader::~mmap_log_reader(void)
+{
+    if(m_base != nullptr)
+    {
+        munmap(const_cast<char*>(m_base), m_size);
+    }
+}
+
+uint32_t mmap_log_reader::current_word(void) const
+{
+    if(m_base == nullptr || m_pos + mmap_log_file::RECORD_HEADER > m_size)
+    {
+        return mmap_log_file::RECORD_END;
+    }
+    return load_word(m_base + m_pos);
+}
+
+bool mmap_log_reader::next(std::string& msg)
+{
+    uint32_t word = current_word();
+    if(word == mmap_log_file::RECORD_NEXT)
+    {
+        m_state = READ_NEXT;
+        return false;
+    }
+    if(word == mmap_log_file::RECORD_END)
+    {
+        m_state = READ_END;
+        return false;
+    }
+    if(word == 0)
+    {
+        m_state = READ_EMPTY;
+        return false;
+    }
+    if((word & mmap_log_file::RECORD_COMMITTED) == 0)
+    {
+        m_state = READ_PENDING;
+        return false;
+    }
+    size_t len = word & ~mmap_log_file::RECORD_COMMITTED;
+    if(m_pos + record_size(len) > m_size)
+    {
+        m_state = READ_END;
+        return false;
+    }
+    msg.assign(m_base + m_pos + mmap_log_file::RECORD_HEADER, len);
+    m_pos += record_size(len);
+    m_state = READ_EMPTY;
+    return true;
+}
+
+void mmap_log_reader::skip(void)
+{
+    uint32_t word = current_word();
+    if(word != 0 && (word & mmap_log_file::RECORD_COMMITTED) == 0)
+    {
+        m_pos += record_size(word);
+    }
+}
+
+uint64_t mmap_log_reader::active_segment(const std::string& name)
+{
+    std::vector<uint64_t> segments = mmap_log_file::list_segments(name);
+    for(auto iter = segments.rbegin(); iter != segments.rend(); ++iter)
+    {
+        mmap_log_reader reader(mmap_log_file::segment_name(name, *iter));
+        if(reader.good() && reader.current_word() != 0)
+        {
+            return *iter;
+        }
+    }
+    return segments.empty() ? 0 : segments.front();
+}
+
+} // namespace snower
@@ -0,0 +1,49 @@
+#include <cstdlib>
+#include <new>
+#include "alloc_counter.h"
+
+using namespace std;
+
+atomic<size_t> s_allocations(0);
+
+static void* counted_malloc(size_t size)
+{
+    s_allocations++;
+    void* ret = malloc(size > 0 ? size : 1);
+    if(ret == nullptr)
+    {
+        throw bad_alloc();
+    }
+    return ret;
+}
+
+// 单个对象和数组都替换，保证new/delete两边都落在malloc/free上
+void* operator new(size_t size)
+{
+    return counted_malloc(size);
+}
+
+void* operator new[](size_t size)
+{
+    return counted_malloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
@@ -0,0 +1,10 @@
+#ifndef __TEST_ALLOC_COUNTER_H__
+#define __TEST_ALLOC_COUNTER_H__
+
+#include <atomic>
+#include <cstddef>
+
+// 整个测试程序的堆分配次数，由alloc_counter.cpp里替换的operator new统计
+extern std::atomic<size_t> s_allocations;
+
+#endif // __TEST_ALLOC_COUNTER_H__
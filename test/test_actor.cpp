@@ -1,9 +1,12 @@
+#include <chrono>
 #include <iostream>
+#include <thread>
 #include <gtest/gtest.h>
 #include <snower/actor/actor.h>
 #include <snower/actor/actor_system.h>
 
 using namespace std;
+using namespace std::chrono;
 using namespace snower;
 using namespace snower::actor;
 
@@ -99,9 +102,69 @@ TEST(TestActor, CallActor)
     //as.call(addr);
     send(addr, 4);
     //as.call(addr);
-    this_thread::sleep_for(std::chrono::milliseconds(1000));
+    wait_for_all_actor_done();
     stop(addr);
     ASSERT_FALSE(flag);
     ASSERT_FALSE((bool)addr);
 }
 
+
+class TestSleepyActor : public snower::actor::actor
+{
+public:
+    TestSleepyActor(void)
+    {
+        handle(&TestSleepyActor::touch, this);
+    }
+    void touch(int n)
+    {
+        m_touched += n;
+    }
+
+    int32_t m_touched = 0;
+    int32_t m_hibernated = 0;
+    int32_t m_wakeup = 0;
+
+protected:
+    virtual void on_hibernate(void)
+    {
+        m_hibernated++;
+    }
+    virtual void on_wakeup(void)
+    {
+        m_wakeup++;
+    }
+};
+
+TEST(TestActor, HibernateActor)
+{
+    actor_system& as = singleton<actor_system>::get_instance();
+    auto addr = spawn<TestSleepyActor>();
+    TestSleepyActor* a = (TestSleepyActor*)as.get_actor(addr).get();
+    as.hibernate_idle_actors();
+    ASSERT_EQ(1, a->m_hibernated);
+    ASSERT_EQ(0, a->m_wakeup);
+    as.hibernate_idle_actors();
+    ASSERT_EQ(1, a->m_hibernated);
+    send(addr, 3);
+    wait_for_all_actor_done();
+    ASSERT_EQ(3, a->m_touched);
+    ASSERT_EQ(1, a->m_wakeup);
+    stop(addr);
+}
+
+TEST(TestActor, HibernateByTimer)
+{
+    // 没有消息发送时也由线程池的控制线程定期检查
+    actor_system as;
+    as.set_hibernate_seconds(1);
+    auto addr = as.spawn<TestSleepyActor>();
+    TestSleepyActor* a = (TestSleepyActor*)as.get_actor(addr).get();
+    steady_clock::time_point deadline = steady_clock::now() + seconds(5);
+    while(a->m_hibernated == 0 && steady_clock::now() < deadline)
+    {
+        this_thread::sleep_for(milliseconds(50));
+    }
+    ASSERT_EQ(1, a->m_hibernated);
+    as.stop(addr);
+}
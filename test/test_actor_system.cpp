@@ -1,2 +1,346 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <snower/actor/actor.h>
+#include <snower/actor/actor_system.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace snower;
+using namespace snower::actor;
+
+class TestCountActor : public snower::actor::actor
+{
+public:
+    TestCountActor(void)
+    {
+        handle(&TestCountActor::count, this);
+    }
+    void count(int sleep_ms)
+    {
+        if(sleep_ms > 0)
+        {
+            this_thread::sleep_for(milliseconds(sleep_ms));
+        }
+        m_count++;
+    }
+
+    atomic<int> m_count{ 0 };
+};
+
+TEST(TestActorSystem, WaitForAllActorDone)
+{
+    singletons<logger>::get_instance("actor_system").enable(false);
+    singletons<logger>::get_instance("mailbox").enable(false);
+    actor_system& as = singleton<actor_system>::get_instance();
+    auto addr = spawn<TestCountActor>();
+    TestCountActor* a = (TestCountActor*)as.get_actor(addr).get();
+    for(int i = 0; i < 1000; i++)
+    {
+        send(addr, 0);
+    }
+    ASSERT_TRUE(wait_for_all_actor_done(steady_clock::now() + seconds(10)));
+    ASSERT_EQ(1000, a->m_count.load());
+    stop(addr);
+}
+
+TEST(TestActorSystem, Shutdown)
+{
+    actor_system& as = singleton<actor_system>::get_instance();
+    auto addr = spawn<TestCountActor>();
+    TestCountActor* a = (TestCountActor*)as.get_actor(addr).get();
+    for(int i = 0; i < 100; i++)
+    {
+        send(addr, 0);
+    }
+    ASSERT_TRUE(shutdown(steady_clock::now() + seconds(10)));
+    ASSERT_EQ(100, a->m_count.load());
+    // 关闭之后的消息被丢弃
+    send(addr, 0);
+    ASSERT_TRUE(wait_for_all_actor_done(steady_clock::now() + seconds(1)));
+    ASSERT_EQ(100, a->m_count.load());
+
+    // 到deadline时没处理完的消息被丢弃，start之后可以继续使用
+    as.start();
+    for(int i = 0; i < 20; i++)
+    {
+        send(addr, 20);
+    }
+    ASSERT_FALSE(shutdown(steady_clock::now() + milliseconds(50)));
+    ASSERT_LT(a->m_count.load(), 120);
+    as.start();
+    int before = a->m_count;
+    send(addr, 0);
+    wait_for_all_actor_done();
+    ASSERT_EQ(before + 1, a->m_count.load());
+    stop(addr);
+}
+
+// 发送线程和shutdown并发时，计数不能留下永远处理不到的消息
+TEST(TestActorSystem, ShutdownWhileSending)
+{
+    actor_system as;
+    vector<actor_address> addrs;
+    for(int i = 0; i < 4; i++)
+    {
+        addrs.push_back(as.spawn<TestCountActor>());
+    }
+    for(int round = 0; round < 50; round++)
+    {
+        atomic<bool> stop_flag(false);
+        vector<thread> senders;
+        for(int t = 0; t < 4; t++)
+        {
+            senders.emplace_back([&as, &addrs, &stop_flag, t](){
+                    while(!stop_flag)
+                    {
+                        as.send(addrs[t], 0);
+                    }
+                });
+        }
+        this_thread::sleep_for(microseconds(200));
+        bool drained = as.shutdown((round % 2 == 0) ? steady_clock::time_point::max() : steady_clock::now());
+        stop_flag = true;
+        for(thread& t : senders)
+        {
+            t.join();
+        }
+        if(round % 2 == 0)
+        {
+            ASSERT_TRUE(drained);
+            ASSERT_TRUE(as.wait_for_all_actor_done(steady_clock::now() + seconds(5))) << "round " << round;
+        }
+        // 超时的一轮里留在邮箱的消息在start之后处理完
+        as.start();
+        ASSERT_TRUE(as.wait_for_all_actor_done(steady_clock::now() + seconds(5))) << "round " << round;
+    }
+    as.send(addrs[0], 0);
+    ASSERT_TRUE(as.wait_for_all_actor_done(steady_clock::now() + seconds(5)));
+}
+
+class TestHogActor : public snower::actor::actor
+{
+public:
+    TestHogActor(void)
+    {
+        handle(&TestHogActor::work, this);
+    }
+    // 每个单位忙等5微秒，预算用完时把剩下的工作发给自己
+    void work(int units)
+    {
+        for(int i = 0; i < units; i++)
+        {
+            steady_clock::time_point end = steady_clock::now() + microseconds(5);
+            while(steady_clock::now() < end)
+            {
+            }
+            m_units++;
+            if(yield_point() && i + 1 < units)
+            {
+                m_checkpoints++;
+                send(get_self(), units - i - 1);
+                return;
+            }
+        }
+    }
+
+    atomic<int> m_units{ 0 };
+    atomic<int> m_checkpoints{ 0 };
+};
+
+class TestProbeActor : public snower::actor::actor
+{
+public:
+    TestProbeActor(void)
+    {
+        handle(&TestProbeActor::probe, this);
+    }
+    void probe(int64_t sent_ns)
+    {
+        m_latency.push_back(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() - sent_ns);
+    }
+
+    vector<int64_t> m_latency;
+};
+
+static int64_t probe_p99(uint32_t budget, int& checkpoints)
+{
+    actor_system& as = singleton<actor_system>::get_instance();
+    as.set_reduction_budget(budget);
+    auto hog = spawn<TestHogActor>();
+    auto probe = spawn<TestProbeActor>();
+    TestHogActor* h = (TestHogActor*)as.get_actor(hog).get();
+    TestProbeActor* p = (TestProbeActor*)as.get_actor(probe).get();
+    send(hog, 20000);
+    for(int i = 0; i < 50; i++)
+    {
+        this_thread::sleep_for(milliseconds(1));
+        send(probe, (int64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+    wait_for_all_actor_done();
+    EXPECT_EQ(20000, h->m_units.load());
+    checkpoints = h->m_checkpoints;
+    vector<int64_t> lats = p->m_latency;
+    sort(lats.begin(), lats.end());
+    stop(hog);
+    stop(probe);
+    as.set_reduction_budget(actor_system::REDUCTION_BUDGET);
+    return lats.empty() ? 0 : lats[lats.size() * 99 / 100];
+}
+
+TEST(TestActorSystem, ReductionBudget)
+{
+    int checkpoints = 0;
+    int64_t unlimited = probe_p99(0, checkpoints);
+    ASSERT_EQ(0, checkpoints);
+    int64_t limited = probe_p99(200, checkpoints);
+    ASSERT_GT(checkpoints, 0);
+    cout << "probe p99 latency(us) : unlimited " << unlimited / 1000 << ", budget 200 " << limited / 1000 << endl;
+}
+
+class TestSleepActor : public snower::actor::actor
+{
+public:
+    TestSleepActor(bool section)
+    : m_section(section)
+    {
+        handle(&TestSleepActor::io, this);
+    }
+    // 用sleep模拟一次阻塞的IO调用
+    void io(int ms)
+    {
+        if(m_section)
+        {
+            blocking_section guard;
+            this_thread::sleep_for(milliseconds(ms));
+        }
+        else
+        {
+            this_thread::sleep_for(milliseconds(ms));
+        }
+        m_done++;
+    }
+
+    bool m_section;
+    atomic<int> m_done{ 0 };
+};
+
+// mode : 0 普通spawn，1 spawn_blocking，2 普通spawn + blocking_section
+static int64_t blocking_p99(int mode)
+{
+    const int actors = 4;
+    const int calls = 10;
+    actor_system& as = singleton<actor_system>::get_instance();
+    vector<actor_address> sleepers;
+    for(int i = 0; i < actors; i++)
+    {
+        sleepers.push_back((mode == 1) ? spawn_blocking<TestSleepActor>(false) : spawn<TestSleepActor>(mode == 2));
+    }
+    auto probe = spawn<TestProbeActor>();
+    TestProbeActor* p = (TestProbeActor*)as.get_actor(probe).get();
+    for(int i = 0; i < calls; i++)
+    {
+        for(actor_address& s : sleepers)
+        {
+            send(s, 10);
+        }
+    }
+    for(int i = 0; i < 50; i++)
+    {
+        this_thread::sleep_for(milliseconds(1));
+        send(probe, (int64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+    wait_for_all_actor_done();
+    for(actor_address& s : sleepers)
+    {
+        EXPECT_EQ(calls, ((TestSleepActor*)as.get_actor(s).get())->m_done.load());
+        stop(s);
+    }
+    vector<int64_t> lats = p->m_latency;
+    sort(lats.begin(), lats.end());
+    stop(probe);
+    return lats.empty() ? 0 : lats[lats.size() * 99 / 100];
+}
+
+TEST(TestActorSystem, BlockingDispatcher)
+{
+    int64_t shared = blocking_p99(0);
+    int64_t isolated = blocking_p99(1);
+    int64_t section = blocking_p99(2);
+    cout << "probe p99 latency(us) with blocking actors : shared pool " << shared / 1000 << ", spawn_blocking " << isolated / 1000 << ", blocking_section " << section / 1000 << endl;
+    ASSERT_LT(isolated, duration_cast<nanoseconds>(milliseconds(10)).count());
+}
+
+class TestRelayActor : public snower::actor::actor
+{
+public:
+    TestRelayActor(const actor_address& target)
+    : m_target(target)
+    {
+        handle(&TestRelayActor::relay, this);
+    }
+    void relay(int sleep_ms)
+    {
+        send(m_target, sleep_ms);
+    }
+
+    actor_address m_target;
+};
+
+static int64_t send_ns(actor_system& from, const actor_address& to, int count)
+{
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        from.send(to, 0);
+    }
+    int64_t ret = duration_cast<nanoseconds>(steady_clock::now() - start).count() / count;
+    to.get_system()->wait_for_all_actor_done();
+    return ret;
+}
+
+TEST(TestActorSystem, MultipleSystems)
+{
+    actor_system first;
+    actor_system second;
+    auto a = first.spawn<TestCountActor>();
+    auto b = second.spawn<TestCountActor>();
+    ASSERT_EQ(&first, a.get_system());
+    ASSERT_EQ(&second, b.get_system());
+    TestCountActor* ca = (TestCountActor*)first.get_actor(a).get();
+    TestCountActor* cb = (TestCountActor*)second.get_actor(b).get();
+
+    // 各自的actor表互不相干，同一个名字可以在两个实例里各用一次
+    ASSERT_TRUE(first.spawn_and_named<TestCountActor>("same").get_system() == &first);
+    ASSERT_TRUE(second.spawn_and_named<TestCountActor>("same").get_system() == &second);
+
+    // 不管从哪个实例、自由函数还是actor里发，消息都进接收者所属实例的邮箱
+    auto relay = first.spawn<TestRelayActor>(b);
+    for(int i = 0; i < 100; i++)
+    {
+        first.send(b, 0);
+        send(a, 0);
+        send(relay, 0);
+    }
+    ASSERT_TRUE(first.wait_for_all_actor_done(steady_clock::now() + seconds(10)));
+    ASSERT_TRUE(second.wait_for_all_actor_done(steady_clock::now() + seconds(10)));
+    ASSERT_EQ(100, ca->m_count.load());
+    ASSERT_EQ(200, cb->m_count.load());
+
+    int64_t local = send_ns(second, b, 10000);
+    int64_t remote = send_ns(first, b, 10000);
+    cout << "send cost(ns) : same system " << local << ", other system " << remote << endl;
+
+    // 关闭一个实例不影响另一个
+    ASSERT_TRUE(first.shutdown(steady_clock::now() + seconds(10)));
+    send(a, 0);
+    send(b, 0);
+    ASSERT_TRUE(second.wait_for_all_actor_done(steady_clock::now() + seconds(10)));
+    ASSERT_EQ(100, ca->m_count.load());
+    ASSERT_EQ(20201, cb->m_count.load());
+}
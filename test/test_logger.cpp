@@ -1,8 +1,22 @@
+#include <glob.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 #include <snower/logger.h>
 #include <snower/singleton.h>
+#include "alloc_counter.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -24,3 +38,1048 @@ TEST(TestLogger, ConsoleLogger)
     }
 }
 
+class TestCountAppender : public log_appender
+{
+public:
+    TestCountAppender(void)
+    : log_appender("%T [%L] %F:%l %f - %M")
+    , m_lines(0)
+    , m_bytes(0)
+    {
+    }
+
+protected:
+    virtual void do_write(const std::string& log_msg)
+    {
+        m_lines++;
+        m_bytes += log_msg.size();
+    }
+
+public:
+    atomic<uint64_t> m_lines;
+    atomic<uint64_t> m_bytes;
+};
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 返回调用者线程上平均每条日志消耗的CPU纳秒数，不含后台写线程的部分
+static double log_producer_ns(logger& l, size_t threads, size_t per_thread)
+{
+    vector<thread> producers;
+    atomic<int64_t> cpu_ns(0);
+    for(size_t t = 0; t < threads; t++)
+    {
+        producers.emplace_back([&l, &cpu_ns, per_thread, t](){
+                // 每个线程第一次写日志要建自己的缓冲，新线程的第一次分配还可能碰上之前的测试留下的零碎堆，不算在每次调用的开销里
+                l.INFO("message ", 0, " from producer ", t);
+                int64_t start = thread_cpu_ns();
+                for(size_t i = 1; i < per_thread; i++)
+                {
+                    l.INFO("message ", i, " from producer ", t);
+                }
+                cpu_ns += thread_cpu_ns() - start;
+            });
+    }
+    for(thread& t : producers)
+    {
+        t.join();
+    }
+    return (double)cpu_ns / (threads * (per_thread - 1));
+}
+
+TEST(TestLogger, AsyncThroughput)
+{
+    const size_t threads = 4;
+    const size_t per_thread = 50000;
+    TestCountAppender* sync_counter = new TestCountAppender();
+    logger sync_logger("sync");
+    sync_logger.add_appender(sync_counter);
+    double sync_ns = log_producer_ns(sync_logger, threads, per_thread);
+    ASSERT_EQ(threads * per_thread, sync_counter->m_lines.load());
+
+    TestCountAppender* async_counter = new TestCountAppender();
+    logger async_logger("async");
+    async_logger.add_appender(async_counter);
+    async_logger.set_async();
+    double async_ns = log_producer_ns(async_logger, threads, per_thread);
+    steady_clock::time_point start = steady_clock::now();
+    async_logger.flush();
+    double flush_ms = duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0;
+    ASSERT_EQ(threads * per_thread, async_counter->m_lines.load());
+    ASSERT_EQ(sync_counter->m_bytes.load(), async_counter->m_bytes.load());
+    cout << "log call(ns) : sync " << sync_ns << ", async " << async_ns << " (+" << flush_ms << "ms to drain)" << endl;
+    async_logger.set_async(false);
+}
+
+TEST(TestLogger, AsyncDrop)
+{
+    async_log_writer& w = async_log_writer::get_instance();
+    TestCountAppender* counter = new TestCountAppender();
+    logger l("drop");
+    l.add_appender(counter);
+    l.set_async();
+    w.set_overflow_policy(async_log_writer::OVERFLOW_DROP);
+    w.set_ring_capacity(64);
+    uint64_t dropped = w.dropped();
+    const size_t total = 100000;
+    // 新线程才会用新的缓冲大小
+    thread([&l, total](){
+            for(size_t i = 0; i < total; i++)
+            {
+                l.INFO(i);
+            }
+        }).join();
+    l.flush();
+    dropped = w.dropped() - dropped;
+    w.set_overflow_policy(async_log_writer::OVERFLOW_BLOCK);
+    w.set_ring_capacity(async_log_writer::DEFAULT_CAPACITY);
+    ASSERT_EQ(total, counter->m_lines.load() + dropped);
+    cout << "dropped " << dropped << " of " << total << endl;
+    l.set_async(false);
+}
+
+TEST(TestLogger, FlushOnCrash)
+{
+    const char* path = "/tmp/snower_test_crash.log";
+    unlink(path);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if(pid == 0)
+    {
+        logger l("crash");
+        l.add_appender(new file_appender<file_infinite>("%M", new file_infinite(path)));
+        l.set_async();
+        async_log_writer::get_instance().install_crash_handler();
+        for(int i = 0; i < 1000; i++)
+        {
+            l.INFO("line ", i);
+        }
+        raise(SIGSEGV);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFSIGNALED(status));
+    ASSERT_EQ(SIGSEGV, WTERMSIG(status));
+    ifstream in(path);
+    string line;
+    int lines = 0;
+    while(getline(in, line))
+    {
+        ASSERT_EQ("line " + to_string(lines), line);
+        lines++;
+    }
+    ASSERT_EQ(1000, lines);
+    unlink(path);
+}
+
+static int s_evaluated = 0;
+
+static string expensive_arg(void)
+{
+    s_evaluated++;
+    return string(64, 'x');
+}
+
+TEST(TestLogger, LazyArguments)
+{
+    const int total = 1000000;
+    logger l("lazy");
+    TestCountAppender* counter = new TestCountAppender();
+    l.add_appender(counter);
+    l.set_level(logger::LEVEL_WARN);
+    s_evaluated = 0;
+    l.INFO("value ", expensive_arg());
+    ASSERT_EQ(0, s_evaluated);
+    l.WARN("value ", expensive_arg());
+    ASSERT_EQ(1, s_evaluated);
+    ASSERT_EQ(1u, counter->m_lines.load());
+
+    // 直接调用log时参数总是先求值，宏只在级别满足时求值
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        l.log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_INFO, "value ", expensive_arg());
+    }
+    double eager_ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        l.INFO("value ", expensive_arg());
+    }
+    double lazy_ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    ASSERT_EQ(1 + total, s_evaluated);
+    cout << "disabled log call(ns) : eager " << eager_ns << ", macro " << lazy_ns << endl;
+}
+
+class TestCaptureAppender : public log_appender
+{
+public:
+    using log_appender::log_appender;
+
+protected:
+    virtual void do_write(const std::string& log_msg)
+    {
+        m_lines.push_back(log_msg);
+    }
+
+public:
+    vector<string> m_lines;
+};
+
+struct TestCountedArg
+{
+    int* m_count;
+};
+
+static ostream& operator << (ostream& os, const TestCountedArg& arg)
+{
+    (*arg.m_count)++;
+    return os << "counted";
+}
+
+TEST(TestLogger, PreparsedFormat)
+{
+    logger l("fmt");
+    TestCaptureAppender* capture = new TestCaptureAppender("[%L] %N: %m|%m|%M%%%x");
+    l.add_appender(capture);
+    l.INFO("a", 1, 2.5);
+    l.WARN();
+    l.INFOF("%N %m-%m", 7, "x");
+    ASSERT_EQ(3u, capture->m_lines.size());
+    ASSERT_EQ("[INFO] fmt: a|1|2.5%\n", capture->m_lines[0]);
+    ASSERT_EQ("[WARN] fmt: %m|%m|%M%%x\n", capture->m_lines[1]);
+    ASSERT_EQ("fmt 7-x\n", capture->m_lines[2]);
+
+    // 格式相同的appender只格式化一次
+    int rendered = 0;
+    logger shared("shared");
+    TestCaptureAppender* a1 = new TestCaptureAppender("%m");
+    TestCaptureAppender* a2 = new TestCaptureAppender("%m");
+    TestCaptureAppender* a3 = new TestCaptureAppender("<%m>");
+    shared.add_appender(a1).add_appender(a2).add_appender(a3);
+    shared.INFO(TestCountedArg{ &rendered });
+    ASSERT_EQ(2, rendered);
+    ASSERT_EQ("counted\n", a2->m_lines[0]);
+    ASSERT_EQ("<counted>\n", a3->m_lines[0]);
+
+    // 同一个调用点传不同的格式串变量
+    capture->m_lines.clear();
+    for(const string& format : { string("%m+%m"), string("%m-%m"), string("%m+%m") })
+    {
+        l.INFOF(format, 1, 2);
+    }
+    ASSERT_EQ(3u, capture->m_lines.size());
+    ASSERT_EQ("1+2\n", capture->m_lines[0]);
+    ASSERT_EQ("1-2\n", capture->m_lines[1]);
+    ASSERT_EQ("1+2\n", capture->m_lines[2]);
+}
+
+TEST(TestLogger, AsyncCopiesCStrings)
+{
+    // 异步时C字符串参数在调用返回后就可能失效，必须在提交时复制
+    const int total = 100;
+    logger l("cstr");
+    TestCaptureAppender* capture = new TestCaptureAppender("%M");
+    l.add_appender(capture);
+    l.set_async();
+    for(int i = 0; i < total; i++)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "stack %d", i);
+        string s = "heap string number " + to_string(i);
+        l.INFO(buf, "|", s.c_str(), "|", (char*)buf, "|", (const char*)nullptr);
+        l.INFOF("%m|%m", buf, s.c_str());
+        strcpy(buf, "overwritten");
+        s.assign(s.size(), 'x');
+    }
+    l.flush();
+    ASSERT_EQ((size_t)total * 2, capture->m_lines.size());
+    for(int i = 0; i < total; i++)
+    {
+        string expect = "stack " + to_string(i) + "|heap string number " + to_string(i);
+        ASSERT_EQ(expect + "|stack " + to_string(i) + "|\n", capture->m_lines[i * 2]);
+        ASSERT_EQ(expect + "\n", capture->m_lines[i * 2 + 1]);
+    }
+    l.set_async(false);
+}
+
+TEST(TestLogger, NoAllocationPerCall)
+{
+    const int total = 100000;
+    logger l("alloc");
+    TestCountAppender* counter = new TestCountAppender();
+    l.add_appender(counter);
+    l.INFO("warm up ", 0);
+    size_t before = s_allocations;
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        l.INFO("message ", i);
+    }
+    double ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    double allocs = (double)(s_allocations - before) / total;
+    cout << "sync log call(ns) : " << ns << ", allocations per call : " << allocs << endl;
+    ASSERT_EQ((uint64_t)total + 1, counter->m_lines.load());
+    ASSERT_LT(allocs, 0.01);
+
+    // 格式串编译一次后缓存在调用点，超过短字符串长度的格式也不再分配
+    before = s_allocations;
+    start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        l.INFOF("formatted message number %m", i);
+    }
+    ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    allocs = (double)(s_allocations - before) / total;
+    cout << "sync logf call(ns) : " << ns << ", allocations per call : " << allocs << endl;
+    ASSERT_EQ((uint64_t)total * 2 + 1, counter->m_lines.load());
+    ASSERT_LT(allocs, 0.01);
+}
+
+static void emit_binary_sample(logger& l, int* counted)
+{
+    int value = 42;
+    l.INFO("str", string(" std"), -5, 7u, 1234567890123LL, true, 'c', 2.5, 0.1f);
+    l.WARN((void*)&value, " ", TestCountedArg{ counted }, (unsigned char)'A');
+    l.WARN();
+    l.ERROR(value);
+    l.log(__FILE__, __FUNCTION__, __LINE__, logger::LEVEL_INFO, "direct ", value);
+    l.INFOF("%N formatted %m", value);
+}
+
+static string temp_log_name(const char* tag)
+{
+    return string("/tmp/snower_") + tag + "_" + to_string(getpid()) + ".blog";
+}
+
+TEST(TestLogger, BinaryMatchesText)
+{
+    const string format = "[%L] %N %p %t %F:%l %f - %M|%m|%x";
+    const string name = temp_log_name("match");
+    int counted = 0;
+    logger text("bin");
+    TestCaptureAppender* capture = new TestCaptureAppender(format);
+    text.add_appender(capture);
+    emit_binary_sample(text, &counted);
+    ASSERT_EQ(6u, capture->m_lines.size());
+
+    logger binary("bin");
+    binary.set_binary(make_shared<binary_log_file>(name, format));
+    emit_binary_sample(binary, &counted);
+    binary.flush();
+    ASSERT_EQ(2, counted);
+
+    ifstream in(name, ios::in | ios::binary);
+    binary_log_reader reader(in);
+    ASSERT_TRUE(reader.good());
+    for(const string& expected : capture->m_lines)
+    {
+        stringstream decoded;
+        ASSERT_TRUE(reader.next(decoded));
+        ASSERT_EQ(expected, decoded.str());
+    }
+    stringstream rest;
+    ASSERT_FALSE(reader.next(rest));
+
+    // 解码时可以换一种格式
+    in.clear();
+    in.seekg(0);
+    binary_log_reader timed(in, "%T %m");
+    stringstream decoded;
+    ASSERT_TRUE(timed.next(decoded));
+    ASSERT_EQ(strlen("2007-12-25 01:45:32:123456 str\n"), decoded.str().size());
+    unlink(name.c_str());
+}
+
+// 日志默认的CLOCK_SOURCE_REALTIME取一次时间的CPU纳秒数
+static double clock_read_ns(size_t count)
+{
+    struct timeval tv;
+    int64_t start = thread_cpu_ns();
+    for(size_t i = 0; i < count; i++)
+    {
+        log_clock::now(log_clock::CLOCK_SOURCE_REALTIME, tv);
+    }
+    return (double)(thread_cpu_ns() - start) / count;
+}
+
+TEST(TestLogger, BinaryProducerCost)
+{
+    const size_t threads = 2;
+    const size_t per_thread = 100000;
+    TestCountAppender* counter = new TestCountAppender();
+    logger text("text");
+    text.add_appender(counter);
+    double text_ns = log_producer_ns(text, threads, per_thread);
+
+    const string name = temp_log_name("cost");
+    logger binary("binary");
+    binary.set_binary(make_shared<binary_log_file>(name, counter->format().source()));
+    double binary_ns = log_producer_ns(binary, threads, per_thread);
+    binary.flush();
+    struct stat st;
+    ASSERT_EQ(0, stat(name.c_str(), &st));
+
+    ifstream in(name, ios::in | ios::binary);
+    binary_log_reader reader(in);
+    size_t lines = 0;
+    uint64_t bytes = 0;
+    stringstream decoded;
+    while(reader.next(decoded))
+    {
+        lines++;
+        bytes += decoded.str().size();
+        decoded.str(string());
+    }
+    ASSERT_EQ(threads * per_thread, lines);
+    ASSERT_EQ(counter->m_bytes.load(), bytes);
+    // 两种方式都要取一次时间，这部分二进制模式省不掉，取时间慢的机器上整体的倍数会小很多
+    // (clock_gettime约40ns的虚拟机上只有6倍左右)，所以也输出除去取时间以外的倍数
+    double clock_ns = clock_read_ns(per_thread);
+    cout << "log call(ns) : text " << text_ns << ", binary " << binary_ns << " (" << text_ns / binary_ns << "x), clock "
+        << clock_ns << ", without clock " << (text_ns - clock_ns) / (binary_ns - clock_ns) << "x, "
+        << (double)st.st_size / lines << " bytes per record" << endl;
+    unlink(name.c_str());
+}
+
+static string reference_time(const struct timeval& tv, bool utc)
+{
+    char buff[64];
+    time_t sec = tv.tv_sec;
+    struct tm t;
+    if(utc)
+    {
+        gmtime_r(&sec, &t);
+    }
+    else
+    {
+        localtime_r(&sec, &t);
+    }
+    snprintf(buff, sizeof(buff), "%4d-%02d-%02d %02d:%02d:%02d:%06ld", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday
+            , t.tm_hour, t.tm_min, t.tm_sec, (long int)tv.tv_usec);
+    return buff;
+}
+
+TEST(TestLogger, TimestampFormat)
+{
+    char buff[log_clock::TIME_BUFFER_SIZE];
+    // 同一秒内换微秒、跨秒、本地时间和UTC交替，缓存都要给出和直接格式化一样的结果
+    const struct timeval samples[] = {
+        { 1198546532, 123456 }, { 1198546532, 7 }, { 1198546533, 999999 },
+        { 1198546532, 0 }, { 0, 0 }, { 1893456000, 500000 },
+    };
+    for(const struct timeval& tv : samples)
+    {
+        for(bool utc : { false, true })
+        {
+            size_t len = log_clock::format(buff, tv, utc);
+            ASSERT_EQ(reference_time(tv, utc), string(buff, len));
+        }
+    }
+
+    logger l("clock");
+    TestCaptureAppender* capture = new TestCaptureAppender("%T|%U");
+    l.add_appender(capture);
+    l.INFO();
+    ASSERT_EQ(1u, capture->m_lines.size());
+    ASSERT_EQ(2 * strlen("2007-12-25 01:45:32:123456") + 2, capture->m_lines[0].size());
+}
+
+TEST(TestLogger, TimestampCost)
+{
+    const int total = 1000000;
+    struct timeval tv;
+    struct timeval real;
+    const log_clock::source sources[] = { log_clock::CLOCK_SOURCE_REALTIME, log_clock::CLOCK_SOURCE_COARSE, log_clock::CLOCK_SOURCE_TSC };
+    const char* names[] = { "realtime", "coarse", "tsc" };
+    for(size_t s = 0; s < 3; s++)
+    {
+        log_clock::now(sources[s], tv);
+        gettimeofday(&real, nullptr);
+        int64_t diff_us = ((int64_t)real.tv_sec - tv.tv_sec) * 1000000 + (real.tv_usec - tv.tv_usec);
+        // 粗粒度时钟最多落后一个节拍
+        ASSERT_LT(llabs(diff_us), 20000);
+        steady_clock::time_point start = steady_clock::now();
+        for(int i = 0; i < total; i++)
+        {
+            log_clock::now(sources[s], tv);
+        }
+        double ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+        cout << "clock " << names[s] << "(ns) : " << ns << endl;
+    }
+
+    // 同一秒内的时间戳，缓存之后只格式化微秒
+    char buff[log_clock::TIME_BUFFER_SIZE];
+    size_t bytes = 0;
+    gettimeofday(&tv, nullptr);
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        tv.tv_usec = i % 1000000;
+        bytes += log_clock::format(buff, tv, false);
+    }
+    double cached_ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    start = steady_clock::now();
+    for(int i = 0; i < total / 10; i++)
+    {
+        tv.tv_usec = i % 1000000;
+        bytes += reference_time(tv, false).size();
+    }
+    double reference_ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / (total / 10);
+    ASSERT_EQ((total + total / 10) * strlen("2007-12-25 01:45:32:123456"), bytes);
+    cout << "format time(ns) : cached " << cached_ns << ", localtime_r+snprintf " << reference_ns << endl;
+}
+
+static off_t file_size(const string& name)
+{
+    struct stat st;
+    return (stat(name.c_str(), &st) == 0) ? st.st_size : -1;
+}
+
+TEST(TestLogger, FileFlushPolicy)
+{
+    const string name = temp_log_name("flush");
+    const string line = "buffered line\n";
+    unlink(name.c_str());
+    {
+        file_infinite f(name);
+        f.set_flush_interval(hours(1));
+        f.write(line, logger::LEVEL_INFO);
+        f.write(line, logger::LEVEL_INFO);
+        // 打开了文件，但两行都还在缓冲里
+        ASSERT_EQ(0, file_size(name));
+        f.write(line, logger::LEVEL_WARN);
+        ASSERT_EQ((off_t)line.size() * 3, file_size(name));
+
+        // 攒够缓冲大小时整批写出去
+        f.set_buffer_size(line.size() * 4);
+        for(int i = 0; i < 4; i++)
+        {
+            f.write(line, logger::LEVEL_INFO);
+        }
+        ASSERT_EQ((off_t)line.size() * 3, file_size(name));
+        f.write(line, logger::LEVEL_INFO);
+        ASSERT_EQ((off_t)line.size() * 8, file_size(name));
+
+        f.set_flush_interval(milliseconds(0));
+        f.write(line, logger::LEVEL_INFO);
+        ASSERT_EQ((off_t)line.size() * 9, file_size(name));
+        f.set_flush_interval(hours(1));
+        f.write(line, logger::LEVEL_INFO);
+    }
+    // 析构时写完缓冲
+    ASSERT_EQ((off_t)line.size() * 10, file_size(name));
+    unlink(name.c_str());
+
+    // 之后没有新日志时，后台线程在刷新间隔过后写出缓冲
+    {
+        file_infinite f(name);
+        f.set_flush_interval(milliseconds(200));
+        f.write(line, logger::LEVEL_INFO);
+        ASSERT_EQ(0, file_size(name));
+        steady_clock::time_point deadline = steady_clock::now() + seconds(2);
+        while(file_size(name) == 0 && steady_clock::now() < deadline)
+        {
+            this_thread::sleep_for(milliseconds(10));
+        }
+        ASSERT_EQ((off_t)line.size(), file_size(name));
+    }
+    unlink(name.c_str());
+}
+
+template<typename File>
+static double file_write_ns(File& f, const string& line, int total)
+{
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        f.write(line, logger::LEVEL_INFO);
+    }
+    f.flush();
+    return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+}
+
+static void remove_split_files(const string& name)
+{
+    glob_t files;
+    if(glob((name + ".*").c_str(), 0, nullptr, &files) == 0)
+    {
+        for(size_t i = 0; i < files.gl_pathc; i++)
+        {
+            unlink(files.gl_pathv[i]);
+        }
+    }
+    globfree(&files);
+}
+
+TEST(TestLogger, FileThroughput)
+{
+    const int total = 200000;
+    const string line = "2007-12-25 01:45:32:123456 [INFO] file throughput test line\n";
+    const size_t buffer_sizes[] = { 0, file_object_base::DEFAULT_BUFFER_SIZE };
+    double ns[3][2];
+    for(size_t b = 0; b < 2; b++)
+    {
+        const string infinite = temp_log_name("infinite");
+        unlink(infinite.c_str());
+        {
+            file_infinite f(infinite);
+            f.set_buffer_size(buffer_sizes[b]);
+            ns[0][b] = file_write_ns(f, line, total);
+            ASSERT_EQ((off_t)(line.size() * total), file_size(infinite));
+        }
+        unlink(infinite.c_str());
+
+        // 写的过程中会截断好几次，最后留下的不超过上限
+        const string truncated = temp_log_name("truncated");
+        const size_t limit = 1024 * 1024;
+        {
+            file_truncated f(truncated, limit);
+            f.set_buffer_size(buffer_sizes[b]);
+            ns[1][b] = file_write_ns(f, line, total);
+            log_rotator::get_instance().wait();
+            ASSERT_EQ((off_t)((line.size() * total) % (limit / line.size() * line.size())), file_size(truncated));
+        }
+        unlink(truncated.c_str());
+
+        // 文件名只精确到秒，上限大于总量，测试中不切分
+        const string splitted = temp_log_name("splitted");
+        remove_split_files(splitted);
+        {
+            file_splitted f(splitted, line.size() * total * 2);
+            f.set_buffer_size(buffer_sizes[b]);
+            ns[2][b] = file_write_ns(f, line, total);
+        }
+        glob_t files;
+        ASSERT_EQ(0, glob((splitted + ".*").c_str(), 0, nullptr, &files));
+        ASSERT_EQ(1u, files.gl_pathc);
+        ASSERT_EQ((off_t)(line.size() * total), file_size(files.gl_pathv[0]));
+        globfree(&files);
+        remove_split_files(splitted);
+    }
+    const char* names[] = { "file_infinite", "file_truncated", "file_splitted" };
+    for(size_t i = 0; i < 3; i++)
+    {
+        cout << names[i] << " write(ns) : unbuffered " << ns[i][0] << ", buffered " << ns[i][1]
+            << " (" << ns[i][0] / ns[i][1] << "x)" << endl;
+    }
+}
+
+static size_t count_files(const string& pattern, vector<string>* names = nullptr)
+{
+    glob_t files;
+    size_t ret = 0;
+    if(glob(pattern.c_str(), 0, nullptr, &files) == 0)
+    {
+        ret = files.gl_pathc;
+        for(size_t i = 0; names != nullptr && i < files.gl_pathc; i++)
+        {
+            names->push_back(files.gl_pathv[i]);
+        }
+    }
+    globfree(&files);
+    return ret;
+}
+
+TEST(TestLogger, BackgroundRotation)
+{
+    const int total = 2000;
+    const string line = "2007-12-25 01:45:32:123456 [INFO] background rotation test line\n";
+    const size_t limit = line.size() * 50;
+    const string splitted = temp_log_name("rotate");
+    remove_split_files(splitted);
+    int64_t worst_ns = 0;
+    {
+        // 同一秒里切出的文件加序号，一行也不丢
+        file_splitted f(splitted, limit);
+        f.set_buffer_size(0);
+        for(int i = 0; i < total; i++)
+        {
+            steady_clock::time_point start = steady_clock::now();
+            f.write(line, logger::LEVEL_INFO);
+            worst_ns = max(worst_ns, (int64_t)duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        }
+    }
+    log_rotator::get_instance().wait();
+    vector<string> names;
+    ASSERT_EQ((size_t)(total / 50), count_files(splitted + ".[0-9]*", &names));
+    off_t bytes = 0;
+    for(const string& n : names)
+    {
+        bytes += file_size(n);
+    }
+    ASSERT_EQ((off_t)(line.size() * total), bytes);
+    ASSERT_EQ(0u, count_files(splitted + ".next.*"));
+    remove_split_files(splitted);
+    cout << "splitted write with rotation, worst(us) : " << worst_ns / 1000.0 << endl;
+
+    // 只留下最近的3个，旧文件压缩
+    {
+        file_splitted f(splitted, limit);
+        f.set_max_files(3);
+        f.set_compressor(&log_rotator::gzip);
+        for(int i = 0; i < total; i++)
+        {
+            f.write(line, logger::LEVEL_INFO);
+        }
+    }
+    log_rotator::get_instance().wait();
+    names.clear();
+    ASSERT_EQ(3u, count_files(splitted + ".[0-9]*", &names));
+    ASSERT_EQ(2u, count_files(splitted + ".[0-9]*.gz"));
+    ASSERT_EQ(0u, count_files(splitted + ".next.*"));
+    remove_split_files(splitted);
+
+    // 截断的文件换成新文件以后，留下的是最后写的那些行
+    const string truncated = temp_log_name("rotate_trunc");
+    {
+        file_truncated f(truncated, limit);
+        for(int i = 0; i < total + 10; i++)
+        {
+            f.write(line, logger::LEVEL_INFO);
+        }
+    }
+    log_rotator::get_instance().wait();
+    ASSERT_EQ((off_t)(line.size() * 10), file_size(truncated));
+    ASSERT_EQ(0u, count_files(truncated + ".next.*"));
+    unlink(truncated.c_str());
+}
+
+// 按序号读出name的所有段，返回日志的行数，states记下每个段读完时的状态
+static size_t read_mmap_segments(const string& name, vector<string>& lines, vector<mmap_log_reader::read_state>* states = nullptr)
+{
+    for(uint64_t seq : mmap_log_file::list_segments(name))
+    {
+        mmap_log_reader reader(mmap_log_file::segment_name(name, seq));
+        string msg;
+        while(reader.good() && reader.next(msg))
+        {
+            lines.push_back(msg);
+        }
+        if(states != nullptr)
+        {
+            states->push_back(reader.state());
+        }
+    }
+    return lines.size();
+}
+
+TEST(TestLogger, MmapAppender)
+{
+    const size_t threads = 4;
+    const size_t per_thread = 5000;
+    const string name = temp_log_name("mmap");
+    remove_split_files(name);
+    {
+        // 段取最小值，写的过程中换好几个段
+        logger l("mmap");
+        l.add_appender(new file_appender<mmap_log_file>("%M", new mmap_log_file(name, mmap_log_file::MIN_SEGMENT_SIZE)));
+        vector<thread> producers;
+        for(size_t t = 0; t < threads; t++)
+        {
+            producers.emplace_back([&l, per_thread, t](){
+                    for(size_t i = 0; i < per_thread; i++)
+                    {
+                        l.INFO(t, " ", i);
+                    }
+                });
+        }
+        for(thread& t : producers)
+        {
+            t.join();
+        }
+    }
+    vector<string> lines;
+    vector<mmap_log_reader::read_state> states;
+    ASSERT_EQ(threads * per_thread, read_mmap_segments(name, lines, &states));
+    ASSERT_GT(states.size(), 2u);
+    for(size_t i = 0; i + 1 < states.size(); i++)
+    {
+        ASSERT_EQ(mmap_log_reader::READ_NEXT, states[i]);
+    }
+    ASSERT_EQ(mmap_log_reader::READ_END, states.back());
+    // 每个线程的每一行都正好出现一次
+    vector<vector<bool>> seen(threads, vector<bool>(per_thread, false));
+    for(const string& line : lines)
+    {
+        size_t t = 0, i = 0;
+        ASSERT_EQ(2, sscanf(line.c_str(), "%zu %zu", &t, &i));
+        ASSERT_LT(t, threads);
+        ASSERT_LT(i, per_thread);
+        ASSERT_FALSE(seen[t][i]);
+        seen[t][i] = true;
+    }
+
+    // 再次打开接着原来的序号往后写，不覆盖旧的段
+    uint64_t last = mmap_log_file::list_segments(name).back();
+    {
+        mmap_log_file f(name, mmap_log_file::MIN_SEGMENT_SIZE);
+        ASSERT_EQ(last + 1, f.current_segment());
+        f.write("reopened\n");
+    }
+    ASSERT_EQ(last + 1, mmap_log_reader::active_segment(name));
+    remove_split_files(name);
+}
+
+TEST(TestLogger, MmapCrash)
+{
+    const string name = temp_log_name("mmap_crash");
+    remove_split_files(name);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if(pid == 0)
+    {
+        // 不析构、不刷新，直接被杀掉
+        mmap_log_file* f = new mmap_log_file(name, mmap_log_file::MIN_SEGMENT_SIZE);
+        for(int i = 0; i < 10000; i++)
+        {
+            f->write("line " + to_string(i) + "\n");
+        }
+        raise(SIGKILL);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFSIGNALED(status));
+    vector<string> lines;
+    vector<mmap_log_reader::read_state> states;
+    ASSERT_EQ(10000u, read_mmap_segments(name, lines, &states));
+    for(size_t i = 0; i < lines.size(); i++)
+    {
+        ASSERT_EQ("line " + to_string(i) + "\n", lines[i]);
+    }
+    // 最后一个段没有关闭的标记
+    ASSERT_EQ(mmap_log_reader::READ_EMPTY, states.back());
+    remove_split_files(name);
+
+    // 和写文件描述符的file_infinite比每次写的开销
+    const int total = 200000;
+    const string line = "2007-12-25 01:45:32:123456 [INFO] mmap write test line\n";
+    const string infinite = temp_log_name("mmap_infinite");
+    unlink(infinite.c_str());
+    double mmap_ns = 0, unbuffered_ns = 0, buffered_ns = 0;
+    {
+        mmap_log_file f(name);
+        mmap_ns = file_write_ns(f, line, total);
+    }
+    {
+        file_infinite f(infinite);
+        buffered_ns = file_write_ns(f, line, total);
+        f.set_buffer_size(0);
+        unbuffered_ns = file_write_ns(f, line, total);
+    }
+    unlink(infinite.c_str());
+    lines.clear();
+    ASSERT_EQ((size_t)total, read_mmap_segments(name, lines));
+    remove_split_files(name);
+    cout << "write(ns) : mmap " << mmap_ns << ", file buffered " << buffered_ns << ", file unbuffered " << unbuffered_ns << endl;
+}
+
+// 宏里的限流器是调用点的静态变量，测试重复执行时状态会留下来，数量上的检查用单独的log_limiter
+static void limited_warn(logger& l)
+{
+    l.WARN_LIMIT(100, "limited ", expensive_arg());
+}
+
+static void sampled_warn(logger& l)
+{
+    l.WARN_SAMPLE(2, "sampled ", expensive_arg());
+}
+
+// 返回以prefix开头的行数，汇总行里报告的丢弃条数加到reported上
+static size_t count_limited(const vector<string>& lines, const string& prefix, uint64_t& reported)
+{
+    const string summary = "[限流] 这里有";
+    size_t count = 0;
+    for(const string& line : lines)
+    {
+        if(line.compare(0, prefix.size(), prefix) == 0)
+        {
+            count++;
+        }
+        else if(line.compare(0, summary.size(), summary) == 0)
+        {
+            reported += stoull(line.substr(summary.size()));
+        }
+    }
+    return count;
+}
+
+TEST(TestLogger, RateLimitedSite)
+{
+    const int total = 200000;
+    logger l("limited");
+    TestCaptureAppender* capture = new TestCaptureAppender("%M");
+    l.add_appender(capture);
+    log_site site(l, logger::LEVEL_WARN, __FILE__, __FUNCTION__, __LINE__);
+
+    // 一开始允许连着写一秒的量，之后每秒100行，汇总每秒最多一行
+    log_limiter limiter(100, 0);
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        if(limiter.pass(site))
+        {
+            site("limited ", i);
+        }
+    }
+    double elapsed = duration_cast<microseconds>(steady_clock::now() - start).count() / 1000000.0;
+    uint64_t reported = 0;
+    size_t passed = count_limited(capture->m_lines, "limited ", reported);
+    ASSERT_GE(passed, 100u);
+    // 汇总行也算在每秒的行数里
+    ASSERT_LE(capture->m_lines.size(), 100 + 100 * elapsed + 1);
+    ASSERT_LE(capture->m_lines.size() - passed, elapsed + 1);
+    ASSERT_EQ(total - passed, limiter.suppressed());
+    double suppressed_ns = elapsed * 1e9 / total;
+    // 之后不再有调用，后台线程过了汇总间隔也会报告剩下的丢弃条数
+    this_thread::sleep_for(milliseconds(log_limiter::REPORT_INTERVAL_MS + 300));
+    l.flush();
+    reported = 0;
+    passed = count_limited(capture->m_lines, "limited ", reported);
+    ASSERT_EQ((uint64_t)total, passed + reported);
+    ASSERT_TRUE(limiter.pass(site));
+    site("limited ", total);
+    reported = 0;
+    passed = count_limited(capture->m_lines, "limited ", reported);
+    ASSERT_EQ((uint64_t)total + 1, passed + reported);
+    ASSERT_EQ("limited " + to_string(total) + "\n", capture->m_lines.back());
+
+    // logger::flush时不等汇总间隔，立即报告
+    capture->m_lines.clear();
+    log_limiter quiet(1, 0);
+    ASSERT_TRUE(quiet.pass(site));
+    ASSERT_FALSE(quiet.pass(site));
+    l.flush();
+    reported = 0;
+    count_limited(capture->m_lines, "limited ", reported);
+    ASSERT_EQ(1u, reported);
+
+    // 每10条只写第1条
+    capture->m_lines.clear();
+    log_limiter sampler(0, 10);
+    for(int i = 0; i < 1000; i++)
+    {
+        if(sampler.pass(site))
+        {
+            site("sampled ", i);
+        }
+    }
+    this_thread::sleep_for(milliseconds(log_limiter::REPORT_INTERVAL_MS + 100));
+    ASSERT_TRUE(sampler.pass(site));
+    site("sampled ", 1000);
+    reported = 0;
+    passed = count_limited(capture->m_lines, "sampled ", reported);
+    ASSERT_EQ(101u, passed);
+    ASSERT_EQ(1001u, passed + reported);
+    for(const string& line : capture->m_lines)
+    {
+        if(line.compare(0, 8, "sampled ") == 0)
+        {
+            ASSERT_EQ(0, stoi(line.substr(8)) % 10);
+        }
+    }
+
+    // 宏：被丢掉的调用不对参数求值；上面等过了一秒多，限速的额度是满的
+    capture->m_lines.clear();
+    s_evaluated = 0;
+    sampled_warn(l);
+    sampled_warn(l);
+    ASSERT_EQ(1, s_evaluated);
+    s_evaluated = 0;
+    start = steady_clock::now();
+    for(int i = 0; i < 1000; i++)
+    {
+        limited_warn(l);
+    }
+    elapsed = duration_cast<microseconds>(steady_clock::now() - start).count() / 1000000.0;
+    ASSERT_GE(s_evaluated, 100);
+    ASSERT_LE(s_evaluated, 100 + 100 * elapsed + 1);
+    cout << "limited log call(ns) : " << suppressed_ns << endl;
+}
+
+static logger& cached_registry_logger(void)
+{
+    return SNOWER_LOGGER("registry_cached");
+}
+
+TEST(TestLogger, LoggerRegistry)
+{
+    log_registry& r = log_registry::get_instance();
+    ASSERT_EQ(nullptr, r.find("registry_missing"));
+    logger& a = r.get("registry_a");
+    ASSERT_EQ(&a, r.find("registry_a"));
+    ASSERT_EQ(&a, &singletons<logger>::get_instance("registry_a"));
+    ASSERT_EQ(&r.get("registry_cached"), &cached_registry_logger());
+
+    // 几个线程同时建同一批logger，每个名字只有一个
+    const size_t threads = 4;
+    const size_t names = 200;
+    vector<vector<logger*>> found(threads, vector<logger*>(names, nullptr));
+    vector<thread> workers;
+    for(size_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&r, &found, names, t](){
+                for(size_t i = 0; i < names; i++)
+                {
+                    size_t n = (i + t * 37) % names;
+                    found[t][n] = &r.get("registry_" + to_string(n));
+                }
+            });
+    }
+    for(thread& t : workers)
+    {
+        t.join();
+    }
+    for(size_t t = 1; t < threads; t++)
+    {
+        ASSERT_EQ(found[0], found[t]);
+    }
+
+    // 写日志的线程不停地写，另一边改级别，改完以后的日志按新级别过滤
+    TestCountAppender* counter = new TestCountAppender();
+    a.add_appender(counter);
+    atomic<bool> running(true);
+    thread writer([&a, &running](){
+            while(running)
+            {
+                a.INFO("registry level");
+            }
+        });
+    for(int i = 0; i < 1000; i++)
+    {
+        r.set_level("registry_a", (i % 2) ? logger::LEVEL_ALL : logger::LEVEL_WARN);
+    }
+    r.set_level("registry_a", logger::LEVEL_WARN);
+    running = false;
+    writer.join();
+    uint64_t lines = counter->m_lines.load();
+    a.INFO("registry level");
+    ASSERT_EQ(lines, counter->m_lines.load());
+    r.set_level("registry_a", logger::LEVEL_ALL);
+    a.INFO("registry level");
+    ASSERT_EQ(lines + 1, counter->m_lines.load());
+    a.clear_appender();
+
+    // 按名字查表和调用点缓存的开销
+    const int total = 1000000;
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        ASSERT_EQ(&a, &r.get("registry_a"));
+    }
+    double lookup_ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        ASSERT_FALSE(SNOWER_LOGGER("registry_a").enabled(logger::LEVEL_ALL - 1));
+    }
+    double cached_ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / total;
+    cout << "logger lookup(ns) : by name " << lookup_ns << ", cached " << cached_ns << endl;
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <snower/parallel.h>
+#include <snower/thread_pool.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace snower;
+
+TEST(TestParallel, For)
+{
+    thread_pool<Sequence, Fixed> pool;
+    vector<int> marks(10007, 0);
+    parallel_for(pool, 0, marks.size(), [&](size_t i){ marks[i]++; });
+    for(int m : marks)
+    {
+        ASSERT_EQ(1, m);
+    }
+    parallel_for(pool, 5, 5, [&](size_t i){ marks[i]++; });
+    parallel_for(pool, 0, 3, [&](size_t i){ marks[i]++; }, 100);
+    ASSERT_EQ(2, marks[2]);
+    ASSERT_EQ(1, marks[3]);
+}
+
+TEST(TestParallel, ReduceAndTransform)
+{
+    thread_pool<Sequence, Fixed> pool;
+    uint64_t sum = parallel_reduce(pool, 1, 100001, (uint64_t)0,
+            [](size_t i){ return (uint64_t)i; },
+            [](uint64_t a, uint64_t b){ return a + b; });
+    ASSERT_EQ((uint64_t)100000 * 100001 / 2, sum);
+
+    vector<int> in(1000);
+    for(size_t i = 0; i < in.size(); i++)
+    {
+        in[i] = (int)i;
+    }
+    vector<int> out(in.size());
+    parallel_transform(pool, in.begin(), in.end(), out.begin(), [](int v){ return v * 2; }, 7);
+    for(size_t i = 0; i < out.size(); i++)
+    {
+        ASSERT_EQ((int)i * 2, out[i]);
+    }
+}
+
+TEST(TestParallel, InvokeAndNested)
+{
+    thread_pool<Sequence, Fixed> pool;
+    atomic<int> total(0);
+    parallel_invoke(pool, [&](){ total += 1; }, [&](){ total += 10; }, [&](){ total += 100; });
+    ASSERT_EQ(111, total.load());
+
+    // 在工作线程里再发起parallel_for，调用者参与执行所以不会因为线程都在等待而死锁
+    total = 0;
+    parallel_for(pool, 0, 16, [&](size_t){
+            parallel_for(pool, 0, 100, [&](size_t){ total++; });
+        }, 1);
+    ASSERT_EQ(1600, total.load());
+}
+
+TEST(TestParallel, Exception)
+{
+    thread_pool<Sequence, Fixed> pool;
+    atomic<int> count(0);
+    ASSERT_THROW(parallel_for(pool, 0, 1000, [&](size_t i){
+            count++;
+            if(i == 500)
+            {
+                throw runtime_error("bad index");
+            }
+        }, 10), runtime_error);
+    // 抛异常的那一块停在500，其余的块照常执行完
+    ASSERT_EQ(991, count.load());
+}
+
+TEST(TestParallel, Speedup)
+{
+    const size_t total = 2000000;
+    auto work = [](size_t i){ return sqrt((double)i) * sin((double)i); };
+    vector<double> out(total);
+    steady_clock::time_point start = steady_clock::now();
+    for(size_t i = 0; i < total; i++)
+    {
+        out[i] = work(i);
+    }
+    double serial = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+    thread_pool<Sequence, Fixed> pool(0);
+    start = steady_clock::now();
+    parallel_for(pool, 0, total, [&](size_t i){ out[i] = work(i); });
+    double parallel = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    cout << "threads " << pool.thread_count() + 1 << ", serial " << serial << "s, parallel " << parallel << "s, speedup " << serial / parallel << endl;
+}
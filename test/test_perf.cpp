@@ -1,3 +1,4 @@
+#include <malloc.h>
 #include <chrono>
 #include <gtest/gtest.h>
 #include <snower/actor/actor.h>
@@ -65,3 +66,71 @@ TEST(TestPerformence, PingPong)
     cout << total << endl;
 }
 
+
+class TestIdleActor : public snower::actor::actor
+{
+public:
+    TestIdleActor(void)
+    {
+        handle(&TestIdleActor::touch, this);
+    }
+    void touch(int)
+    {
+    }
+};
+
+static size_t heap_in_use(void)
+{
+#ifdef __GLIBC__
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif // __GLIBC__
+}
+
+// 建一百万个actor要十来秒，默认不跑，用--gtest_also_run_disabled_tests --gtest_filter=*IdleActorMemory运行
+TEST(TestPerformence, DISABLED_IdleActorMemory)
+{
+    const size_t total = 1000000;
+    singletons<logger>::get_instance("actor_system").enable(false);
+    singletons<logger>::get_instance("mailbox").enable(false);
+    actor_system& as = singleton<actor_system>::get_instance();
+
+    vector<actor_address> addrs;
+    addrs.reserve(total);
+    size_t base = heap_in_use();
+    for(size_t i = 0; i < total; i++)
+    {
+        addrs.push_back(spawn<TestIdleActor>());
+    }
+    size_t awake = heap_in_use();
+    as.hibernate_idle_actors();
+    size_t sleep = heap_in_use();
+    cout << "idle actors : " << total << endl;
+    cout << "awake bytes/actor : " << (awake - base) / total << endl;
+    cout << "hibernated bytes/actor : " << (sleep - base) / total << endl;
+    for(actor_address& a : addrs)
+    {
+        stop(a);
+    }
+}
+
+TEST(TestPerformence, SendWithLoggingDisabled)
+{
+    const int total = 200000;
+    singletons<logger>::get_instance("actor_system").enable(false);
+    singletons<logger>::get_instance("mailbox").enable(false);
+    singletons<logger>::get_instance("actor").enable(false);
+
+    auto a = spawn<TestIdleActor>();
+    steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i < total; i++)
+    {
+        send(a, i);
+    }
+    wait_for_all_actor_done();
+    double secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    cout << "sends/s with logging disabled : " << (uint64_t)(total / secs) << endl;
+    stop(a);
+}
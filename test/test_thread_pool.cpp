@@ -1,2 +1,424 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+#include <snower/task.h>
+#include <snower/thread_pool.h>
+#include "alloc_counter.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace snower;
+
+template<typename QueueType>
+double jobs_per_second(size_t producers, size_t total)
+{
+    thread_pool<QueueType, Fixed> pool(4096);
+    atomic<size_t> done(0);
+    steady_clock::time_point start = steady_clock::now();
+    vector<thread> threads;
+    for(size_t p = 0; p < producers; p++)
+    {
+        threads.push_back(thread([&, p](){
+                for(size_t i = p; i < total; i += producers)
+                {
+                    while(!pool.add_job([&](){ done++; }))
+                    {
+                        this_thread::yield();
+                    }
+                }
+            }));
+    }
+    for(thread& t : threads)
+    {
+        t.join();
+    }
+    while(done < total)
+    {
+        this_thread::yield();
+    }
+    double secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    EXPECT_EQ(total, done.load());
+    return total / secs;
+}
+
+TEST(TestThreadPool, LockFreeContention)
+{
+    const size_t total = 200000;
+    size_t max_producers = std::max(4u, thread::hardware_concurrency());
+    for(size_t p = 1; p <= max_producers; p *= 2)
+    {
+        double seq = jobs_per_second<Sequence>(p, total);
+        double lf = jobs_per_second<LockFree>(p, total);
+        cout << "producers " << p << " : Sequence " << (uint64_t)seq << " jobs/s, LockFree " << (uint64_t)lf << " jobs/s" << endl;
+    }
+}
+
+TEST(TestThreadPool, LockFreeUnlimited)
+{
+    // queue_limit为0时环满了要拒绝，不能让生产者一直等
+    atomic<bool> release(false);
+    thread_pool<LockFree, Fixed> pool(0);
+    size_t accepted = 0;
+    while(pool.add_job([&](){ while(!release) this_thread::sleep_for(milliseconds(1)); }))
+    {
+        accepted++;
+        ASSERT_LT(accepted, 200000u);
+    }
+    ASSERT_GE(accepted, 60000u);
+    release = true;
+}
+
+TEST(TestThreadPool, HillClimbing)
+{
+    // 模拟一个在6个线程时吞吐最高的负载
+    auto rate_of = [](uint32_t threads) -> double {
+        return 1000.0 - 50.0 * (threads > 6 ? threads - 6 : 6 - threads) * (threads > 6 ? threads - 6 : 6 - threads);
+    };
+    native::hill_climbing climber(2, 16);
+    uint32_t target = climber.target();
+    for(int i = 0; i < 50; i++)
+    {
+        target = climber.update(rate_of(target), 1000, target);
+    }
+    ASSERT_GE(target, 5u);
+    ASSERT_LE(target, 7u);
+    for(int i = 0; i < 50; i++)
+    {
+        target = climber.update(0, 0, 0);
+    }
+    ASSERT_EQ(2u, target);
+}
+
+TEST(TestThreadPool, AdaptiveThreads)
+{
+    thread_pool<Sequence, AutoManage> pool(100000);
+    pool.set_adjust_interval(10);
+    atomic<size_t> done(0);
+    for(size_t i = 0; i < 2000; i++)
+    {
+        pool.add_job([&](){ this_thread::sleep_for(microseconds(200)); done++; });
+    }
+    while(done < 2000)
+    {
+        ASSERT_LE(pool.thread_count(), native::available_cpus() + 1);
+        this_thread::sleep_for(milliseconds(1));
+    }
+    ASSERT_GE(pool.thread_count(), 1u);
+    cout << "available cpus : " << native::available_cpus() << ", threads : " << pool.thread_count() << endl;
+}
+
+template<typename Strategy>
+void wakeup_latency(const char* name)
+{
+    const size_t rounds = 200;
+    thread_pool<Sequence, Fixed> pool;
+    pool.set_idle_strategy<Strategy>(2000, 200);
+    vector<int64_t> lats;
+    for(size_t i = 0; i < rounds; i++)
+    {
+        this_thread::sleep_for(microseconds(500));
+        atomic<bool> done(false);
+        int64_t lat = 0;
+        steady_clock::time_point start = steady_clock::now();
+        pool.add_job([&](){
+                lat = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+                done = true;
+            });
+        while(!done)
+        {
+            this_thread::yield();
+        }
+        lats.push_back(lat);
+    }
+    sort(lats.begin(), lats.end());
+    cout << name << " wake-up latency(ns) : p50 " << lats[rounds / 2] << ", p99 " << lats[rounds * 99 / 100] << ", max " << lats.back() << endl;
+}
+
+TEST(TestThreadPool, IdleStrategyLatency)
+{
+    wakeup_latency<Park>("Park");
+    wakeup_latency<SpinPark>("SpinPark");
+    wakeup_latency<SpinYield>("SpinYield");
+    wakeup_latency<BusySpin>("BusySpin");
+}
+
+TEST(TestThreadPool, PriorityOrder)
+{
+    native::queue_wrapper<Priority> q(0, 0);
+    vector<int> order;
+    q.add(1, [&](){ order.push_back(1); });
+    q.add(10, [&](){ order.push_back(10); });
+    q.add(5, [&](){ order.push_back(5); });
+    q.add(5, [&](){ order.push_back(6); });
+    q.add(20, [&](){ order.push_back(20); });
+    while(!q.empty())
+    {
+        q.try_get()();
+    }
+    ASSERT_EQ((vector<int>{ 10, 20, 5, 6, 1 }), order);
+
+    q.set_aging_milliseconds(1);
+    q.add(1, [&](){ order.push_back(100); });
+    this_thread::sleep_for(milliseconds(20));
+    q.add(10, [&](){ order.push_back(110); });
+    q.try_get()();
+    ASSERT_EQ(100, order.back());
+    q.try_get()();
+
+    // 关闭aging时加入的任务从开启aging时才开始算等待时间
+    native::queue_wrapper<Priority> late(0, 0);
+    late.add(1, [&](){ order.push_back(200); });
+    this_thread::sleep_for(milliseconds(20));
+    late.set_aging_milliseconds(100);
+    late.add(10, [&](){ order.push_back(210); });
+    late.try_get()();
+    ASSERT_EQ(210, order.back());
+    late.try_get()();
+    ASSERT_EQ(200, order.back());
+}
+
+TEST(TestThreadPool, PriorityBuckets)
+{
+    const size_t total = 1000000;
+    using func_type = function<void ()>;
+    size_t sum = 0;
+    steady_clock::time_point start = steady_clock::now();
+    {
+        multimap<size_t, func_type> m;
+        for(size_t i = 0; i < total; i++)
+        {
+            m.emplace(i % 10 + 1, [&](){ sum++; });
+        }
+        while(!m.empty())
+        {
+            auto iter = m.begin();
+            func_type f = iter->second;
+            m.erase(iter);
+            f();
+        }
+    }
+    double map_secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    start = steady_clock::now();
+    {
+        native::queue_wrapper<Priority, func_type> q(0, 0);
+        for(size_t i = 0; i < total; i++)
+        {
+            q.add(i % 10 + 1, [&](){ sum++; });
+        }
+        while(!q.empty())
+        {
+            q.try_get()();
+        }
+    }
+    double bucket_secs = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    ASSERT_EQ(total * 2, sum);
+    cout << "1M jobs, multimap " << map_secs << "s, buckets " << bucket_secs << "s" << endl;
+}
+
+TEST(TestThreadPool, MoveOnlyTask)
+{
+    unique_ptr<int> value(new int(7));
+    int result = 0;
+    task t([&result, v = move(value)](){ result = *v; });
+    task other(move(t));
+    ASSERT_FALSE((bool)t);
+    ASSERT_TRUE((bool)other);
+    other();
+    ASSERT_EQ(7, result);
+
+    array<size_t, 32> big;
+    big.fill(1);
+    task heap([&result, big](){ result = (int)big.size(); });
+    t = move(heap);
+    t();
+    ASSERT_EQ(32, result);
+    ASSERT_FALSE((bool)task(function<void ()>()));
+}
+
+TEST(TestThreadPool, SubmitAllocations)
+{
+    const size_t total = 100000;
+    atomic<size_t> done(0);
+    // 48字节的捕获，超出了std::function的内部缓冲
+    array<size_t, 5> payload;
+    payload.fill(1);
+    size_t before = 0;
+    {
+        thread_pool<LockFree, Fixed> pool(total);
+        before = s_allocations;
+        for(size_t i = 0; i < total; i++)
+        {
+            pool.add_job([&done, payload](){ done += payload[0]; });
+        }
+        while(done < total)
+        {
+            this_thread::yield();
+        }
+    }
+    double task_allocs = (double)(s_allocations - before) / total;
+
+    done = 0;
+    {
+        native::queue_wrapper<LockFree, function<void ()>> queue(0, total);
+        before = s_allocations;
+        for(size_t i = 0; i < total; i++)
+        {
+            queue.add(0, [&done, payload](){ done += payload[0]; });
+        }
+        while(!queue.empty())
+        {
+            queue.try_get()();
+        }
+    }
+    double function_allocs = (double)(s_allocations - before) / total;
+    ASSERT_EQ(total, done.load());
+    cout << "allocations per job : task " << task_allocs << ", std::function " << function_allocs << endl;
+    ASSERT_LT(task_allocs, 0.01);
+}
+
+TEST(TestThreadPool, AddJobs)
+{
+    const size_t total = 65536;
+    for(size_t batch : { 1, 64, 4096 })
+    {
+        thread_pool<Sequence, Fixed> pool(0);
+        pool.set_worker_batch(16);
+        atomic<size_t> done(0);
+        double submit_secs = 0;
+        vector<task> jobs;
+        for(size_t i = 0; i < total; i += batch)
+        {
+            jobs.clear();
+            for(size_t j = 0; j < batch; j++)
+            {
+                jobs.emplace_back([&](){ done++; });
+            }
+            steady_clock::time_point start = steady_clock::now();
+            ASSERT_EQ(batch, pool.add_jobs(make_move_iterator(jobs.begin()), make_move_iterator(jobs.end())));
+            submit_secs += duration_cast<duration<double>>(steady_clock::now() - start).count();
+        }
+        while(done < total)
+        {
+            this_thread::yield();
+        }
+        cout << "batch " << batch << " : " << (uint64_t)(submit_secs * 1e9 / total) << " ns per job submitted" << endl;
+    }
+
+    thread_pool<Sequence, Fixed> limited(100);
+    vector<function<void ()>> funcs(300, [](){ this_thread::sleep_for(milliseconds(1)); });
+    ASSERT_LE(limited.add_jobs(funcs.begin(), funcs.end()), 100u);
+}
+
+TEST(TestThreadPool, Stats)
+{
+    thread_pool<Sequence, Fixed> pool(100);
+    pool.set_stats_sampling(1);
+    pool.set_worker_batch(4);
+    atomic<size_t> done(0);
+    atomic<bool> go(false);
+    size_t accepted = 0;
+    for(size_t i = 0; i < 200; i++)
+    {
+        if(pool.add_job([&](){ while(!go) { this_thread::yield(); } done++; }))
+        {
+            accepted++;
+        }
+    }
+    thread_pool_stats s = pool.stats();
+    while(s.m_busy < s.m_threads)
+    {
+        this_thread::yield();
+        s = pool.stats();
+    }
+    ASSERT_EQ(accepted, s.m_queued);
+    ASSERT_EQ(s.m_queued, s.m_started + s.m_pending);
+    ASSERT_EQ(200 - accepted, s.m_rejected);
+    ASSERT_GT(s.m_rejected, 0u);
+    ASSERT_EQ(s.m_threads, s.m_busy + s.m_idle);
+    go = true;
+    while(done < accepted)
+    {
+        this_thread::yield();
+    }
+    while(pool.stats().m_completed < accepted)
+    {
+        this_thread::yield();
+    }
+    s = pool.stats();
+    ASSERT_EQ(accepted, s.m_started);
+    ASSERT_EQ(accepted, s.m_wait.m_count);
+    ASSERT_EQ(accepted, s.m_run.m_count);
+    ASSERT_GE(s.m_wait.percentile_ns(0.99), s.m_wait.percentile_ns(0.5));
+    cout << "wait p50 " << s.m_wait.percentile_ns(0.5) << "ns, run p50 " << s.m_run.percentile_ns(0.5) << "ns" << endl;
+}
+
+// 每个任务在提交线程和工作线程上走一遍统计的各个钩子，返回平均的纳秒数
+static double stats_hook_ns(uint32_t sample, size_t count)
+{
+    native::pool_counters counters;
+    steady_clock::time_point start = steady_clock::now();
+    for(size_t i = 0; i < count; i++)
+    {
+        uint64_t enqueued = native::pool_counters::sample_clock(sample);
+        counters.on_queued();
+        counters.on_started();
+        if(enqueued == 0)
+        {
+            counters.on_completed(0, 0);
+        }
+        else
+        {
+            uint64_t begin = native::pool_counters::now_ns();
+            uint64_t end = native::pool_counters::now_ns();
+            counters.on_completed(std::max(begin - std::min(begin, enqueued), (uint64_t)1), std::max(end - begin, (uint64_t)1));
+        }
+    }
+    return duration_cast<duration<double, nano>>(steady_clock::now() - start).count() / count;
+}
+
+TEST(TestThreadPool, StatsOverhead)
+{
+    const size_t total = 200000;
+    // 单核的机器上线程池吞吐量本身的抖动有10%，比较不出2%的差别：
+    // 分别量出关闭统计时每个任务的开销和统计钩子本身的开销，再算比例
+    double best = 0;
+    for(int round = 0; round < 3; round++)
+    {
+        thread_pool<Sequence, Fixed> pool(0);
+        pool.enable_stats(false);
+        atomic<size_t> done(0);
+        steady_clock::time_point start = steady_clock::now();
+        for(size_t i = 0; i < total; i++)
+        {
+            pool.add_job([&](){ done++; });
+        }
+        while(done < total)
+        {
+            this_thread::yield();
+        }
+        best = max(best, total / duration_cast<duration<double>>(steady_clock::now() - start).count());
+    }
+    double job_ns = 1e9 / best;
+    double hooks[3] = { 0, 0, 0 };
+    uint32_t samples[3] = { 0, 64, 1 };
+    for(size_t k = 0; k < 3; k++)
+    {
+        hooks[k] = stats_hook_ns(samples[k], total);
+        for(int round = 0; round < 4; round++)
+        {
+            hooks[k] = min(hooks[k], stats_hook_ns(samples[k], total));
+        }
+    }
+    // 默认的1/64采样一般在1%~1.6%，虚拟机上抖动较大，只输出不比较
+    cout << "job without stats " << job_ns << "ns, stats adds : counting only " << hooks[0] << "ns (" << hooks[0] / job_ns * 100
+        << "%), sampled 1/64 " << hooks[1] << "ns (" << hooks[1] / job_ns * 100
+        << "%), every job " << hooks[2] << "ns (" << hooks[2] / job_ns * 100 << "%)" << endl;
+}
@@ -1,2 +1,170 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <snower/thread_pool.h>
+#include <snower/timer_queue.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace snower;
+
+TEST(TestTimer, HeapOrderAndCancel)
+{
+    using clock_type = steady_clock;
+    timer_heap<int> heap;
+    clock_type::time_point base = clock_type::now();
+    vector<timer_handle> handles;
+    for(int i = 0; i < 100; i++)
+    {
+        int at = (i * 37) % 100;
+        handles.push_back(heap.push(base + milliseconds(at), int(at)));
+    }
+    // 取消所有到期时间是3的倍数的任务
+    for(int i = 0; i < 100; i++)
+    {
+        if(((i * 37) % 100) % 3 == 0)
+        {
+            ASSERT_TRUE(heap.cancel(handles[i]));
+            ASSERT_FALSE(heap.cancel(handles[i]));
+        }
+    }
+    deque<int> out;
+    ASSERT_EQ(0u, heap.pop_expired(base - milliseconds(1), out));
+    heap.pop_expired(base + milliseconds(49), out);
+    heap.pop_expired(base + milliseconds(100), out);
+    ASSERT_TRUE(heap.empty());
+    ASSERT_EQ(66u, out.size());
+    ASSERT_TRUE(is_sorted(out.begin(), out.end()));
+    ASSERT_FALSE(heap.cancel(handles[1]));
+
+    // 槽位复用后旧句柄不能取消新任务
+    timer_handle h = heap.push(base, 1);
+    for(timer_handle& old : handles)
+    {
+        if(old.slot() == h.slot())
+        {
+            ASSERT_FALSE(heap.cancel(old));
+        }
+    }
+    ASSERT_EQ(1u, heap.size());
+    ASSERT_TRUE(heap.cancel(h));
+}
+
+TEST(TestTimer, CancelJob)
+{
+    thread_pool<Schedule, Fixed> pool;
+    atomic<int> done(0);
+    thread_pool<Schedule, Fixed>::job_handle h1 = pool.add_timer_job([&](){ done += 1; }, 20000);
+    thread_pool<Schedule, Fixed>::job_handle h2 = pool.add_timer_job([&](){ done += 10; }, 20000);
+    ASSERT_TRUE((bool)h1);
+    // add_job仍然只返回是否接受
+    bool accepted = pool.add_job([&](){ done += 100; }, 10000000);
+    ASSERT_TRUE(accepted);
+    ASSERT_TRUE(pool.cancel_job(h2));
+    ASSERT_FALSE(pool.cancel_job(h2));
+    this_thread::sleep_for(milliseconds(100));
+    ASSERT_EQ(1, done.load());
+    ASSERT_FALSE(pool.cancel_job(h1));
+}
+
+TEST(TestTimer, QueueLimit)
+{
+    // 还没到期的任务也占queue_limit
+    thread_pool<Schedule, Fixed> pool(10);
+    atomic<int> done(0);
+    vector<thread_pool<Schedule, Fixed>::job_handle> handles;
+    for(int i = 0; i < 100; i++)
+    {
+        thread_pool<Schedule, Fixed>::job_handle h = pool.add_timer_job([&](){ done++; }, 10000000);
+        if(h)
+        {
+            handles.push_back(h);
+        }
+    }
+    ASSERT_EQ(10u, handles.size());
+    ASSERT_FALSE(pool.add_job([&](){ done++; }, 10000000));
+    // 取消一个就腾出一个位置
+    ASSERT_TRUE(pool.cancel_job(handles.back()));
+    ASSERT_TRUE(pool.add_job([&](){ done++; }, 1000));
+    while(done == 0)
+    {
+        this_thread::yield();
+    }
+    for(size_t i = 0; i + 1 < handles.size(); i++)
+    {
+        ASSERT_TRUE(pool.cancel_job(handles[i]));
+    }
+    ASSERT_EQ(1, done.load());
+}
+
+TEST(TestTimer, EarlierDeadline)
+{
+    thread_pool<Schedule, Fixed> pool;
+    atomic<bool> done(false);
+    steady_clock::time_point start = steady_clock::now();
+    pool.add_job([](){}, 5000000);
+    this_thread::sleep_for(milliseconds(10));
+    pool.add_job([&](){ done = true; }, 5000);
+    while(!done)
+    {
+        ASSERT_LT(steady_clock::now() - start, milliseconds(1000));
+        this_thread::yield();
+    }
+}
+
+TEST(TestTimer, EarlierDeadlineNearDue)
+{
+    // 计时线程已经快到期时加入更早的任务，也要按时执行，不能等前一个到期
+    const size_t rounds = 21;
+    thread_pool<Schedule, Fixed> pool;
+    vector<int64_t> lates(rounds, 0);
+    for(size_t i = 0; i < rounds; i++)
+    {
+        atomic<bool> done(false);
+        pool.add_job([](){}, 2000);
+        this_thread::sleep_for(microseconds(1200));
+        steady_clock::time_point due = steady_clock::now() + microseconds(100);
+        pool.add_job([&, i, due](){
+                lates[i] = duration_cast<microseconds>(steady_clock::now() - due).count();
+                done = true;
+            }, 100);
+        while(!done)
+        {
+            this_thread::yield();
+        }
+    }
+    sort(lates.begin(), lates.end());
+    cout << "earlier timer late(us) : p50 " << lates[rounds / 2] << ", max " << lates.back() << endl;
+    ASSERT_LT(lates[rounds / 2], 400);
+}
+
+TEST(TestTimer, Jitter)
+{
+    const size_t rounds = 200;
+    thread_pool<Schedule, Fixed> pool;
+    vector<int64_t> lates(rounds, 0);
+    atomic<size_t> done(0);
+    for(size_t i = 0; i < rounds; i++)
+    {
+        int delay = 1000 + (int)(i % 10) * 100;
+        steady_clock::time_point due = steady_clock::now() + microseconds(delay);
+        pool.add_job([&, i, due](){
+                lates[i] = duration_cast<microseconds>(steady_clock::now() - due).count();
+                done++;
+            }, delay);
+        this_thread::sleep_for(microseconds(500));
+    }
+    while(done < rounds)
+    {
+        this_thread::sleep_for(milliseconds(1));
+    }
+    sort(lates.begin(), lates.end());
+    ASSERT_GE(lates.front(), 0);
+    cout << "timer jitter(us) : p50 " << lates[rounds / 2] << ", p99 " << lates[rounds * 99 / 100] << ", max " << lates.back() << endl;
+}
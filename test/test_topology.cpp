@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <snower/thread_pool.h>
+#include <snower/topology.h>
+
+using namespace std;
+using namespace snower;
+
+static void write_file(const string& name, const string& content)
+{
+    ofstream out(name);
+    out << content << endl;
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+// 每次运行用mkdtemp建自己的临时目录，并行运行的测试互不影响；析构时连同内容一起删掉
+struct TestTempDir
+{
+    TestTempDir(void)
+    {
+        char temp[] = "/tmp/snower_topology_XXXXXX";
+        if(mkdtemp(temp) != nullptr)
+        {
+            m_path = temp;
+        }
+    }
+    ~TestTempDir(void)
+    {
+        if(!m_path.empty())
+        {
+            nftw(m_path.c_str(), &remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        }
+    }
+
+    string m_path;
+};
+
+TEST(TestTopology, ParseCpuList)
+{
+    vector<int> cpus = cpu_topology::parse_cpu_list("0-3,8,10-11");
+    ASSERT_EQ((vector<int>{ 0, 1, 2, 3, 8, 10, 11 }), cpus);
+    ASSERT_TRUE(cpu_topology::parse_cpu_list("").empty());
+}
+
+TEST(TestTopology, FakeSysfs)
+{
+    TestTempDir dir;
+    ASSERT_FALSE(dir.m_path.empty());
+    const string& root = dir.m_path;
+    mkdir((root + "/devices").c_str(), 0755);
+    mkdir((root + "/devices/system").c_str(), 0755);
+    mkdir((root + "/devices/system/cpu").c_str(), 0755);
+    write_file(root + "/devices/system/cpu/online", "0-7");
+    cpu_topology single(root, false);
+    ASSERT_EQ(1u, single.node_count());
+    ASSERT_EQ(8u, single.cpu_count());
+    ASSERT_EQ(3, single.cpu_of_worker(3));
+
+    mkdir((root + "/devices/system/node").c_str(), 0755);
+    mkdir((root + "/devices/system/node/node0").c_str(), 0755);
+    mkdir((root + "/devices/system/node/node1").c_str(), 0755);
+    write_file(root + "/devices/system/node/node0/cpulist", "0-3");
+    write_file(root + "/devices/system/node/node1/cpulist", "4-7");
+    cpu_topology numa(root, false);
+    ASSERT_EQ(2u, numa.node_count());
+    ASSERT_EQ(1, numa.node_of_cpu(5));
+    ASSERT_EQ(0u, numa.node_of_worker(2));
+    ASSERT_EQ(1, numa.cpu_of_worker(2));
+    ASSERT_EQ(5, numa.cpu_of_worker(3));
+}
+
+TEST(TestTopology, PinnedPerNodePool)
+{
+    thread_pool<PerNode<Sequence>, Fixed> pool(10000);
+    pool.set_cpu_affinity();
+    atomic<size_t> done(0);
+    for(size_t i = 0; i < 5000; i++)
+    {
+        while(!pool.add_job([&](){ done++; }))
+        {
+            this_thread::yield();
+        }
+    }
+    while(done < 5000)
+    {
+        this_thread::yield();
+    }
+    ASSERT_EQ(5000u, done.load());
+}
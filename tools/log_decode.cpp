@@ -0,0 +1,33 @@
+#include <fstream>
+#include <iostream>
+#include <snower/binary_log.h>
+
+using namespace std;
+using namespace snower;
+
+// 把二进制日志还原成文本：log_decode <文件> [格式]，不给格式时使用文件里记录的格式
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        cerr << "usage: " << argv[0] << " <binary log file> [format]" << endl;
+        return 1;
+    }
+    ifstream in(argv[1], ios::in | ios::binary);
+    if(!in.is_open())
+    {
+        cerr << "can not open " << argv[1] << endl;
+        return 1;
+    }
+    binary_log_reader reader(in, (argc > 2) ? argv[2] : "");
+    if(!reader.good())
+    {
+        cerr << argv[1] << " is not a binary log file" << endl;
+        return 1;
+    }
+    while(reader.next(cout))
+    {
+    }
+    cout.flush();
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <snower/mmap_log.h>
+
+using namespace std;
+using namespace snower;
+
+// 读内存映射日志：log_tail <日志名> [-f]，打印正在写的段里已经写完的日志；
+// 加上-f时一直等新的日志，段写满后跟到下一个段，写的一方关闭文件时退出
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        cerr << "usage: " << argv[0] << " <mmap log name> [-f]" << endl;
+        return 1;
+    }
+    const string name = argv[1];
+    const bool follow = (argc > 2) && strcmp(argv[2], "-f") == 0;
+    uint64_t seq = mmap_log_reader::active_segment(name);
+    if(seq == 0)
+    {
+        cerr << "no segment of " << name << endl;
+        return 1;
+    }
+    unique_ptr<mmap_log_reader> reader(new mmap_log_reader(mmap_log_file::segment_name(name, seq)));
+    // 一条日志一秒钟还没写完，多半是写它的进程已经不在了
+    const int pending_rounds = 10;
+    int pending = 0;
+    string msg;
+    while(true)
+    {
+        if(!reader->good())
+        {
+            // 下一个段可能还在建
+            if(!follow)
+            {
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(100));
+            reader.reset(new mmap_log_reader(mmap_log_file::segment_name(name, seq)));
+            continue;
+        }
+        while(reader->next(msg))
+        {
+            cout << msg;
+            pending = 0;
+        }
+        mmap_log_reader::read_state state = reader->state();
+        if(state == mmap_log_reader::READ_END)
+        {
+            break;
+        }
+        if(state == mmap_log_reader::READ_NEXT)
+        {
+            reader.reset(new mmap_log_reader(mmap_log_file::segment_name(name, ++seq)));
+            continue;
+        }
+        if(state == mmap_log_reader::READ_PENDING && (!follow || ++pending >= pending_rounds))
+        {
+            reader->skip();
+            pending = 0;
+            continue;
+        }
+        if(!follow)
+        {
+            break;
+        }
+        cout.flush();
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    cout.flush();
+    return 0;
+}